@@ -0,0 +1,387 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../include/activation_functions.h"
+#include "../include/dataset_utils.h"
+#include "../include/evaluation.h"
+#include "../include/helpers.h"
+#include "../include/neural_network.h"
+#include "../include/parameter_handler.h"
+
+/*
+ * Benchmark suite
+ *
+ * Times the data loading, training, inference and evaluation building blocks over a range of batch
+ * sizes and writes the results as JSON, one benchmark per line:
+ *
+ *   NumberClassifierBenchmarks [--data-dir DIR] [--output FILE] [--baseline FILE] [--tolerance FRACTION] [--quick]
+ *
+ * --data-dir     directory with the MNIST IDX files (default ../data); synthetic IDX files
+ *                are generated in the temp directory when they are missing
+ * --output       where to write the JSON results (default: standard output)
+ * --baseline     results of an earlier run; every benchmark whose median got slower by more
+ *                than --tolerance (default 0.10) is reported and the exit code is 1
+ * --quick        fewer and shorter samples, for a smoke test
+ */
+
+struct BenchmarkResult {
+    std::string name;
+    long long iterations = 0;
+    double medianNs = 0.0;
+    double minNs = 0.0;
+    double itemsPerSecond = 0.0;
+};
+
+struct BenchmarkSettings {
+    int samples = 15;
+    double minSampleSeconds = 0.02;
+};
+
+// Keep the compiler from optimising away a benchmarked result
+template <typename T>
+static void keep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+/**
+ * @brief Time a function.
+ *
+ * After one warm-up call, the function is called in rounds long enough to be timed
+ * reliably (at least settings.minSampleSeconds each); the median and fastest per-call
+ * times over settings.samples rounds are reported.
+ *
+ * @param name The benchmark name.
+ * @param items The number of items (e.g. samples) processed per call, for the throughput.
+ * @param settings The number and length of the timed rounds.
+ * @param function The code to time.
+ * @return The timing results.
+ */
+template <typename Function>
+static BenchmarkResult measure(const std::string& name, long long items, const BenchmarkSettings& settings, Function&& function) {
+    using Clock = std::chrono::steady_clock;
+    function();
+
+    long long callsPerSample = 1;
+    while (true) {
+        auto start = Clock::now();
+        for (long long i = 0; i < callsPerSample; ++i) {
+            function();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (seconds >= settings.minSampleSeconds || callsPerSample >= (1LL << 30)) {
+            break;
+        }
+        callsPerSample *= seconds > 0.0 ? std::clamp<long long>(static_cast<long long>(settings.minSampleSeconds / seconds * 1.2), 2, 100) : 100;
+    }
+
+    std::vector<double> perCallNs;
+    for (int sample = 0; sample < settings.samples; ++sample) {
+        auto start = Clock::now();
+        for (long long i = 0; i < callsPerSample; ++i) {
+            function();
+        }
+        perCallNs.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count() / callsPerSample);
+    }
+    std::sort(perCallNs.begin(), perCallNs.end());
+
+    BenchmarkResult result;
+    result.name = name;
+    result.iterations = callsPerSample * settings.samples;
+    result.medianNs = perCallNs[perCallNs.size() / 2];
+    result.minNs = perCallNs.front();
+    result.itemsPerSecond = items * 1e9 / result.medianNs;
+    std::cerr << name << ": " << result.medianNs / 1e3 << " us" << std::endl;
+    return result;
+}
+
+/**
+ * @brief Write a 32-bit integer in the big-endian order of IDX headers.
+ *
+ * @param file The output file.
+ * @param value The value to write.
+ */
+static void writeBigEndian32(std::ofstream& file, std::uint32_t value) {
+    const char bytes[] = {static_cast<char>(value >> 24), static_cast<char>(value >> 16), static_cast<char>(value >> 8), static_cast<char>(value)};
+    file.write(bytes, sizeof(bytes));
+}
+
+/**
+ * @brief Write IDX image and label files of random digit-like images.
+ *
+ * About a fifth of the pixels are lit, roughly the density of MNIST, so sparse code
+ * paths behave as they would on the real data.
+ *
+ * @param imageFile The image file to create (IDX3, 28x28 unsigned bytes).
+ * @param labelFile The label file to create (IDX1).
+ * @param numImages The number of images.
+ */
+static void writeSyntheticIdx(const std::string& imageFile, const std::string& labelFile, int numImages) {
+    std::mt19937 generator(12345);
+    std::uniform_int_distribution<int> pixel(1, 255);
+    std::uniform_int_distribution<int> digit(0, 9);
+    std::bernoulli_distribution lit(0.2);
+
+    std::ofstream images(imageFile, std::ios::binary);
+    writeBigEndian32(images, 2051);
+    writeBigEndian32(images, numImages);
+    writeBigEndian32(images, 28);
+    writeBigEndian32(images, 28);
+    std::vector<char> image(784);
+    for (int i = 0; i < numImages; ++i) {
+        for (char& value : image) {
+            value = static_cast<char>(lit(generator) ? pixel(generator) : 0);
+        }
+        images.write(image.data(), image.size());
+    }
+
+    std::ofstream labels(labelFile, std::ios::binary);
+    writeBigEndian32(labels, 2049);
+    writeBigEndian32(labels, numImages);
+    for (int i = 0; i < numImages; ++i) {
+        labels.put(static_cast<char>(digit(generator)));
+    }
+}
+
+/**
+ * @brief Serialise results as JSON, one benchmark per line.
+ *
+ * @param results The benchmark results.
+ * @param dataSource Where the datasets came from ("mnist" or "synthetic").
+ * @return The JSON document.
+ */
+static std::string toJson(const std::vector<BenchmarkResult>& results, const std::string& dataSource) {
+    std::ostringstream json;
+    json.precision(10);
+    json << "{\n  \"data\": \"" << dataSource << "\",\n  \"benchmarks\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult& result = results[i];
+        json << "    {\"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+             << ", \"median_ns\": " << result.medianNs << ", \"min_ns\": " << result.minNs
+             << ", \"items_per_second\": " << result.itemsPerSecond << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    json << "  ]\n}\n";
+    return json.str();
+}
+
+/**
+ * @brief Read the median times from a results file written by toJson.
+ *
+ * @param filename The baseline file.
+ * @return The median time in nanoseconds of every benchmark, by name.
+ */
+static std::map<std::string, double> readBaseline(const std::string& filename) {
+    std::map<std::string, double> medians;
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return medians;
+    }
+
+    const std::string nameKey = "\"name\": \"";
+    const std::string medianKey = "\"median_ns\": ";
+    std::string line;
+    while (std::getline(file, line)) {
+        std::size_t name = line.find(nameKey);
+        std::size_t median = line.find(medianKey);
+        if (name == std::string::npos || median == std::string::npos) {
+            continue;
+        }
+        name += nameKey.size();
+        medians[line.substr(name, line.find('"', name) - name)] = std::stod(line.substr(median + medianKey.size()));
+    }
+    return medians;
+}
+
+/**
+ * @brief Compare results against a baseline and print the benchmarks that got slower.
+ *
+ * @param results The current results.
+ * @param baseline The baseline medians by name.
+ * @param tolerance The allowed relative slowdown, e.g. 0.1 for 10%.
+ * @return The number of regressions.
+ */
+static int reportRegressions(const std::vector<BenchmarkResult>& results, const std::map<std::string, double>& baseline, double tolerance) {
+    int regressions = 0;
+    for (const BenchmarkResult& result : results) {
+        auto previous = baseline.find(result.name);
+        if (previous == baseline.end() || previous->second <= 0.0) {
+            continue;
+        }
+        const double change = result.medianNs / previous->second - 1.0;
+        if (change > tolerance) {
+            std::cerr << "REGRESSION " << result.name << ": " << previous->second << " ns -> " << result.medianNs
+                      << " ns (+" << std::lround(change * 100.0) << "%)" << std::endl;
+            ++regressions;
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char** argv) {
+    std::string dataDir = "../data";
+    std::string outputFile;
+    std::string baselineFile;
+    double tolerance = 0.10;
+    BenchmarkSettings settings;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--data-dir" && hasValue) {
+            dataDir = argv[++i];
+        } else if (arg == "--output" && hasValue) {
+            outputFile = argv[++i];
+        } else if (arg == "--baseline" && hasValue) {
+            baselineFile = argv[++i];
+        } else if (arg == "--tolerance" && hasValue) {
+            tolerance = std::stod(argv[++i]);
+        } else if (arg == "--quick") {
+            settings.samples = 3;
+            settings.minSampleSeconds = 0.002;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--data-dir DIR] [--output FILE] [--baseline FILE] [--tolerance FRACTION] [--quick]" << std::endl;
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    // Datasets: the real training files if present, otherwise synthetic ones of the same format
+    std::string imageFile = dataDir + "/train-images-idx3-ubyte";
+    std::string labelFile = dataDir + "/train-labels.idx1-ubyte";
+    std::string dataSource = "mnist";
+    if (!std::filesystem::exists(imageFile) || !std::filesystem::exists(labelFile)) {
+        const std::filesystem::path syntheticDir = std::filesystem::temp_directory_path() / "number_classifier_benchmarks";
+        std::filesystem::create_directories(syntheticDir);
+        imageFile = (syntheticDir / "synthetic-images-idx3-ubyte").string();
+        labelFile = (syntheticDir / "synthetic-labels.idx1-ubyte").string();
+        writeSyntheticIdx(imageFile, labelFile, 10000);
+        dataSource = "synthetic";
+        std::cerr << "MNIST files not found in " << dataDir << ", using synthetic data" << std::endl;
+    }
+
+    std::vector<BenchmarkResult> results;
+
+    Eigen::MatrixXf data = readData(imageFile);
+    Eigen::VectorXi labels = readLabels(labelFile);
+    const long long numSamples = data.cols();
+
+    results.push_back(measure("readData", numSamples, settings, [&] { keep(readData(imageFile)); }));
+    results.push_back(measure("readLabels", numSamples, settings, [&] { keep(readLabels(labelFile)); }));
+    results.push_back(measure("toSparseInput", numSamples, settings, [&] { keep(toSparseInput(data)); }));
+
+    const std::vector<int> batchSizes = {1, 16, 64, 256, 1024, 8192};
+    NetworkParameters params = initNetworkParameters();
+    const Eigen::MatrixXf b1 = params.b1;
+    const Eigen::MatrixXf b2 = params.b2;
+
+    for (int batchSize : batchSizes) {
+        if (batchSize > numSamples) {
+            continue;
+        }
+        const std::string suffix = "/" + std::to_string(batchSize);
+        Eigen::MatrixXf X = data.leftCols(batchSize);
+        Eigen::VectorXi Y = labels.head(batchSize);
+
+        Eigen::MatrixXf shuffledX = X;
+        Eigen::VectorXi shuffledY = Y;
+        results.push_back(measure("shuffleDataAndLabels" + suffix, batchSize, settings, [&] {
+            shuffleDataAndLabels(shuffledX, shuffledY);
+            keep(shuffledX);
+        }));
+
+        Eigen::MatrixXf Z1, A1, Z2, A2;
+        std::tie(Z1, A1, Z2, A2) = forwardPropagation(params.W1, b1, params.W2, b2, X);
+
+        results.push_back(measure("forwardPropagation" + suffix, batchSize, settings, [&] {
+            keep(forwardPropagation(params.W1, b1, params.W2, b2, X));
+        }));
+        results.push_back(measure("backwardPropagation" + suffix, batchSize, settings, [&] {
+            keep(backwardPropagation(Z1, A1, Z2, A2, params.W1, params.W2, X, Y));
+        }));
+        TrainingWorkspace workspace(static_cast<int>(X.rows()), static_cast<int>(params.W1.rows()), static_cast<int>(params.W2.rows()), batchSize);
+        NetworkParameters stepParams = params;
+        results.push_back(measure("trainingStep" + suffix, batchSize, settings, [&] {
+            trainingStep(stepParams, X, Y, 0.0f, workspace);
+            keep(stepParams);
+        }));
+        const SparseInputMatrix sparseX = toSparseInput(X);
+        results.push_back(measure("trainingStepSparse" + suffix, batchSize, settings, [&] {
+            forwardPass(stepParams, sparseX, Y, workspace);
+            backwardPass(stepParams, sparseX, Y, workspace);
+            applyGradients(stepParams, workspace, 0.0f);
+            keep(stepParams);
+        }));
+        results.push_back(measure("softmax" + suffix, batchSize, settings, [&] { keep(softmax(Z2)); }));
+        results.push_back(measure("getPredictions" + suffix, batchSize, settings, [&] { keep(getPredictions(A2)); }));
+    }
+
+    // Whole-dataset evaluation: forward pass, argmax, loss and confusion matrix in one chunked pass
+    Evaluator evaluator(static_cast<int>(params.W1.rows()), static_cast<int>(params.W2.rows()));
+    results.push_back(measure("evaluate", numSamples, settings, [&] { keep(evaluator.evaluate(NetworkView(params), data, labels)); }));
+
+    // Parameter updates alone, from the gradients of one step, for each optimizer
+    {
+        const int batchSize = static_cast<int>(std::min<long long>(64, numSamples));
+        TrainingWorkspace workspace(static_cast<int>(data.rows()), static_cast<int>(params.W1.rows()), static_cast<int>(params.W2.rows()), batchSize);
+        NetworkParameters stepParams = params;
+        trainingStep(stepParams, data.leftCols(batchSize), labels.head(batchSize), 0.0f, workspace);
+        const std::pair<const char*, OptimizerType> optimizers[] = {
+            {"sgd", OPTIMIZER_SGD}, {"momentum", OPTIMIZER_MOMENTUM}, {"nesterov", OPTIMIZER_NESTEROV}, {"adam", OPTIMIZER_ADAM}};
+        for (const auto& [name, type] : optimizers) {
+            std::unique_ptr<Optimizer> optimizer = makeOptimizer(OptimizerConfig{type}, stepParams);
+            results.push_back(measure(std::string("optimizerStep/") + name, stepParams.W1.size() + stepParams.W2.size(), settings, [&] {
+                optimizer->step(stepParams, workspace, 0.0f);
+                keep(stepParams);
+            }));
+        }
+    }
+
+    // Model loading, in the current format and the legacy headerless one
+    const std::filesystem::path modelDir = std::filesystem::temp_directory_path() / "number_classifier_benchmarks";
+    std::filesystem::create_directories(modelDir);
+    const std::string modelFile = (modelDir / "model_v2.bin").string();
+    const std::string legacyModelFile = (modelDir / "model_legacy.bin").string();
+    if (!saveParameters(params.W1, params.b1, params.W2, params.b2, modelFile)) {
+        return 1;
+    }
+    {
+        std::ofstream legacy(legacyModelFile, std::ios::binary);
+        const int dims[] = {static_cast<int>(params.W1.rows()), static_cast<int>(params.W1.cols()), static_cast<int>(params.W2.rows()),
+                            static_cast<int>(params.W2.cols()), static_cast<int>(params.b1.rows()), static_cast<int>(params.b2.rows())};
+        legacy.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+        legacy.write(reinterpret_cast<const char*>(params.W1.data()), sizeof(float) * params.W1.size());
+        legacy.write(reinterpret_cast<const char*>(params.W2.data()), sizeof(float) * params.W2.size());
+        legacy.write(reinterpret_cast<const char*>(params.b1.data()), sizeof(float) * params.b1.size());
+        legacy.write(reinterpret_cast<const char*>(params.b2.data()), sizeof(float) * params.b2.size());
+    }
+    results.push_back(measure("loadParameters/v2", 1, settings, [&] { keep(loadParameters(modelFile)); }));
+    results.push_back(measure("loadParameters/legacy", 1, settings, [&] { keep(loadParameters(legacyModelFile)); }));
+
+    const std::string json = toJson(results, dataSource);
+    if (outputFile.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream output(outputFile);
+        output << json;
+    }
+
+    if (!baselineFile.empty()) {
+        std::map<std::string, double> baseline = readBaseline(baselineFile);
+        if (baseline.empty()) {
+            return 1;
+        }
+        int regressions = reportRegressions(results, baseline, tolerance);
+        std::cerr << regressions << " regression(s) against " << baselineFile << std::endl;
+        return regressions > 0 ? 1 : 0;
+    }
+    return 0;
+}
@@ -3,10 +3,18 @@
 
 #include <Eigen/Dense>
 
-Eigen::MatrixXf ReLU(Eigen::MatrixXf Z);
+Eigen::MatrixXf ReLU(const Eigen::MatrixXf& Z);
 
 Eigen::MatrixXf softmax(const Eigen::MatrixXf& Z);
 
-Eigen::MatrixXf ReLU_derivative(Eigen::MatrixXf Z);
+Eigen::MatrixXf ReLU_derivative(const Eigen::MatrixXf& Z);
 
-#endif
\ No newline at end of file
+void biasReLU(Eigen::Ref<Eigen::MatrixXf> Z, const Eigen::Ref<const Eigen::VectorXf>& b, Eigen::Ref<Eigen::MatrixXf> A);
+
+void softmaxInPlace(Eigen::Ref<Eigen::MatrixXf> Z);
+
+float crossEntropyFromLogits(const Eigen::Ref<const Eigen::MatrixXf>& Z, const Eigen::VectorXi& Y);
+
+float softmaxCrossEntropy(const Eigen::Ref<const Eigen::MatrixXf>& Z, const Eigen::VectorXi& Y, Eigen::Ref<Eigen::MatrixXf> A);
+
+#endif
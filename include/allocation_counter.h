@@ -0,0 +1,15 @@
+#ifndef ALLOCATION_COUNTER
+#define ALLOCATION_COUNTER
+
+#include <cstddef>
+
+bool heapAllocationCountingSupported();
+
+std::size_t heapAllocationCount();
+
+// Called by the allocator hooks (src/allocation_hooks.cpp), which only test builds link in
+void enableHeapAllocationCounting();
+
+void recordHeapAllocation();
+
+#endif
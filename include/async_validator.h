@@ -0,0 +1,58 @@
+#ifndef ASYNC_VALIDATOR
+#define ASYNC_VALIDATOR
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "neural_network.h"
+
+struct ValidationResult {
+    int iteration = 0;        // iteration or epoch the parameters were taken after, counting from 1
+    double accuracy = 0.0;
+    double loss = 0.0;        // mean cross-entropy
+};
+
+// Evaluates copies of the parameters on a background thread while training continues.
+// At most one snapshot waits besides the one being evaluated; a newer one replaces it.
+class AsyncValidator {
+public:
+    // Fills in the accuracy and loss of a snapshot; the iteration is set by the validator
+    typedef std::function<ValidationResult(const NetworkParameters& params)> Evaluate;
+    typedef std::function<void(const ValidationResult& result)> Report;
+
+    AsyncValidator(Evaluate evaluate, Report report);
+    ~AsyncValidator();
+
+    AsyncValidator(const AsyncValidator&) = delete;
+    AsyncValidator& operator=(const AsyncValidator&) = delete;
+
+    void submit(int iteration, const NetworkView& params);
+    void wait();
+
+    std::optional<ValidationResult> latest() const;
+    int replaced() const;
+
+private:
+    void workerLoop();
+
+    Evaluate evaluate_;
+    Report report_;
+
+    NetworkParameters pending_;     // snapshot waiting to be evaluated
+    NetworkParameters evaluating_;  // snapshot the worker is evaluating; swapped with pending_
+    int pendingIteration_ = 0;
+    bool hasPending_ = false;
+    bool busy_ = false;
+    bool stopping_ = false;
+    int replaced_ = 0;              // snapshots dropped because a newer one arrived first
+    std::optional<ValidationResult> latest_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    std::thread worker_;
+};
+
+#endif
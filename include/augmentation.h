@@ -0,0 +1,56 @@
+#ifndef AUGMENTATION
+#define AUGMENTATION
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <Eigen/Core>
+
+#include "batch_prefetcher.h"
+#include "thread_pool.h"
+
+struct AugmentationConfig {
+    float maxShift = 2.0f;             // pixels, drawn uniformly in each direction
+    float maxRotationDegrees = 10.0f;  // drawn uniformly, clockwise or anticlockwise
+    float elasticAlpha = 34.0f;        // scale of the elastic displacement field, 0 to disable
+    float elasticSigma = 4.0f;         // smoothness of the distortion: standard deviation of its Gaussian in pixels
+};
+
+// Replaces every image of a batch by a random variant: a shift, a rotation about the centre
+// and an elastic distortion, resampled bilinearly. The variant of a sample depends only on the
+// seed, the sample's dataset index and the epoch, so it does not change with batch order or
+// thread count. Images are row-major, one per column. Buffers are allocated at construction.
+class ImageAugmenter {
+public:
+    ImageAugmenter(int width, int height, const AugmentationConfig& config, unsigned int seed, int numThreads = 1);
+
+    ImageAugmenter(const ImageAugmenter&) = delete;
+    ImageAugmenter& operator=(const ImageAugmenter&) = delete;
+
+    void augment(Eigen::MatrixXf& batchData, const int* sampleIndices, int epoch);
+    void augmentImage(Eigen::Ref<Eigen::VectorXf> image, int sampleIndex, int epoch, int workspace = 0);
+
+private:
+    // Per-thread buffers, one value per pixel
+    struct Workspace {
+        Eigen::ArrayXf original;
+        Eigen::ArrayXf fieldX, fieldY;  // elastic displacement
+        Eigen::ArrayXf smoothed;        // first pass of the separable Gaussian
+        Eigen::ArrayXf sourceX, sourceY;
+    };
+
+    void smoothField(Eigen::ArrayXf& field, Eigen::ArrayXf& smoothed) const;
+
+    int width_;
+    int height_;
+    AugmentationConfig config_;
+    std::uint64_t seed_;
+    Eigen::ArrayXf gridX_, gridY_;  // pixel coordinates relative to the image centre
+    std::vector<float> kernel_;     // normalised Gaussian weights, kernel_[radius] at the centre
+    std::vector<Workspace> workspaces_;
+    std::unique_ptr<ThreadPool> pool_;
+};
+
+BatchAugmentation makeImageAugmentation(int width, int height, const AugmentationConfig& config, unsigned int seed, int numThreads = 1);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef BATCH_PREFETCHER
+#define BATCH_PREFETCHER
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <Eigen/Core>
+
+#include "dataset_utils.h"
+
+// Modifies a gathered batch in place on the loader thread, e.g. to augment the images.
+// sampleIndices[j] is the dataset index of column j; epoch counts from 0.
+typedef std::function<void(Eigen::MatrixXf& batchData, const int* sampleIndices, int epoch)> BatchAugmentation;
+
+struct PrefetchedBatch {
+    Eigen::MatrixXf X;
+    Eigen::VectorXi Y;
+};
+
+// Gathers, normalises and augments the next batches on a background thread into a second
+// buffer while the current batch trains
+class BatchPrefetcher {
+public:
+    BatchPrefetcher(const Eigen::MatrixXf& data, const Eigen::VectorXi& labels, const DatasetPermutation& permutation, int batchSize, BatchAugmentation augment = nullptr, int firstEpoch = 0);
+    BatchPrefetcher(const PixelMatrix& data, const Eigen::VectorXi& labels, const DatasetPermutation& permutation, int batchSize, BatchAugmentation augment = nullptr, int firstEpoch = 0);
+    ~BatchPrefetcher();
+
+    BatchPrefetcher(const BatchPrefetcher&) = delete;
+    BatchPrefetcher& operator=(const BatchPrefetcher&) = delete;
+
+    void startEpoch(int numBatches);
+    const PrefetchedBatch& next();
+
+    double inputStallSeconds() const { return inputStallNanoseconds_.load(std::memory_order_relaxed) * 1e-9; }
+    double loaderStallSeconds() const { return loaderStallNanoseconds_.load(std::memory_order_relaxed) * 1e-9; }
+    void resetStallCounters();
+
+private:
+    typedef std::function<void(int start, Eigen::MatrixXf& batchData, Eigen::VectorXi& batchLabels)> Gather;
+
+    BatchPrefetcher(Gather gather, const DatasetPermutation& permutation, int rows, int batchSize, BatchAugmentation augment, int firstEpoch);
+    void loaderLoop();
+
+    Gather gather_;
+    const DatasetPermutation& permutation_;
+    BatchAugmentation augment_;
+    int batchSize_;
+
+    std::array<PrefetchedBatch, 2> buffers_;
+    std::array<bool, 2> ready_{};  // buffer holds a batch the trainer has not taken yet
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    int epoch_ = -1;
+    int numBatches_ = 0;
+    int produced_ = 0;
+    int consumed_ = 0;
+    bool holding_ = false;  // the trainer still uses the buffer of the last batch it took
+    bool stopping_ = false;
+
+    std::atomic<std::int64_t> inputStallNanoseconds_{0};   // trainer waiting for the loader
+    std::atomic<std::int64_t> loaderStallNanoseconds_{0};  // loader waiting for a free buffer
+    std::thread loader_;
+};
+
+#endif
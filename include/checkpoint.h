@@ -0,0 +1,73 @@
+#ifndef CHECKPOINT
+#define CHECKPOINT
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Eigen/Core>
+
+#include "optimizer.h"
+
+struct CheckpointConfig {
+    std::string file;     // empty disables checkpointing
+    int interval = 1;     // iterations of full-batch descent, or mini-batch epochs, between checkpoints
+    bool resume = false;  // continue from file if it exists instead of starting from new parameters
+};
+
+// Everything needed to continue a training run exactly where it stopped
+struct TrainingCheckpoint {
+    Eigen::MatrixXf W1;
+    Eigen::VectorXf b1;
+    Eigen::MatrixXf W2;
+    Eigen::VectorXf b2;
+    OptimizerState optimizerState;
+    int completed = 0;                          // iterations or epochs finished
+    std::vector<int> permutation;               // sample order of the last epoch, empty for full-batch descent
+    std::vector<std::uint32_t> generatorState;  // shuffle generator, empty for full-batch descent
+};
+
+bool saveCheckpoint(const TrainingCheckpoint& checkpoint, const std::string& filename);
+
+std::optional<TrainingCheckpoint> loadCheckpoint(const std::string& filename);
+
+// Writes checkpoints on a background thread, so training only pays for copying the state.
+// At most one checkpoint waits besides the one being written; a newer one replaces it.
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(const std::string& filename);
+    ~CheckpointWriter();
+
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    void submit(const TrainingCheckpoint& checkpoint);
+    void wait();
+
+    int written() const;
+    int failed() const;
+
+private:
+    void workerLoop();
+
+    std::string filename_;
+    std::string temporaryName_;
+
+    std::vector<unsigned char> staging_;  // file image being assembled by submit()
+    std::vector<unsigned char> pending_;  // complete file image waiting to be written
+    std::vector<unsigned char> writing_;  // file image the worker is writing; the three are swapped, never copied
+    bool hasPending_ = false;
+    bool busy_ = false;
+    bool stopping_ = false;
+    int written_ = 0;
+    int failed_ = 0;
+
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    std::thread worker_;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef DATA_PARALLEL
+#define DATA_PARALLEL
+
+#include <vector>
+#include <Eigen/Core>
+
+#include "batch_prefetcher.h"
+#include "dataset_utils.h"
+#include "neural_network.h"
+#include "optimizer.h"
+#include "thread_pool.h"
+#include "training_telemetry.h"
+
+// Splits every batch across a thread pool; each shard computes gradients into a private
+// workspace, which are then combined by a fixed-order tree reduction before the update.
+// An optional augmentation hook is run on every shard between gathering and the forward pass.
+class DataParallelStep {
+public:
+    DataParallelStep(ThreadPool& pool, int inputSize, int hiddenSize, int outputSize, int batchSize, Optimizer* optimizer = nullptr,
+                     BatchAugmentation augment = nullptr);
+
+    // The epoch passed to the augmentation hook, counting from 0
+    void startEpoch(int epoch) { epoch_ = epoch; }
+    void run(NetworkParameters& params, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y, const DatasetPermutation& permutation, int start, float alpha,
+             TrainingTelemetry* telemetry = nullptr, const int* sampleIndices = nullptr);
+    void run(NetworkParameters& params, const PixelMatrix& X, const Eigen::VectorXi& Y, const DatasetPermutation& permutation, int start, float alpha,
+             TrainingTelemetry* telemetry = nullptr, const int* sampleIndices = nullptr);
+
+    const TrainingWorkspace& reducedGradients() const { return workspaces_.front(); }
+    int numCorrect() const { return numCorrect_; }
+    float loss() const { return loss_; }
+
+private:
+    template <typename Data>
+    void computeShards(const NetworkParameters& params, const Data& X, const Eigen::VectorXi& Y, const DatasetPermutation& permutation, int start,
+                       TrainingTelemetry* telemetry, const int* sampleIndices);
+    void reduce();
+    template <typename Data>
+    void step(NetworkParameters& params, const Data& X, const Eigen::VectorXi& Y, const DatasetPermutation& permutation, int start, float alpha,
+              TrainingTelemetry* telemetry, const int* sampleIndices);
+
+    ThreadPool& pool_;
+    Optimizer* optimizer_;
+    BatchAugmentation augment_;
+    int epoch_ = 0;
+    int batchSize_;
+    std::vector<int> shardStarts_;
+    std::vector<Eigen::MatrixXf> shardX_;
+    std::vector<Eigen::VectorXi> shardY_;
+    std::vector<TrainingWorkspace> workspaces_;
+    std::vector<int> shardCorrect_;
+    int numCorrect_ = 0;
+    float loss_ = 0.0f;
+};
+
+#endif
@@ -1,10 +1,45 @@
 #ifndef DATASET_UTILS
 #define DATASET_UTILS
 
+#include <cstdint>
+#include <optional>
+#include <random>
 #include <vector>
 #include <Eigen/Dense>
 
-Eigen::MatrixXf readData(const std::string& filename);
+// Raw 8-bit images, one image per column, for keeping datasets resident at a quarter of the float size
+typedef Eigen::Matrix<unsigned char, Eigen::Dynamic, Eigen::Dynamic> PixelMatrix;
+
+class DatasetPermutation {
+public:
+    explicit DatasetPermutation(int size, std::optional<unsigned int> seed = std::nullopt);
+
+    void shuffle();
+
+    // For checkpoints: the generator state, and restoring the order and generator of a saved run
+    std::vector<std::uint32_t> generatorState() const;
+    bool restore(const std::vector<int>& indices, const std::vector<std::uint32_t>& generatorState);
+
+    const std::vector<int>& indices() const { return indices_; }
+    int size() const { return static_cast<int>(indices_.size()); }
+
+private:
+    std::vector<int> indices_;
+    std::mt19937 generator_;
+};
+
+// Shuffle generator state as 32-bit words, for checkpoints
+std::vector<std::uint32_t> saveGeneratorState(const std::mt19937& generator);
+
+bool restoreGeneratorState(std::mt19937& generator, const std::vector<std::uint32_t>& state);
+
+bool isPermutation(const std::vector<int>& indices, int size);
+
+int32_t readBigEndian32(const unsigned char* bytes);
+
+Eigen::MatrixXf readData(const std::string& filename, int numThreads = 0);
+
+PixelMatrix readRawData(const std::string& filename);
 
 Eigen::VectorXi  readLabels(const std::string& filename);
 
@@ -12,4 +47,12 @@ void savePGM(const std::string& filename, const Eigen::MatrixXf& image);
 
 void shuffleDataAndLabels(Eigen::MatrixXf& data, Eigen::VectorXi& labels);
 
+void gatherBatch(const Eigen::MatrixXf& data, const Eigen::VectorXi& labels, const DatasetPermutation& permutation, int start,
+                 Eigen::MatrixXf& batchData, Eigen::VectorXi& batchLabels);
+
+void gatherBatch(const PixelMatrix& data, const Eigen::VectorXi& labels, const DatasetPermutation& permutation, int start,
+                 Eigen::MatrixXf& batchData, Eigen::VectorXi& batchLabels);
+
+void normalisePixels(const Eigen::Ref<const PixelMatrix>& pixels, Eigen::MatrixXf& normalised);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef EVALUATION
+#define EVALUATION
+
+#include <ostream>
+#include <Eigen/Core>
+
+#include "dataset_utils.h"
+#include "idx_stream.h"
+#include "neural_network.h"
+
+// Accuracy, loss and confusion matrix of a network on a labelled dataset
+struct EvaluationReport {
+    int numSamples = 0;
+    int numCorrect = 0;
+    int numInvalidLabels = 0;   // samples skipped because their label is outside [0, numClasses)
+    double totalLoss = 0.0;     // summed cross-entropy over the samples
+    Eigen::MatrixXi confusion;  // confusion(true label, predicted label)
+
+    double accuracy() const;
+    double loss() const;
+    double precision(int label) const;
+    double recall(int label) const;
+};
+
+// Evaluates a network chunk by chunk. Each sample's logits are scanned once for the prediction
+// and the loss, with no softmax, predictions or one-hot matrices. Buffers are allocated at
+// construction, and the one for normalising raw 8-bit data on its first use, so evaluating
+// never allocates after that.
+class Evaluator {
+public:
+    Evaluator(int hiddenSize, int numClasses, int chunkSize = 1000);
+
+    const EvaluationReport& evaluate(const NetworkView& network, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y);
+    const EvaluationReport& evaluate(const NetworkView& network, const PixelMatrix& X, const Eigen::VectorXi& Y);
+    const EvaluationReport& evaluate(const NetworkView& network, IdxStream& stream);
+
+    // For data that arrives in pieces: reset, accumulate every piece, then read the report
+    void reset();
+    void accumulate(const NetworkView& network, const Eigen::Ref<const Eigen::MatrixXf>& X, const Eigen::Ref<const Eigen::VectorXi>& Y);
+    void accumulate(const NetworkView& network, const Eigen::Ref<const PixelMatrix>& X, const Eigen::Ref<const Eigen::VectorXi>& Y);
+    const EvaluationReport& report() const { return report_; }
+
+private:
+    void accumulateChunk(const NetworkView& network, const Eigen::Ref<const Eigen::MatrixXf>& X, const Eigen::Ref<const Eigen::VectorXi>& Y);
+
+    int chunkSize_;
+    Eigen::MatrixXf input_;   // normalised chunk of a raw 8-bit dataset, empty until one is evaluated
+    Eigen::MatrixXf hidden_;
+    Eigen::MatrixXf logits_;
+    EvaluationReport report_;
+};
+
+void printEvaluationReport(std::ostream& output, const EvaluationReport& report);
+
+#endif
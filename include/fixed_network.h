@@ -0,0 +1,153 @@
+#ifndef FIXED_NETWORK
+#define FIXED_NETWORK
+
+#include <Eigen/Core>
+
+#include "activation_functions.h"
+#include "neural_network.h"
+
+/*
+ * Fixed-topology network
+ *
+ * The same two layer network as NetworkParameters, with the layer sizes known at compile
+ * time so Eigen can specialise and unroll the kernels for those shapes. The dynamic
+ * functions in neural_network.h remain the fallback for any other topology.
+ *
+ * Inference keeps its own copy of the weights, with W1 stored row-major so each hidden
+ * neuron is a contiguous dot product over the image. Training works in place on
+ * NetworkParameters through fixed-size maps, so optimisers and checkpoints see the
+ * usual dynamic matrices.
+ */
+template <int Inputs, int Hidden, int Outputs>
+class FixedNetwork {
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    typedef Eigen::Matrix<float, Hidden, Inputs, Eigen::RowMajor> FirstWeights;
+    typedef Eigen::Matrix<float, Hidden, 1> FirstBias;
+    typedef Eigen::Matrix<float, Outputs, Hidden> SecondWeights;
+    typedef Eigen::Matrix<float, Outputs, 1> SecondBias;
+
+    // Params is NetworkParameters or NetworkView
+    template <typename Params>
+    static bool matches(const Params& params) {
+        return params.W1.rows() == Hidden && params.W1.cols() == Inputs && params.b1.size() == Hidden &&
+               params.W2.rows() == Outputs && params.W2.cols() == Hidden && params.b2.size() == Outputs;
+    }
+
+    template <typename Params>
+    explicit FixedNetwork(const Params& params) : W1(params.W1), b1(params.b1), W2(params.W2), b2(params.b2) {}
+
+    /**
+     * @brief Compute the output logits of the network for a batch.
+     *
+     * @param X The input batch, Inputs rows and one sample per column.
+     * @param hidden Scratch of Hidden rows and X.cols() columns, receives the hidden layer activations.
+     * @param logits Receives the Outputs x X.cols() pre-softmax scores.
+     */
+    template <typename Input, typename HiddenBlock, typename OutputBlock>
+    void logits(const Eigen::MatrixBase<Input>& X, const Eigen::MatrixBase<HiddenBlock>& hidden, const Eigen::MatrixBase<OutputBlock>& logits) const {
+        HiddenBlock& A1 = const_cast<HiddenBlock&>(hidden.derived());
+        OutputBlock& Z2 = const_cast<OutputBlock&>(logits.derived());
+
+        A1.noalias() = W1 * X;
+        A1 = (A1.colwise() + b1).cwiseMax(0.0f);
+
+        Z2.noalias() = W2 * A1;
+        Z2.colwise() += b2;
+    }
+
+    /**
+     * @brief Compute the activations and loss of one training step.
+     *
+     * Same results as the dynamic forwardPass, with fixed-size views of the parameters.
+     *
+     * @param params The current parameters, which must match this topology.
+     * @param X The batch of input samples, one per column.
+     * @param Y The true labels of the batch.
+     * @param ws Workspace sized for X, receives the activations and loss.
+     */
+    template <typename Input>
+    static void forwardPass(const NetworkParameters& params, const Eigen::MatrixBase<Input>& X, const Eigen::VectorXi& Y, TrainingWorkspace& ws) {
+        Eigen::Map<const Eigen::Matrix<float, Hidden, Inputs>> fixedW1(params.W1.data());
+        Eigen::Map<const SecondWeights> fixedW2(params.W2.data());
+        Eigen::Map<const SecondBias> fixedB2(params.b2.data());
+
+        Eigen::Map<Eigen::Matrix<float, Hidden, Eigen::Dynamic>> Z1(ws.Z1.data(), Hidden, X.cols());
+        Eigen::Map<Eigen::Matrix<float, Hidden, Eigen::Dynamic>> A1(ws.A1.data(), Hidden, X.cols());
+        Eigen::Map<Eigen::Matrix<float, Outputs, Eigen::Dynamic>> Z2(ws.Z2.data(), Outputs, X.cols());
+        Eigen::Map<Eigen::Matrix<float, Outputs, Eigen::Dynamic>> A2(ws.A2.data(), Outputs, X.cols());
+
+        Z1.noalias() = fixedW1 * X;
+        biasReLU(Z1, params.b1, A1);
+
+        Z2.noalias() = fixedW2 * A1;
+        Z2.colwise() += fixedB2;
+        ws.loss = softmaxCrossEntropy(Z2, Y, A2);
+    }
+
+    /**
+     * @brief Compute the gradients of one training step from the activations of forwardPass.
+     *
+     * @param params The current parameters, which must match this topology.
+     * @param X The batch of input samples, one per column.
+     * @param Y The true labels of the batch.
+     * @param ws Workspace holding the batch's activations, receives the gradients.
+     */
+    template <typename Input>
+    static void backwardPass(const NetworkParameters& params, const Eigen::MatrixBase<Input>& X, const Eigen::VectorXi& Y, TrainingWorkspace& ws) {
+        Eigen::Map<const SecondWeights> fixedW2(params.W2.data());
+
+        Eigen::Map<const Eigen::Matrix<float, Hidden, Eigen::Dynamic>> Z1(ws.Z1.data(), Hidden, X.cols());
+        Eigen::Map<const Eigen::Matrix<float, Hidden, Eigen::Dynamic>> A1(ws.A1.data(), Hidden, X.cols());
+        Eigen::Map<const Eigen::Matrix<float, Outputs, Eigen::Dynamic>> A2(ws.A2.data(), Outputs, X.cols());
+        Eigen::Map<Eigen::Matrix<float, Hidden, Eigen::Dynamic>> dZ1(ws.dZ1.data(), Hidden, X.cols());
+        Eigen::Map<Eigen::Matrix<float, Outputs, Eigen::Dynamic>> dZ2(ws.dZ2.data(), Outputs, X.cols());
+        Eigen::Map<Eigen::Matrix<float, Hidden, Inputs>> dW1(ws.dW1.data());
+        Eigen::Map<FirstBias> db1(ws.db1.data());
+        Eigen::Map<SecondWeights> dW2(ws.dW2.data());
+        Eigen::Map<SecondBias> db2(ws.db2.data());
+
+        const float invM = 1.0f / static_cast<float>(X.cols());
+
+        dZ2 = A2;
+        for (Eigen::Index j = 0; j < dZ2.cols(); ++j) {
+            dZ2(Y(j), j) -= 1.0f;
+        }
+
+        dW2.noalias() = invM * dZ2 * A1.transpose();
+        db2.noalias() = invM * dZ2.rowwise().sum();
+
+        dZ1.noalias() = fixedW2.transpose() * dZ2;
+        dZ1.array() *= (Z1.array() > 0.0f).template cast<float>();
+
+        dW1.noalias() = invM * dZ1 * X.transpose();
+        db1.noalias() = invM * dZ1.rowwise().sum();
+    }
+
+    /**
+     * @brief Compute the activations and gradients of one training step.
+     *
+     * Same results as the dynamic computeGradients, with fixed-size views of the parameters.
+     *
+     * @param params The current parameters, which must match this topology.
+     * @param X The batch of input samples, one per column.
+     * @param Y The true labels of the batch.
+     * @param ws Workspace sized for X, receives the activations and gradients.
+     */
+    template <typename Input>
+    static void computeGradients(const NetworkParameters& params, const Eigen::MatrixBase<Input>& X, const Eigen::VectorXi& Y, TrainingWorkspace& ws) {
+        forwardPass(params, X, Y, ws);
+        backwardPass(params, X, Y, ws);
+    }
+
+    FirstWeights W1;
+    FirstBias b1;
+    SecondWeights W2;
+    SecondBias b2;
+};
+
+// The topology trained and deployed by default: 784 pixels, 10 hidden neurons, 10 digits
+typedef FixedNetwork<784, 10, 10> MnistNetwork;
+
+#endif
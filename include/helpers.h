@@ -2,13 +2,16 @@
 #define HELPERS
 
 #include <Eigen/Core>
+#include <optional>
 
-std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> initParams();
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> initParams(std::optional<unsigned int> seed = std::nullopt);
 
-Eigen::MatrixXi oneHotEncode(const Eigen::VectorXi& Y);
+Eigen::MatrixXi oneHotEncode(const Eigen::VectorXi& Y, int numClasses = 0);
 
 Eigen::VectorXi getPredictions(const Eigen::MatrixXf& A2);
 
+int countCorrectPredictions(const Eigen::Ref<const Eigen::MatrixXf>& A2, const Eigen::Ref<const Eigen::VectorXi>& Y);
+
 double getAccuracy(const Eigen::VectorXi& predictions, const Eigen::VectorXi& Y);
 
 int findMaxIndex(const Eigen::MatrixXf& matrix);
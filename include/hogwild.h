@@ -0,0 +1,12 @@
+#ifndef HOGWILD
+#define HOGWILD
+
+#include <Eigen/Core>
+
+#include "neural_network.h"
+
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> hogwildGradientDescent(const Eigen::MatrixXf& X,const Eigen::VectorXi& Y,const Eigen::MatrixXf& valX,const Eigen::VectorXi& valY, const TrainingConfig& config);
+
+void compareHogwildWithSynchronous(const Eigen::MatrixXf& X,const Eigen::VectorXi& Y,const Eigen::MatrixXf& valX,const Eigen::VectorXi& valY, const TrainingConfig& config);
+
+#endif
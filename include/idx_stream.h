@@ -0,0 +1,94 @@
+#ifndef IDX_STREAM
+#define IDX_STREAM
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Eigen/Core>
+
+#include "dataset_utils.h"
+
+// Reads an IDX3 image file and its IDX1 label file in fixed-size chunks of raw pixels, so a
+// dataset of any size is trained on or evaluated with memory for three chunks. A reader thread
+// fills the next chunk while the current one is used. With shuffling, each epoch visits the
+// chunks in a random order and the samples within each chunk are shuffled as it is read.
+class IdxStream {
+public:
+    IdxStream(const std::string& imageFile, const std::string& labelFile, int chunkSize = 10000, std::optional<unsigned int> seed = std::nullopt);
+    ~IdxStream();
+
+    IdxStream(const IdxStream&) = delete;
+    IdxStream& operator=(const IdxStream&) = delete;
+
+    bool isOpen() const { return open_; }
+    int numSamples() const { return numSamples_; }
+    int sampleSize() const { return sampleSize_; }
+    int chunkSize() const { return chunkSize_; }
+    int numChunks() const { return static_cast<int>(chunkOrder_.size()); }
+
+    void startEpoch(bool shuffle);
+    bool next();
+
+    // For checkpoints, between epochs: the chunk order of the last epoch and the shuffle generator
+    const std::vector<int>& chunkOrder() const { return chunkOrder_; }
+    std::vector<std::uint32_t> generatorState();
+    bool restore(const std::vector<int>& chunkOrder, const std::vector<std::uint32_t>& generatorState);
+
+    // The current chunk: chunkSize() columns, of which the first chunkCount() hold samples.
+    // Valid until the following call to next() or startEpoch().
+    const PixelMatrix& chunkData() const { return chunks_[current_].pixels; }
+    const Eigen::VectorXi& chunkLabels() const { return chunks_[current_].labels; }
+    const std::vector<int>& chunkIndices() const { return chunks_[current_].indices; }  // the dataset index of each column
+    int chunkCount() const { return chunks_[current_].count; }
+
+private:
+    struct Chunk {
+        PixelMatrix pixels;
+        Eigen::VectorXi labels;
+        std::vector<int> indices;
+        int count = 0;
+        bool ok = false;
+    };
+
+    void startRead(int position, int buffer);
+    void finishRead();
+    void readChunk(int chunkIndex, Chunk& chunk);
+    void readerLoop();
+
+    std::string imageFile_;
+    std::ifstream images_;
+    std::ifstream labels_;
+    bool open_ = false;
+    int numSamples_ = 0;
+    int sampleSize_ = 0;
+    int chunkSize_ = 0;
+
+    std::vector<int> chunkOrder_;
+    int position_ = 0;                          // position in chunkOrder_ of the next chunk to read
+    bool shuffle_ = false;
+    std::mt19937 generator_;
+    std::vector<int> sampleOrder_;
+    std::vector<unsigned char> stagingPixels_;  // a chunk in file order, before it is shuffled
+    std::vector<unsigned char> stagingLabels_;
+
+    std::array<Chunk, 2> chunks_;
+    int current_ = 0;
+    int loading_ = -1;                          // buffer being filled by the reader, -1 if none
+
+    // Handshake with the reader thread, which owns the files, the generator and chunks_[loading_] while reading
+    int requestedChunk_ = -1;
+    bool reading_ = false;
+    bool stopping_ = false;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::thread reader_;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef INFERENCE_ENGINE
+#define INFERENCE_ENGINE
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <Eigen/Core>
+
+#include "fixed_network.h"
+#include "model_format.h"
+#include "neural_network.h"
+
+class ModelRegistry;
+
+// A loaded model's weights; immutable once constructed, so one instance can be shared by any number of threads
+class InferenceModel {
+public:
+    explicit InferenceModel(const std::string& modelFile);
+    explicit InferenceModel(NetworkParameters params);
+
+    InferenceModel(const InferenceModel&) = delete;
+    InferenceModel& operator=(const InferenceModel&) = delete;
+
+    bool isLoaded() const { return network().W1.size() > 0; }
+    int hiddenSize() const { return static_cast<int>(network().W1.rows()); }
+    int inputSize() const { return static_cast<int>(network().W1.cols()); }
+    int numClasses() const { return static_cast<int>(network().W2.rows()); }
+    NetworkView network() const { return *network_; }
+
+    void logits(const Eigen::Ref<const Eigen::MatrixXf>& batch, Eigen::Ref<Eigen::MatrixXf> hidden, Eigen::Ref<Eigen::MatrixXf> output) const;
+
+private:
+    void specialise();
+
+    std::unique_ptr<ModelFile> model_;  // set when the weights are used in place from a v2 model file
+    NetworkParameters params_;          // otherwise the model owns them
+    std::optional<NetworkView> network_;          // the weights, wherever they live
+    std::unique_ptr<MnistNetwork> fixedNetwork_;  // set when the model has the default topology
+};
+
+// Classifies batches with preallocated scratch; one engine per thread, the model may be shared
+class InferenceEngine {
+public:
+    InferenceEngine(const std::string& modelFile, int maxBatchSize);
+    InferenceEngine(NetworkParameters params, int maxBatchSize);
+    InferenceEngine(const ModelRegistry& registry, int maxBatchSize);
+
+    bool isLoaded() const { return model()->isLoaded(); }
+    int maxBatchSize() const { return maxBatchSize_; }
+    int numClasses() const { return model()->numClasses(); }
+    std::shared_ptr<const InferenceModel> model() const;
+
+    bool classify(const Eigen::Ref<const Eigen::MatrixXf>& batch, Eigen::Ref<Eigen::VectorXi> labels, Eigen::Ref<Eigen::MatrixXf> probabilities);
+
+private:
+    std::shared_ptr<const InferenceModel> model_;  // the model, unless it comes from a registry
+    const ModelRegistry* registry_ = nullptr;
+    int maxBatchSize_;
+    Eigen::MatrixXf hidden_;  // hidden layer activations for up to maxBatchSize_ samples
+};
+
+#endif
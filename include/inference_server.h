@@ -0,0 +1,98 @@
+#ifndef INFERENCE_SERVER
+#define INFERENCE_SERVER
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "model_registry.h"
+
+/*
+ * Wire protocol, over a Unix domain stream socket. A client may send any number of
+ * requests on one connection; responses come back in the same order.
+ *
+ *   request:  784 bytes, one image of 28x28 pixels (0-255, row by row, as in the IDX files)
+ *   response: int32 predicted digit, int32 number of classes n, n float32 confidences
+ *
+ * Integers and floats are in the byte order of the server.
+ */
+const int SERVER_IMAGE_SIZE = 784;
+
+struct ServerConfig {
+    std::string socketPath = "/tmp/number_classifier.sock";
+    int maxBatchSize = 64;                        // requests run through one forward pass
+    std::chrono::microseconds maxWait{2000};      // longest a request waits for its batch to fill
+    int queueCapacity = 1024;                     // pending requests before readers block
+};
+
+class InferenceServer {
+public:
+    InferenceServer(const ModelRegistry& registry, const ServerConfig& config);
+    ~InferenceServer();
+
+    InferenceServer(const InferenceServer&) = delete;
+    InferenceServer& operator=(const InferenceServer&) = delete;
+
+    bool start();
+    void stop();
+
+    std::size_t requestsServed() const { return requestsServed_.load(std::memory_order_relaxed); }
+    std::size_t batchesRun() const { return batchesRun_.load(std::memory_order_relaxed); }
+
+private:
+    // A client socket, closed once neither its reader nor any queued request refers to it
+    struct Connection {
+        explicit Connection(int fd) : fd(fd) {}
+        ~Connection();
+        int fd;
+    };
+
+    struct Request {
+        std::shared_ptr<Connection> connection;
+        std::chrono::steady_clock::time_point arrived;
+        std::array<unsigned char, SERVER_IMAGE_SIZE> pixels;
+    };
+
+    struct Reader {
+        std::shared_ptr<Connection> connection;
+        std::thread thread;
+        std::atomic<bool> finished{false};
+    };
+
+    void acceptLoop();
+    void readLoop(Reader& reader);
+    void batchLoop();
+    bool push(const std::shared_ptr<Connection>& connection, const unsigned char* pixels);
+    int takeBatch(std::vector<Request>& batch);
+
+    const ModelRegistry& registry_;
+    ServerConfig config_;
+    int listenFd_ = -1;
+
+    // Bounded FIFO of pending requests, a ring buffer allocated once
+    std::vector<Request> queue_;
+    std::size_t head_ = 0;
+    std::size_t count_ = 0;
+    std::mutex queueMutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    std::atomic<bool> stopping_{false};
+
+    std::mutex readersMutex_;
+    std::list<Reader> readers_;
+    std::thread acceptor_;
+    std::thread batcher_;
+
+    std::atomic<std::size_t> requestsServed_{0};
+    std::atomic<std::size_t> batchesRun_{0};
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef LAYER_STACK
+#define LAYER_STACK
+
+#include <optional>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+
+#include "neural_network.h"
+
+enum LayerType {
+    DENSE,
+    RELU,
+    SOFTMAX
+};
+
+// One layer of a LayerStack; units is the output width of a DENSE layer and ignored for the others
+struct LayerSpec {
+    LayerType type;
+    int units = 0;
+};
+
+// Limits on what a layer stack, e.g. one read from a file, may declare
+const int MAX_LAYER_STACK_WIDTH = 1 << 20;  // inputs, and units of any dense layer
+const int MAX_LAYER_STACK_LAYERS = 1024;
+
+std::vector<LayerSpec> multiLayerPerceptron(const std::vector<int>& hiddenWidths, int outputSize);
+
+std::string validateLayerStack(int inputSize, const std::vector<LayerSpec>& layers);
+
+long long layerStackParameterCount(int inputSize, const std::vector<LayerSpec>& layers);
+
+// Feed-forward network of dense, ReLU and softmax layers of any width and depth.
+// All parameters live in one flat vector, and all activations and gradients for a batch in one arena.
+class LayerStack {
+public:
+    LayerStack(int inputSize, const std::vector<LayerSpec>& layers, std::optional<unsigned int> seed = std::nullopt);
+    explicit LayerStack(const NetworkParameters& params);
+
+    int inputSize() const { return inputSize_; }
+    int outputSize() const { return slots_.back().units; }
+    int numLayers() const { return static_cast<int>(layers_.size()); }
+    const std::vector<LayerSpec>& layers() const { return layers_; }
+    int batchCapacity() const { return batchCapacity_; }
+
+    Eigen::Map<Eigen::MatrixXf> weights(int layer);
+    Eigen::Map<const Eigen::MatrixXf> weights(int layer) const;
+    Eigen::Map<Eigen::VectorXf> bias(int layer);
+    Eigen::Map<const Eigen::VectorXf> bias(int layer) const;
+    Eigen::VectorXf& parameters() { return parameters_; }
+    const Eigen::VectorXf& parameters() const { return parameters_; }
+    const Eigen::VectorXf& gradients() const { return gradients_; }
+
+    void reserve(int batchSize);
+    Eigen::Map<const Eigen::MatrixXf> forward(const Eigen::Ref<const Eigen::MatrixXf>& X);
+    Eigen::Map<const Eigen::MatrixXf> probabilities() const;
+    float forwardLoss(const Eigen::Ref<const Eigen::MatrixXf>& X, const Eigen::VectorXi& Y);
+    void backward(const Eigen::Ref<const Eigen::MatrixXf>& X, const Eigen::VectorXi& Y);
+    float computeGradients(const Eigen::Ref<const Eigen::MatrixXf>& X, const Eigen::VectorXi& Y);
+    void applyGradients(float alpha);
+    void applyGradients(Optimizer& optimizer, float alpha);
+    float trainingStep(const Eigen::Ref<const Eigen::MatrixXf>& X, const Eigen::VectorXi& Y, float alpha);
+    double accuracy(const Eigen::MatrixXf& X, const Eigen::VectorXi& Y);
+
+private:
+    // Where a layer's parameters and per-sample activation/gradient rows live
+    struct LayerSlot {
+        int units;
+        int inputs;
+        Eigen::Index weights;
+        Eigen::Index bias;
+        Eigen::Index output;
+        Eigen::Index gradient;
+    };
+
+    void propagate(const Eigen::Ref<const Eigen::MatrixXf>& X);
+    Eigen::Ref<const Eigen::MatrixXf> logits(const Eigen::Ref<const Eigen::MatrixXf>& X);
+    Eigen::Map<Eigen::MatrixXf> output(int layer, Eigen::Index cols);
+    Eigen::Map<Eigen::MatrixXf> gradient(int layer, Eigen::Index cols);
+
+    int inputSize_;
+    std::vector<LayerSpec> layers_;
+    std::vector<LayerSlot> slots_;
+    Eigen::VectorXf parameters_;
+    Eigen::VectorXf gradients_;
+    Eigen::VectorXf arena_;  // activations then gradients of every layer, batchCapacity_ columns each
+    Eigen::Index arenaRowsPerSample_ = 0;
+    int batchCapacity_ = 0;
+    Eigen::Index batchCols_ = 0;  // samples in the last forward pass
+};
+
+bool trainLayerStack(LayerStack& stack, const Eigen::MatrixXf& X,const Eigen::VectorXi& Y,const Eigen::MatrixXf& valX,const Eigen::VectorXi& valY, const TrainingConfig& config);
+
+#endif
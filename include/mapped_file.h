@@ -0,0 +1,27 @@
+#ifndef MAPPED_FILE
+#define MAPPED_FILE
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const { return data_ != nullptr; }
+    const unsigned char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+private:
+    const unsigned char* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<unsigned char> buffer_;  // used when the file cannot be memory-mapped
+};
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef MODEL_FORMAT
+#define MODEL_FORMAT
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+
+#include "mapped_file.h"
+#include "neural_network.h"
+
+/*
+ * Model file format, version 2
+ *
+ *   ModelFileHeader                     64 bytes
+ *   TensorDescriptor x numTensors       64 bytes each
+ *   tensor data                         each tensor starts on a 64-byte boundary
+ *
+ * Integers and floats are stored in the byte order of the machine that wrote the file.
+ * A reader of the other byte order sees the magic number byte-swapped and rejects the
+ * file; endianMarker guards the rest of the header against corruption. Tensors are column-major
+ * float32 (uint32 for integer state such as a training checkpoint's counters), so a mapped
+ * file can be viewed with Eigen::Map directly. The checksum is the
+ * CRC-32 of every byte after the header. Files written by the original saveParameters
+ * have no header and start with the row count of W1 instead of the magic number.
+ */
+const std::uint32_t MODEL_FILE_MAGIC = 0x324d434e;  // "NCM2" when read as little-endian bytes
+const std::uint32_t MODEL_FILE_MAGIC_SWAPPED = 0x4e434d32;  // The magic number written on a machine of the other byte order
+const std::uint32_t MODEL_FILE_VERSION = 2;
+const std::uint32_t MODEL_FILE_ENDIAN_MARKER = 0x01020304;
+const std::size_t MODEL_FILE_ALIGNMENT = 64;
+
+struct ModelFileHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t endianMarker;
+    std::uint32_t numTensors;
+    std::uint64_t fileSize;
+    std::uint32_t checksum;
+    std::uint32_t reserved[9];
+};
+
+enum TensorType : std::uint32_t {
+    TENSOR_FLOAT32 = 0,
+    TENSOR_UINT32 = 1
+};
+
+struct TensorDescriptor {
+    char name[32];        // null-terminated
+    std::uint32_t type;   // TensorType; both types are 4 bytes per element
+    std::uint32_t rows;
+    std::uint32_t cols;
+    std::uint32_t reserved;
+    std::uint64_t offset; // from the start of the file, a multiple of MODEL_FILE_ALIGNMENT
+    std::uint64_t size;   // in bytes
+};
+
+static_assert(sizeof(ModelFileHeader) == 64, "model file header must stay 64 bytes");
+static_assert(sizeof(TensorDescriptor) == 64, "tensor descriptors must stay 64 bytes");
+
+// A named matrix to be written to a model file
+struct ModelTensor {
+    std::string name;
+    const void* data;
+    Eigen::Index rows;
+    Eigen::Index cols;
+    TensorType type = TENSOR_FLOAT32;
+};
+
+typedef Eigen::Matrix<std::uint32_t, Eigen::Dynamic, Eigen::Dynamic> WordMatrix;
+
+bool saveModelFile(const std::vector<ModelTensor>& tensors, const std::string& filename);
+
+bool assembleModelFile(const std::vector<ModelTensor>& tensors, std::vector<unsigned char>& contents);
+
+bool writeFileAtomically(const std::vector<unsigned char>& contents, const std::string& filename, const std::string& temporaryName);
+
+std::uint32_t crc32(const unsigned char* data, std::size_t size);
+
+// A version 2 model file mapped into memory; tensors are viewed in place, never copied
+class ModelFile {
+public:
+    explicit ModelFile(const std::string& filename, bool verifyChecksum = true);
+
+    ModelFile(const ModelFile&) = delete;
+    ModelFile& operator=(const ModelFile&) = delete;
+
+    bool hasModelHeader() const { return hasModelHeader_; }
+    bool isValid() const { return valid_; }
+    int numTensors() const { return valid_ ? static_cast<int>(header()->numTensors) : 0; }
+    const TensorDescriptor& descriptor(int index) const { return descriptors()[index]; }
+
+    const TensorDescriptor* findTensor(const std::string& name) const;
+    Eigen::Map<const Eigen::MatrixXf> matrix(const std::string& name) const;
+    Eigen::Map<const WordMatrix> words(const std::string& name) const;
+    bool hasNetwork() const;
+    NetworkView network() const;
+
+private:
+    const ModelFileHeader* header() const { return reinterpret_cast<const ModelFileHeader*>(file_.data()); }
+    const TensorDescriptor* descriptors() const { return reinterpret_cast<const TensorDescriptor*>(file_.data() + sizeof(ModelFileHeader)); }
+    bool validate(const std::string& filename, bool verifyChecksum) const;
+
+    MappedFile file_;
+    bool hasModelHeader_ = false;
+    bool valid_ = false;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef MODEL_REGISTRY
+#define MODEL_REGISTRY
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "inference_engine.h"
+
+// Watches a model file and publishes each new version for inference without blocking readers
+class ModelRegistry {
+public:
+    explicit ModelRegistry(const std::string& modelFile, std::chrono::milliseconds pollInterval = std::chrono::milliseconds(500));
+    ~ModelRegistry();
+
+    ModelRegistry(const ModelRegistry&) = delete;
+    ModelRegistry& operator=(const ModelRegistry&) = delete;
+
+    std::shared_ptr<const InferenceModel> current() const { return current_.load(std::memory_order_acquire); }
+    unsigned long version() const { return version_.load(std::memory_order_acquire); }
+    bool reload();
+
+private:
+    // What identifies one version of the file on disk; a new model is written to a temporary file and renamed over it
+    struct FileStamp {
+        std::filesystem::file_time_type modified;
+        std::uintmax_t size = 0;
+        bool operator==(const FileStamp&) const = default;
+    };
+
+    bool readStamp(FileStamp& stamp) const;
+    void watchLoop();
+
+    std::string modelFile_;
+    std::chrono::milliseconds pollInterval_;
+    std::atomic<std::shared_ptr<const InferenceModel>> current_;
+    std::atomic<unsigned long> version_{0};
+
+    std::mutex reloadMutex_;  // serialises reloads; readers never take it
+    FileStamp loadedStamp_;
+    FileStamp failedStamp_;  // last version that could not be loaded, not retried until it changes
+
+    std::mutex watchMutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::thread watcher_;
+};
+
+#endif
@@ -2,14 +2,96 @@
 #define NEURAL_NETWORK
 
 #include <Eigen/Core>
+#include <optional>
+
+#include "batch_prefetcher.h"
+#include "checkpoint.h"
+#include "dataset_utils.h"
+#include "optimizer.h"
+#include "sparse_input.h"
+#include "training_telemetry.h"
+
+class IdxStream;
+
+struct TrainingConfig {
+    float alpha = 0.15f;  // learning rate
+    OptimizerConfig optimizer;  // plain SGD by default
+    int epochs = 10;      // full passes over the training set
+    int batchSize = 64;   // columns per parameter update
+    std::optional<unsigned int> seed;  // seed of the initial parameters and the shuffles, for reproducible runs
+    int numThreads = 1;   // > 1 splits every batch across this many threads
+    bool prefetch = false;  // gather the next batch on a background thread while the current one trains
+    BatchAugmentation augment;  // optional, applied to every training batch once gathered (on the loader thread when prefetching)
+    bool asyncValidation = false;  // validate a copy of the parameters on a background thread while training continues
+    TrainingTelemetry* telemetry = nullptr;  // optional, receives per-epoch phase timings and throughput
+    CheckpointConfig checkpoint;  // periodic background checkpoints, and resuming from one
+    bool sparseInput = true;  // train the first layer from sparse batches when the inputs are sparse enough
+};
+
+struct NetworkParameters {
+    Eigen::MatrixXf W1;
+    Eigen::VectorXf b1;
+    Eigen::MatrixXf W2;
+    Eigen::VectorXf b2;
+};
+
+// Read-only view of network parameters wherever they are stored, e.g. in a memory-mapped model file
+struct NetworkView {
+    explicit NetworkView(const NetworkParameters& params)
+        : W1(params.W1.data(), params.W1.rows(), params.W1.cols()), b1(params.b1.data(), params.b1.size()),
+          W2(params.W2.data(), params.W2.rows(), params.W2.cols()), b2(params.b2.data(), params.b2.size()) {}
+
+    NetworkView(Eigen::Map<const Eigen::MatrixXf> W1, Eigen::Map<const Eigen::VectorXf> b1, Eigen::Map<const Eigen::MatrixXf> W2, Eigen::Map<const Eigen::VectorXf> b2)
+        : W1(W1), b1(b1), W2(W2), b2(b2) {}
+
+    Eigen::Map<const Eigen::MatrixXf> W1;
+    Eigen::Map<const Eigen::VectorXf> b1;
+    Eigen::Map<const Eigen::MatrixXf> W2;
+    Eigen::Map<const Eigen::VectorXf> b2;
+};
+
+// Activations and gradients of one training step, allocated once for a fixed batch size
+struct TrainingWorkspace {
+    TrainingWorkspace(int inputSize, int hiddenSize, int outputSize, int batchSize);
+
+    Eigen::MatrixXf Z1, A1, Z2, A2;
+    Eigen::MatrixXf dZ1, dZ2;
+    Eigen::MatrixXf dW1, dW2;
+    Eigen::VectorXf db1, db2;
+    float loss = 0.0f;  // mean cross-entropy of the last step
+};
 
 std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> forwardPropagation( const Eigen::MatrixXf& W1, const Eigen::MatrixXf& b1,const Eigen::MatrixXf& W2,const Eigen::MatrixXf& b2,const Eigen::MatrixXf& X);
 
-std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> backwardPropagation(Eigen::MatrixXf Z1, Eigen::MatrixXf A1, Eigen::MatrixXf Z2, Eigen::MatrixXf A2,Eigen::MatrixXf W1, Eigen::MatrixXf W2, Eigen::MatrixXf X, Eigen::VectorXi Y);
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> forwardPropagation(const Eigen::MatrixXf& W1, const Eigen::MatrixXf& b1, const Eigen::MatrixXf& W2, const Eigen::MatrixXf& b2, const SparseInputMatrix& X);
+
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> backwardPropagation(const Eigen::MatrixXf& Z1, const Eigen::MatrixXf& A1, const Eigen::MatrixXf& Z2, const Eigen::MatrixXf& A2,const Eigen::MatrixXf& W1, const Eigen::MatrixXf& W2, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y);
+
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> backwardPropagation(const Eigen::MatrixXf& Z1, const Eigen::MatrixXf& A1, const Eigen::MatrixXf& Z2, const Eigen::MatrixXf& A2,const Eigen::MatrixXf& W1, const Eigen::MatrixXf& W2, const SparseInputMatrix& X, const Eigen::VectorXi& Y);
+
+NetworkParameters initNetworkParameters(std::optional<unsigned int> seed = std::nullopt);
+
+void forwardPass(const NetworkParameters& params, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y, TrainingWorkspace& workspace);
+
+void forwardPass(const NetworkParameters& params, const SparseInputMatrix& X, const Eigen::VectorXi& Y, TrainingWorkspace& workspace);
+
+void backwardPass(const NetworkParameters& params, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y, TrainingWorkspace& workspace);
+
+void backwardPass(const NetworkParameters& params, const SparseInputMatrix& X, const Eigen::VectorXi& Y, TrainingWorkspace& workspace);
+
+void computeGradients(const NetworkParameters& params, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y, TrainingWorkspace& workspace);
+
+void applyGradients(NetworkParameters& params, const TrainingWorkspace& workspace, float alpha);
+
+void trainingStep(NetworkParameters& params, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y, float alpha, TrainingWorkspace& workspace);
+
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> gradientDescent(const Eigen::MatrixXf& X,const Eigen::VectorXi& Y,const Eigen::MatrixXf& valX,const Eigen::VectorXi& valY, float alpha, int iterations, TrainingTelemetry* telemetry = nullptr, const CheckpointConfig& checkpoint = CheckpointConfig(), const OptimizerConfig& optimizerConfig = OptimizerConfig(), bool sparseInput = true);
+
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> miniBatchGradientDescent(const Eigen::MatrixXf& X,const Eigen::VectorXi& Y,const Eigen::MatrixXf& valX,const Eigen::VectorXi& valY, const TrainingConfig& config);
 
-std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> updateParameters(Eigen::MatrixXf W1,Eigen::MatrixXf b1,Eigen::MatrixXf W2, Eigen::MatrixXf b2,Eigen::MatrixXf dW1,Eigen::MatrixXf db1, Eigen::MatrixXf dW2,Eigen::MatrixXf db2,float alpha);
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> miniBatchGradientDescent(const PixelMatrix& X,const Eigen::VectorXi& Y,const PixelMatrix& valX,const Eigen::VectorXi& valY, const TrainingConfig& config);
 
-std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> gradientDescent(Eigen::MatrixXf X,Eigen::VectorXi Y,Eigen::MatrixXf valX,Eigen::VectorXi valY, float alpha, int iterations);
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> miniBatchGradientDescent(IdxStream& training, IdxStream& validation, const TrainingConfig& config);
 
 Eigen::MatrixXf runImageThroughNetwork(const Eigen::MatrixXf& image, const Eigen::MatrixXf& W1, const Eigen::MatrixXf& b1, const Eigen::MatrixXf& W2, const Eigen::MatrixXf& b2);
 
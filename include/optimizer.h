@@ -0,0 +1,115 @@
+#ifndef OPTIMIZER
+#define OPTIMIZER
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <Eigen/Core>
+
+struct NetworkParameters;
+struct TrainingWorkspace;
+
+enum OptimizerType {
+    OPTIMIZER_SGD,
+    OPTIMIZER_MOMENTUM,
+    OPTIMIZER_NESTEROV,
+    OPTIMIZER_ADAM
+};
+
+struct OptimizerConfig {
+    OptimizerType type = OPTIMIZER_SGD;
+    float momentum = 0.9f;  // momentum and Nesterov: decay of the velocity
+    float beta1 = 0.9f;     // Adam: decay of the mean of the gradients
+    float beta2 = 0.999f;   // Adam: decay of the mean of the squared gradients
+    float epsilon = 1e-8f;  // Adam: keeps the step finite where the gradients are 0
+};
+
+// What an optimizer saves in a checkpoint. The type tags the buffers, as momentum and Nesterov
+// keep buffers of the same shapes that do not mean the same thing.
+struct OptimizerState {
+    OptimizerType type = OPTIMIZER_SGD;
+    std::uint32_t steps = 0;               // steps taken, for Adam's bias correction
+    std::vector<Eigen::MatrixXf> buffers;  // the optimizer's buffers, in its own order
+};
+
+// Updates parameter arrays in place from their gradients. Each array is a slot with its own
+// state, allocated once at construction, and each update reads and writes every element once.
+class Optimizer {
+public:
+    virtual ~Optimizer() = default;
+
+    // Call once per step, before updating its slots
+    virtual void beginStep() {}
+    virtual void update(int slot, float* parameters, const float* gradients, float alpha) = 0;
+
+    // Slots W1, b1, W2 and b2, as created by makeOptimizer(config, params)
+    void step(NetworkParameters& params, const TrainingWorkspace& workspace, float alpha);
+
+    virtual OptimizerType type() const = 0;
+
+    // For checkpoints: the state, and restoring it into an optimizer of the same type and slots
+    virtual OptimizerState state() const { return {type(), 0, {}}; }
+    virtual bool restoreState(const OptimizerState& state) { return state.type == type() && state.buffers.empty(); }
+
+    const std::vector<Eigen::Index>& slotSizes() const { return slotSizes_; }
+
+protected:
+    explicit Optimizer(std::vector<Eigen::Index> slotSizes) : slotSizes_(std::move(slotSizes)) {}
+
+    std::vector<Eigen::Index> slotSizes_;
+};
+
+// p -= alpha * g
+class SgdOptimizer : public Optimizer {
+public:
+    explicit SgdOptimizer(std::vector<Eigen::Index> slotSizes) : Optimizer(std::move(slotSizes)) {}
+
+    OptimizerType type() const override { return OPTIMIZER_SGD; }
+    void update(int slot, float* parameters, const float* gradients, float alpha) override;
+};
+
+// v = momentum * v + g, then p -= alpha * v, or with Nesterov p -= alpha * (g + momentum * v)
+class MomentumOptimizer : public Optimizer {
+public:
+    MomentumOptimizer(std::vector<Eigen::Index> slotSizes, float momentum, bool nesterov);
+
+    OptimizerType type() const override { return nesterov_ ? OPTIMIZER_NESTEROV : OPTIMIZER_MOMENTUM; }
+    void update(int slot, float* parameters, const float* gradients, float alpha) override;
+
+    OptimizerState state() const override;
+    bool restoreState(const OptimizerState& state) override;
+
+private:
+    float momentum_;
+    bool nesterov_;
+    std::vector<Eigen::VectorXf> velocity_;
+};
+
+// Adam with bias correction folded into the step size
+class AdamOptimizer : public Optimizer {
+public:
+    AdamOptimizer(std::vector<Eigen::Index> slotSizes, float beta1, float beta2, float epsilon);
+
+    OptimizerType type() const override { return OPTIMIZER_ADAM; }
+    void beginStep() override;
+    void update(int slot, float* parameters, const float* gradients, float alpha) override;
+
+    OptimizerState state() const override;
+    bool restoreState(const OptimizerState& state) override;
+
+private:
+    float beta1_;
+    float beta2_;
+    float epsilon_;
+    std::uint32_t steps_ = 0;
+    float correction1_ = 1.0f;  // 1 - beta1^steps
+    float correction2_ = 1.0f;  // 1 - beta2^steps
+    std::vector<Eigen::VectorXf> mean_;
+    std::vector<Eigen::VectorXf> squaredMean_;
+};
+
+std::unique_ptr<Optimizer> makeOptimizer(const OptimizerConfig& config, std::vector<Eigen::Index> slotSizes);
+
+std::unique_ptr<Optimizer> makeOptimizer(const OptimizerConfig& config, const NetworkParameters& params);
+
+#endif
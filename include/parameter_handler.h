@@ -1,8 +1,17 @@
 #ifndef PARAMETER_HANDLER
 #define PARAMETER_HANDLER
 
-void saveParameters(const Eigen::MatrixXf& W1, const Eigen::VectorXf& b1, const Eigen::MatrixXf& W2, const Eigen::VectorXf& b2, const std::string& filename);
+#include <optional>
+#include <string>
+
+#include "layer_stack.h"
+
+bool saveParameters(const Eigen::MatrixXf& W1, const Eigen::VectorXf& b1, const Eigen::MatrixXf& W2, const Eigen::VectorXf& b2, const std::string& filename);
 
 std::tuple<Eigen::MatrixXf, Eigen::VectorXf, Eigen::MatrixXf, Eigen::VectorXf>loadParameters(const std::string& filename);
 
-#endif
\ No newline at end of file
+bool saveLayerStack(const LayerStack& stack, const std::string& filename);
+
+std::optional<LayerStack> loadLayerStack(const std::string& filename);
+
+#endif
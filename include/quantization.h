@@ -0,0 +1,33 @@
+#ifndef QUANTIZATION
+#define QUANTIZATION
+
+#include <cstdint>
+#include <string>
+#include <Eigen/Core>
+
+#include "dataset_utils.h"
+#include "neural_network.h"
+
+typedef Eigen::Matrix<int8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> QuantizedWeights;
+
+// Int8 weights with one float scale per output row; biases stay float
+struct QuantizedModel {
+    QuantizedWeights W1;
+    Eigen::VectorXf W1Scales;
+    Eigen::VectorXf b1;
+    QuantizedWeights W2;
+    Eigen::VectorXf W2Scales;
+    Eigen::VectorXf b2;
+};
+
+QuantizedModel quantizeParameters(const NetworkParameters& params);
+
+void saveQuantizedParameters(const QuantizedModel& model, const std::string& filename);
+
+QuantizedModel loadQuantizedParameters(const std::string& filename);
+
+void quantizedClassify(const QuantizedModel& model, const Eigen::Ref<const PixelMatrix>& pixels, Eigen::Ref<Eigen::VectorXi> predictions);
+
+void printQuantizationReport(const NetworkParameters& params, const QuantizedModel& model, const PixelMatrix& pixels, const Eigen::VectorXi& labels);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef SPARSE_INPUT
+#define SPARSE_INPUT
+
+#include <Eigen/Core>
+#include <Eigen/SparseCore>
+
+#include "dataset_utils.h"
+
+// Input samples in compressed sparse column (CSC) form: one column per sample, holding only its non-zero pixels
+typedef Eigen::SparseMatrix<float, Eigen::ColMajor, int> SparseInputMatrix;
+
+// Inputs at most this dense train from sparse batches. Measured on MNIST (about 20% non-zero),
+// the sparse first layer breaks even with the dense one at around 70% density.
+const double SPARSE_INPUT_MAX_DENSITY = 0.5;
+
+double inputDensity(const Eigen::MatrixXf& data);
+
+double inputDensity(const PixelMatrix& data);
+
+SparseInputMatrix toSparseInput(const Eigen::MatrixXf& data);
+
+SparseInputMatrix toSparseInput(const PixelMatrix& data);
+
+// A mini-batch gathered from a SparseInputMatrix, with storage for the densest possible batch
+// reserved up front so gathering never allocates
+class SparseBatch {
+public:
+    SparseBatch(int inputSize, int batchSize);
+
+    void gather(const SparseInputMatrix& data, const Eigen::VectorXi& labels, const DatasetPermutation& permutation, int start, Eigen::VectorXi& batchLabels);
+
+    const SparseInputMatrix& matrix() const { return matrix_; }
+
+private:
+    SparseInputMatrix matrix_;
+};
+
+// First-layer kernels: out = W * X and dW = scale * dZ * X^T, touching only the non-zero inputs
+void sparseInputProduct(const Eigen::MatrixXf& W, const SparseInputMatrix& X, Eigen::MatrixXf& out);
+
+void sparseInputGradient(const Eigen::MatrixXf& dZ, const SparseInputMatrix& X, float scale, Eigen::MatrixXf& dW);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads that run indexed tasks; the calling thread takes part as well
+class ThreadPool {
+public:
+    explicit ThreadPool(int numThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return static_cast<int>(workers_.size()) + 1; }
+
+    // Calls task(i) for every i in [0, numTasks) and returns when all calls have finished.
+    // The task is passed by reference, so dispatching never allocates.
+    template <typename Task>
+    void parallelFor(int numTasks, Task&& task) {
+        using TaskType = std::remove_reference_t<Task>;
+        run(numTasks, [](void* context, int index) { (*static_cast<TaskType*>(context))(index); }, const_cast<void*>(static_cast<const void*>(&task)));
+    }
+
+private:
+    void run(int numTasks, void (*invoke)(void*, int), void* context);
+    void runTasks();
+    void workerLoop();
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+
+    void (*invoke_)(void*, int) = nullptr;
+    void* context_ = nullptr;
+    int numTasks_ = 0;
+    std::atomic<int> nextTask_{0};
+    int busyWorkers_ = 0;
+    unsigned long generation_ = 0;
+    bool stopping_ = false;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef TRAINING_TELEMETRY
+#define TRAINING_TELEMETRY
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+
+enum TrainingPhase {
+    PHASE_SHUFFLE,     // reshuffling the sample order
+    PHASE_DATA,        // gathering batches, or waiting for the prefetcher
+    PHASE_FORWARD,
+    PHASE_BACKWARD,
+    PHASE_UPDATE,
+    PHASE_VALIDATION,
+    NUM_TRAINING_PHASES
+};
+
+enum TelemetryFormat {
+    TELEMETRY_OFF,
+    TELEMETRY_CSV,   // a header line, then one line per epoch
+    TELEMETRY_JSON   // one JSON object per line and epoch
+};
+
+// Training figures of one epoch that the trainer knows; timings are collected by the telemetry
+struct EpochSummary {
+    int epoch = 0;            // counts from 1
+    long long samples = 0;    // training samples processed
+    double loss = 0.0;
+    double accuracy = 0.0;
+    double validationAccuracy = 0.0;
+};
+
+// Per-epoch phase timings, throughput, loss and peak memory of a training run. Records are
+// written only while the format is not TELEMETRY_OFF; the format can be changed from any
+// thread and takes effect at the next epoch, so a disabled run only pays a flag check per phase.
+class TrainingTelemetry {
+public:
+    TrainingTelemetry(std::ostream& output, TelemetryFormat format);
+    TrainingTelemetry(const std::string& filename, TelemetryFormat format);
+
+    TrainingTelemetry(const TrainingTelemetry&) = delete;
+    TrainingTelemetry& operator=(const TrainingTelemetry&) = delete;
+
+    void setFormat(TelemetryFormat format) { format_.store(format, std::memory_order_relaxed); }
+    TelemetryFormat format() const { return format_.load(std::memory_order_relaxed); }
+
+    void startEpoch();
+    void endEpoch(const EpochSummary& summary);
+    bool recording() const { return recording_ != TELEMETRY_OFF; }
+
+    void addPhaseTime(TrainingPhase phase, std::chrono::steady_clock::duration elapsed) { phaseTimes_[phase] += elapsed; }
+
+    // Adds the time from construction to destruction to a phase, when the epoch is recorded
+    class PhaseTimer {
+    public:
+        PhaseTimer(TrainingTelemetry* telemetry, TrainingPhase phase)
+            : telemetry_(telemetry && telemetry->recording() ? telemetry : nullptr), phase_(phase) {
+            if (telemetry_) {
+                start_ = std::chrono::steady_clock::now();
+            }
+        }
+        ~PhaseTimer() {
+            if (telemetry_) {
+                telemetry_->addPhaseTime(phase_, std::chrono::steady_clock::now() - start_);
+            }
+        }
+
+        PhaseTimer(const PhaseTimer&) = delete;
+        PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    private:
+        TrainingTelemetry* telemetry_;
+        TrainingPhase phase_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+private:
+    void writeCsv(const EpochSummary& summary, double seconds, long peakRssKilobytes);
+    void writeJson(const EpochSummary& summary, double seconds, long peakRssKilobytes);
+
+    std::string filename_;
+    std::ofstream file_;
+    std::ostream& output_;
+    std::atomic<TelemetryFormat> format_;
+    TelemetryFormat recording_ = TELEMETRY_OFF;  // format of the current epoch, fixed at startEpoch
+    bool csvHeaderWritten_ = false;
+    std::chrono::steady_clock::time_point epochStart_;
+    std::array<std::chrono::steady_clock::duration, NUM_TRAINING_PHASES> phaseTimes_{};
+};
+
+const char* trainingPhaseName(TrainingPhase phase);
+
+TelemetryFormat parseTelemetryFormat(const std::string& name, TelemetryFormat fallback);
+
+long peakResidentSetKilobytes();
+
+#endif
@@ -1,6 +1,7 @@
-#include "../include/neural_network.h"
+#include "../include/activation_functions.h"
 
 #include <Eigen/Dense>
+#include <cmath>
 
 /**
  * @brief Applies the ReLU activation function element-wise to a matrix.
@@ -11,34 +12,25 @@
  * @param Z The input matrix to which ReLU will be applied.
  * @return A matrix with the same dimensions as the input matrix, where each element is the result of applying ReLU.
  */
-Eigen::MatrixXf ReLU(Eigen::MatrixXf Z){
-    return Z.array().max(0);
+Eigen::MatrixXf ReLU(const Eigen::MatrixXf& Z){
+    return Z.cwiseMax(0.0f);
 }
 
 /**
  * @brief Applies the softmax function
  *
  * This function computes the softmax function along the columns of a given matrix.
- * Softmax converts raw scores into probabilities for each column independently
+ * Softmax converts raw scores into probabilities for each column independently.
+ * The largest score of each column is subtracted before exponentiating, so large
+ * scores cannot overflow.
  *
  * @param Z The input matrix to which softmax will be applied.
  * @return A matrix with the same dimensions as the input matrix, where each column represents
  *         the softmax probabilities for one data point.
  */
 Eigen::MatrixXf softmax(const Eigen::MatrixXf& Z) {
-    Eigen::MatrixXf A(Z.rows(), Z.cols());
-
-    // Compute exponential of Z
-    Eigen::MatrixXf expZ = Z.array().exp();
-
-    // Compute sum of exponential along each column
-    Eigen::VectorXf expZSum = expZ.colwise().sum();
-
-    // Compute softmax for each column
-    for (int j = 0; j < Z.cols(); ++j) {
-        A.col(j) = expZ.col(j) / expZSum(j);
-    }
-
+    Eigen::MatrixXf A = Z;
+    softmaxInPlace(A);
     return A;
 }
 
@@ -51,18 +43,96 @@ Eigen::MatrixXf softmax(const Eigen::MatrixXf& Z) {
  * @param Z The input matrix for which the derivative of ReLU will be calculated.
  * @return A matrix with the same dimensions as the input matrix, containing the derivatives of ReLU.
  */
-Eigen::MatrixXf ReLU_derivative(Eigen::MatrixXf Z){
-    Eigen::MatrixXf derivative(Z.rows(), Z.cols());
+Eigen::MatrixXf ReLU_derivative(const Eigen::MatrixXf& Z){
+    return (Z.array() > 0.0f).cast<float>();
+}
 
-    for (int i = 0; i < Z.rows(); ++i) {
-        for (int j = 0; j < Z.cols(); ++j) {
-            if (Z(i, j) > 0) {
-                derivative(i, j) = 1;
-            } else {
-                derivative(i, j) = 0;
-            }
+/**
+ * @brief Adds a bias to every column and applies ReLU in a single pass.
+ *
+ * Each column is read once: the biased value is written back to Z (the pre-activation,
+ * needed by backpropagation) and its ReLU to A. A may alias Z when only the activation is needed.
+ *
+ * @param Z The pre-activation matrix W*X, updated in place to W*X + b.
+ * @param b The bias vector, one entry per row of Z.
+ * @param A Output matrix of the same shape as Z, receives ReLU(Z + b).
+ */
+void biasReLU(Eigen::Ref<Eigen::MatrixXf> Z, const Eigen::Ref<const Eigen::VectorXf>& b, Eigen::Ref<Eigen::MatrixXf> A) {
+    const Eigen::Index rows = Z.rows();
+
+    for (Eigen::Index j = 0; j < Z.cols(); ++j) {
+        float* z = Z.col(j).data();
+        float* a = A.col(j).data();
+        for (Eigen::Index i = 0; i < rows; ++i) {
+            float value = z[i] + b(i);
+            z[i] = value;
+            a[i] = value > 0.0f ? value : 0.0f;
         }
     }
+}
 
-    return derivative;
-}
\ No newline at end of file
+/**
+ * @brief Applies a numerically stable softmax to each column, in place.
+ *
+ * @param Z The scores, overwritten with the softmax probabilities of each column.
+ */
+void softmaxInPlace(Eigen::Ref<Eigen::MatrixXf> Z) {
+    for (Eigen::Index j = 0; j < Z.cols(); ++j) {
+        auto column = Z.col(j);
+        float maxValue = column.maxCoeff();
+        column = (column.array() - maxValue).exp();
+        column /= column.sum();
+    }
+}
+
+/**
+ * @brief Mean cross-entropy loss computed directly from the output scores.
+ *
+ * Uses log-sum-exp with the column maximum subtracted, so it stays finite for any
+ * scores and needs no probability matrix.
+ *
+ * @param Z The output scores, one column per sample.
+ * @param Y The true labels.
+ * @return The mean cross-entropy loss over the columns.
+ */
+float crossEntropyFromLogits(const Eigen::Ref<const Eigen::MatrixXf>& Z, const Eigen::VectorXi& Y) {
+    double totalLoss = 0.0;
+
+    for (Eigen::Index j = 0; j < Z.cols(); ++j) {
+        auto scores = Z.col(j);
+        float maxValue = scores.maxCoeff();
+        totalLoss += std::log((scores.array() - maxValue).exp().sum()) + maxValue - scores(Y(j));
+    }
+
+    return Z.cols() > 0 ? static_cast<float>(totalLoss / Z.cols()) : 0.0f;
+}
+
+/**
+ * @brief Fused, numerically stable softmax and cross-entropy loss.
+ *
+ * For each column the largest score m is subtracted before exponentiating, giving the
+ * softmax probabilities and the log-sum-exp from the same pass:
+ *     loss = log(sum(exp(z - m))) + m - z[y]
+ *
+ * @param Z The output scores, one column per sample.
+ * @param Y The true labels.
+ * @param A Output matrix of the same shape as Z, receives the softmax probabilities.
+ * @return The mean cross-entropy loss over the columns.
+ */
+float softmaxCrossEntropy(const Eigen::Ref<const Eigen::MatrixXf>& Z, const Eigen::VectorXi& Y, Eigen::Ref<Eigen::MatrixXf> A) {
+    double totalLoss = 0.0;
+
+    for (Eigen::Index j = 0; j < Z.cols(); ++j) {
+        auto scores = Z.col(j);
+        auto probabilities = A.col(j);
+
+        float maxValue = scores.maxCoeff();
+        probabilities = (scores.array() - maxValue).exp();
+        float sum = probabilities.sum();
+        probabilities /= sum;
+
+        totalLoss += std::log(sum) + maxValue - scores(Y(j));
+    }
+
+    return Z.cols() > 0 ? static_cast<float>(totalLoss / Z.cols()) : 0.0f;
+}
@@ -0,0 +1,53 @@
+#include "../include/allocation_counter.h"
+
+#include <atomic>
+
+/*
+ * Counting heap allocations
+ *
+ * The counter only moves when the allocator hooks of src/allocation_hooks.cpp are linked into
+ * the executable, which the test target does and the application does not. Every other binary
+ * keeps the system allocator untouched and reports counting as unsupported.
+ */
+
+namespace {
+std::atomic<std::size_t> allocationCount{0};
+std::atomic<bool> countingEnabled{false};
+}
+
+/**
+ * @brief Whether heapAllocationCount() observes allocations in this executable.
+ *
+ * @return True when the allocator hooks are linked in and active.
+ */
+bool heapAllocationCountingSupported() {
+    return countingEnabled.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Get the number of heap allocations made by the process so far.
+ *
+ * Take the difference of two readings to count the allocations made by a region of code.
+ * Always 0 where counting is not supported.
+ *
+ * @return The number of calls to the allocator since the process started.
+ */
+std::size_t heapAllocationCount() {
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Mark counting as supported; called once by the allocator hooks at startup.
+ */
+void enableHeapAllocationCounting() {
+    countingEnabled.store(true, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Count one call to the allocator, from any thread.
+ *
+ * Safe to call before static initialisation, as the counter is constant-initialised.
+ */
+void recordHeapAllocation() {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,88 @@
+#include "../include/allocation_counter.h"
+
+#include <cerrno>
+#include <cstdlib>
+
+/*
+ * Allocator hooks for heapAllocationCount()
+ *
+ * Eigen allocates matrix storage with std::malloc rather than operator new, so counting
+ * operator new would miss exactly the allocations we care about. With glibc the allocator
+ * entry points can be replaced by the executable, so malloc and friends are wrapped here
+ * and forwarded to glibc's own implementation.
+ *
+ * This file is not part of NumberClassifierCore: only the test target links it in, so the
+ * application and the inference server keep the system allocator. Elsewhere than glibc it
+ * compiles to nothing and counting stays unsupported.
+ */
+
+#if defined(__GLIBC__)
+
+namespace {
+
+// Whether an alignment is one posix_memalign and aligned_alloc accept
+bool validAlignment(std::size_t alignment) {
+    return alignment != 0 && (alignment & (alignment - 1)) == 0 && alignment % sizeof(void*) == 0;
+}
+
+struct EnableCounting {
+    EnableCounting() { enableHeapAllocationCounting(); }
+} enableCounting;
+
+}
+
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* pointer, std::size_t size);
+void* __libc_memalign(std::size_t alignment, std::size_t size);
+void __libc_free(void* pointer);
+
+void* malloc(std::size_t size) {
+    recordHeapAllocation();
+    return __libc_malloc(size);
+}
+
+void* calloc(std::size_t count, std::size_t size) {
+    recordHeapAllocation();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, std::size_t size) {
+    recordHeapAllocation();
+    return __libc_realloc(pointer, size);
+}
+
+void* memalign(std::size_t alignment, std::size_t size) {
+    recordHeapAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(std::size_t alignment, std::size_t size) {
+    recordHeapAllocation();
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** pointer, std::size_t alignment, std::size_t size) {
+    recordHeapAllocation();
+    if (!validAlignment(alignment)) {
+        return EINVAL;
+    }
+    void* result = __libc_memalign(alignment, size);
+    if (result == nullptr) {
+        return ENOMEM;
+    }
+    *pointer = result;
+    return 0;
+}
+
+void free(void* pointer) {
+    __libc_free(pointer);
+}
+}
+
+#endif
@@ -0,0 +1,113 @@
+#include "../include/async_validator.h"
+
+/**
+ * @brief Start the validation thread, which idles until a snapshot is submitted.
+ *
+ * @param evaluate Computes the validation accuracy and loss of a snapshot; runs on the validation thread.
+ * @param report Receives every result, on the validation thread; may be empty.
+ */
+AsyncValidator::AsyncValidator(Evaluate evaluate, Report report)
+    : evaluate_(std::move(evaluate)), report_(std::move(report)) {
+    worker_ = std::thread(&AsyncValidator::workerLoop, this);
+}
+
+/**
+ * @brief Finish the submitted snapshots, then stop the validation thread.
+ */
+AsyncValidator::~AsyncValidator() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+    worker_.join();
+}
+
+/**
+ * @brief Queue a copy of the parameters for validation and return without waiting for it.
+ *
+ * The copy goes into a buffer that is reused, so after the first snapshot submitting does not
+ * allocate. If the previous snapshot has not started evaluating yet it is replaced, so a
+ * validation slower than training reports fewer results instead of stalling the trainer.
+ *
+ * @param iteration The iteration or epoch the parameters are from.
+ * @param params The parameters; only read during the call.
+ */
+void AsyncValidator::submit(int iteration, const NetworkView& params) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.W1 = params.W1;
+        pending_.b1 = params.b1;
+        pending_.W2 = params.W2;
+        pending_.b2 = params.b2;
+        pendingIteration_ = iteration;
+        if (hasPending_) {
+            ++replaced_;
+        }
+        hasPending_ = true;
+    }
+    changed_.notify_all();
+}
+
+/**
+ * @brief Block until every submitted snapshot has been evaluated and reported.
+ */
+void AsyncValidator::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return !hasPending_ && !busy_; });
+}
+
+/**
+ * @brief The most recent result, if any validation has finished yet.
+ *
+ * @return The result of the last evaluated snapshot.
+ */
+std::optional<ValidationResult> AsyncValidator::latest() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return latest_;
+}
+
+/**
+ * @brief The number of snapshots replaced by a newer one before they were evaluated.
+ *
+ * @return The count since construction.
+ */
+int AsyncValidator::replaced() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return replaced_;
+}
+
+/**
+ * @brief Body of the validation thread: evaluate each snapshot as it arrives.
+ *
+ * The pending snapshot is swapped into the evaluation buffer, so the trainer can submit
+ * the next one while this one is evaluated.
+ */
+void AsyncValidator::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        changed_.wait(lock, [this] { return stopping_ || hasPending_; });
+        if (!hasPending_) {
+            return;
+        }
+
+        std::swap(pending_, evaluating_);
+        const int iteration = pendingIteration_;
+        hasPending_ = false;
+        busy_ = true;
+        lock.unlock();
+
+        ValidationResult result = evaluate_(evaluating_);
+        result.iteration = iteration;
+        if (report_) {
+            report_(result);
+        }
+
+        lock.lock();
+        latest_ = result;
+        busy_ = false;
+        changed_.notify_all();
+    }
+}
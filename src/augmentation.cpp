@@ -0,0 +1,214 @@
+#include "../include/augmentation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+/**
+ * @brief Derive the generator seed of one sample in one epoch.
+ *
+ * Each input is folded in with a splitmix64 round, so neighbouring indices and epochs give
+ * unrelated streams. Seeding this way does not allocate, unlike std::seed_seq.
+ *
+ * @param seed The augmenter's seed.
+ * @param sampleIndex The dataset index of the sample.
+ * @param epoch The epoch, counting from 0.
+ * @return The seed for the sample's generator.
+ */
+static std::uint32_t sampleSeed(std::uint64_t seed, int sampleIndex, int epoch) {
+    auto mix = [](std::uint64_t z) {
+        z += 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    };
+    std::uint64_t z = mix(seed);
+    z = mix(z ^ static_cast<std::uint32_t>(sampleIndex));
+    z = mix(z ^ static_cast<std::uint32_t>(epoch));
+    return static_cast<std::uint32_t>(z >> 32);
+}
+
+/**
+ * @brief Precompute the pixel grid and Gaussian kernel, and allocate a workspace per thread.
+ *
+ * @param width The width of an image in pixels.
+ * @param height The height of an image in pixels.
+ * @param config The ranges of the random transformations.
+ * @param seed Seed for every random variant; the same seed reproduces the same variants.
+ * @param numThreads The number of threads each batch is split across, including the caller.
+ */
+ImageAugmenter::ImageAugmenter(int width, int height, const AugmentationConfig& config, unsigned int seed, int numThreads)
+    : width_(width), height_(height), config_(config), seed_(seed), gridX_(width * height), gridY_(width * height) {
+    const float centreX = (width_ - 1) * 0.5f;
+    const float centreY = (height_ - 1) * 0.5f;
+    for (int y = 0; y < height_; ++y) {
+        for (int x = 0; x < width_; ++x) {
+            gridX_(y * width_ + x) = x - centreX;
+            gridY_(y * width_ + x) = y - centreY;
+        }
+    }
+
+    // Three standard deviations cover all but a negligible tail of the Gaussian
+    const int radius = config_.elasticSigma > 0.0f ? std::min(static_cast<int>(std::ceil(3.0f * config_.elasticSigma)), std::min(width_, height_) - 1) : 0;
+    kernel_.resize(2 * radius + 1);
+    float total = 0.0f;
+    for (int k = -radius; k <= radius; ++k) {
+        kernel_[k + radius] = radius > 0 ? std::exp(-0.5f * k * k / (config_.elasticSigma * config_.elasticSigma)) : 1.0f;
+        total += kernel_[k + radius];
+    }
+    for (float& weight : kernel_) {
+        weight /= total;
+    }
+
+    if (numThreads > 1) {
+        pool_ = std::make_unique<ThreadPool>(numThreads);
+    }
+    workspaces_.resize(pool_ ? pool_->size() : 1);
+    for (Workspace& workspace : workspaces_) {
+        workspace.original.resize(width_ * height_);
+        workspace.fieldX.resize(width_ * height_);
+        workspace.fieldY.resize(width_ * height_);
+        workspace.smoothed.resize(width_ * height_);
+        workspace.sourceX.resize(width_ * height_);
+        workspace.sourceY.resize(width_ * height_);
+    }
+}
+
+/**
+ * @brief Augment every image of a batch in place; matches the BatchAugmentation signature.
+ *
+ * With several threads the batch is split into contiguous column ranges, one per thread.
+ *
+ * @param batchData The batch, one row-major image per column.
+ * @param sampleIndices The dataset index of each column.
+ * @param epoch The epoch, counting from 0.
+ */
+void ImageAugmenter::augment(Eigen::MatrixXf& batchData, const int* sampleIndices, int epoch) {
+    const int numImages = static_cast<int>(batchData.cols());
+    const int numTasks = std::min(static_cast<int>(workspaces_.size()), numImages);
+
+    auto task = [&](int t) {
+        const int begin = static_cast<int>(static_cast<long long>(numImages) * t / numTasks);
+        const int end = static_cast<int>(static_cast<long long>(numImages) * (t + 1) / numTasks);
+        for (int j = begin; j < end; ++j) {
+            augmentImage(batchData.col(j), sampleIndices[j], epoch, t);
+        }
+    };
+
+    if (numTasks > 1) {
+        pool_->parallelFor(numTasks, task);
+    } else if (numTasks == 1) {
+        task(0);
+    }
+}
+
+/**
+ * @brief Replace one image by its random variant for a sample and epoch.
+ *
+ * Every output pixel is mapped back to a source position: the inverse rotation about the
+ * centre and the inverse shift, plus the elastic displacement. The coordinate maps are whole-image
+ * array expressions; only the bilinear lookups are scalar. Source positions outside the
+ * image read as 0, the background.
+ *
+ * @param image The image, row-major, width * height values.
+ * @param sampleIndex The dataset index of the sample, which selects its random variant.
+ * @param epoch The epoch, counting from 0.
+ * @param workspace The index of the calling thread's workspace.
+ */
+void ImageAugmenter::augmentImage(Eigen::Ref<Eigen::VectorXf> image, int sampleIndex, int epoch, int workspace) {
+    Workspace& w = workspaces_[workspace];
+    std::mt19937 generator(sampleSeed(seed_, sampleIndex, epoch));
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    const float shiftX = config_.maxShift * unit(generator);
+    const float shiftY = config_.maxShift * unit(generator);
+    const float angle = config_.maxRotationDegrees * 3.14159265f / 180.0f * unit(generator);
+    const float c = std::cos(angle);
+    const float s = std::sin(angle);
+    const float centreX = (width_ - 1) * 0.5f;
+    const float centreY = (height_ - 1) * 0.5f;
+
+    w.sourceX = c * (gridX_ - shiftX) + s * (gridY_ - shiftY) + centreX;
+    w.sourceY = c * (gridY_ - shiftY) - s * (gridX_ - shiftX) + centreY;
+
+    // Elastic distortion: a uniform random displacement field, smoothed so that nearby pixels move together
+    if (config_.elasticAlpha > 0.0f) {
+        for (Eigen::Index i = 0; i < w.fieldX.size(); ++i) {
+            w.fieldX(i) = unit(generator);
+            w.fieldY(i) = unit(generator);
+        }
+        smoothField(w.fieldX, w.smoothed);
+        smoothField(w.fieldY, w.smoothed);
+        w.sourceX += config_.elasticAlpha * w.fieldX;
+        w.sourceY += config_.elasticAlpha * w.fieldY;
+    }
+
+    w.original = image.array();
+    const float* original = w.original.data();
+    auto pixel = [&](int x, int y) {
+        return x >= 0 && x < width_ && y >= 0 && y < height_ ? original[y * width_ + x] : 0.0f;
+    };
+
+    for (Eigen::Index i = 0; i < image.size(); ++i) {
+        const float x = w.sourceX(i);
+        const float y = w.sourceY(i);
+        const float floorX = std::floor(x);
+        const float floorY = std::floor(y);
+        const float fx = x - floorX;
+        const float fy = y - floorY;
+        const int x0 = static_cast<int>(floorX);
+        const int y0 = static_cast<int>(floorY);
+
+        const float top = (1.0f - fx) * pixel(x0, y0) + fx * pixel(x0 + 1, y0);
+        const float bottom = (1.0f - fx) * pixel(x0, y0 + 1) + fx * pixel(x0 + 1, y0 + 1);
+        image(i) = (1.0f - fy) * top + fy * bottom;
+    }
+}
+
+/**
+ * @brief Smooth a displacement field with the separable Gaussian kernel, in place.
+ *
+ * Each pass adds shifted copies of whole rows or columns of the field, weighted by the
+ * kernel, so the inner loops are contiguous vector operations. Beyond the border the field is 0.
+ *
+ * @param field The field, row-major, width * height values; receives the result.
+ * @param smoothed Scratch buffer of the same size.
+ */
+void ImageAugmenter::smoothField(Eigen::ArrayXf& field, Eigen::ArrayXf& smoothed) const {
+    typedef Eigen::Map<Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> ImageMap;
+    ImageMap image(field.data(), height_, width_);
+    ImageMap rows(smoothed.data(), height_, width_);
+    const int radius = static_cast<int>(kernel_.size()) / 2;
+
+    rows.setZero();
+    for (int k = -radius; k <= radius; ++k) {
+        const int span = width_ - std::abs(k);
+        rows.middleCols(std::max(0, -k), span) += kernel_[k + radius] * image.middleCols(std::max(0, k), span);
+    }
+
+    image.setZero();
+    for (int k = -radius; k <= radius; ++k) {
+        const int span = height_ - std::abs(k);
+        image.middleRows(std::max(0, -k), span) += kernel_[k + radius] * rows.middleRows(std::max(0, k), span);
+    }
+}
+
+/**
+ * @brief Create an augmentation hook for TrainingConfig::augment.
+ *
+ * The hook shares one ImageAugmenter between its copies, and so must only be run by one
+ * thread at a time, as the batch prefetcher does.
+ *
+ * @param width The width of an image in pixels.
+ * @param height The height of an image in pixels.
+ * @param config The ranges of the random transformations.
+ * @param seed Seed for every random variant.
+ * @param numThreads The number of threads each batch is split across, including the loader thread.
+ * @return The hook.
+ */
+BatchAugmentation makeImageAugmentation(int width, int height, const AugmentationConfig& config, unsigned int seed, int numThreads) {
+    std::shared_ptr<ImageAugmenter> augmenter = std::make_shared<ImageAugmenter>(width, height, config, seed, numThreads);
+    return [augmenter](Eigen::MatrixXf& batchData, const int* sampleIndices, int epoch) {
+        augmenter->augment(batchData, sampleIndices, epoch);
+    };
+}
@@ -0,0 +1,170 @@
+#include "../include/batch_prefetcher.h"
+
+#include <chrono>
+
+/**
+ * @brief Prefetch batches of a float dataset.
+ *
+ * @param data The dataset, one sample per column. Must outlive the prefetcher.
+ * @param labels The labels of the dataset.
+ * @param permutation The sample order; shuffle it only between epochs, once every batch of the epoch has been taken.
+ * @param batchSize The number of samples per batch.
+ * @param augment Optional hook run on every batch on the loader thread.
+ * @param firstEpoch The epoch passed to the hook for the first startEpoch(), e.g. when resuming a run.
+ */
+BatchPrefetcher::BatchPrefetcher(const Eigen::MatrixXf& data, const Eigen::VectorXi& labels, const DatasetPermutation& permutation, int batchSize, BatchAugmentation augment, int firstEpoch)
+    : BatchPrefetcher([&data, &labels, &permutation](int start, Eigen::MatrixXf& batchData, Eigen::VectorXi& batchLabels) {
+                          gatherBatch(data, labels, permutation, start, batchData, batchLabels);
+                      },
+                      permutation, static_cast<int>(data.rows()), batchSize, std::move(augment), firstEpoch) {}
+
+/**
+ * @brief Prefetch batches of a raw 8-bit dataset; pixels are normalised on the loader thread.
+ *
+ * @param data The dataset as raw pixels, one sample per column. Must outlive the prefetcher.
+ * @param labels The labels of the dataset.
+ * @param permutation The sample order; shuffle it only between epochs, once every batch of the epoch has been taken.
+ * @param batchSize The number of samples per batch.
+ * @param augment Optional hook run on every batch on the loader thread.
+ * @param firstEpoch The epoch passed to the hook for the first startEpoch(), e.g. when resuming a run.
+ */
+BatchPrefetcher::BatchPrefetcher(const PixelMatrix& data, const Eigen::VectorXi& labels, const DatasetPermutation& permutation, int batchSize, BatchAugmentation augment, int firstEpoch)
+    : BatchPrefetcher([&data, &labels, &permutation](int start, Eigen::MatrixXf& batchData, Eigen::VectorXi& batchLabels) {
+                          gatherBatch(data, labels, permutation, start, batchData, batchLabels);
+                      },
+                      permutation, static_cast<int>(data.rows()), batchSize, std::move(augment), firstEpoch) {}
+
+/**
+ * @brief Allocate both batch buffers and start the loader thread, which idles until startEpoch().
+ *
+ * @param gather Fills a batch buffer from the dataset, starting at a position of the permutation.
+ * @param permutation The sample order.
+ * @param rows The number of rows of a sample.
+ * @param batchSize The number of samples per batch.
+ * @param augment Optional hook run on every batch on the loader thread.
+ * @param firstEpoch The epoch passed to the hook for the first startEpoch(), e.g. when resuming a run.
+ */
+BatchPrefetcher::BatchPrefetcher(Gather gather, const DatasetPermutation& permutation, int rows, int batchSize, BatchAugmentation augment, int firstEpoch)
+    : gather_(std::move(gather)), permutation_(permutation), augment_(std::move(augment)), batchSize_(batchSize), epoch_(firstEpoch - 1) {
+    for (PrefetchedBatch& buffer : buffers_) {
+        buffer.X.resize(rows, batchSize_);
+        buffer.Y.resize(batchSize_);
+    }
+    loader_ = std::thread(&BatchPrefetcher::loaderLoop, this);
+}
+
+/**
+ * @brief Stop and join the loader thread.
+ */
+BatchPrefetcher::~BatchPrefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+    loader_.join();
+}
+
+/**
+ * @brief Start loading the batches of a new epoch in the permutation's current order.
+ *
+ * Call after shuffling the permutation for the epoch. The loader immediately starts
+ * filling both buffers, so the first batch is usually ready by the time it is needed.
+ *
+ * @param numBatches The number of batches in the epoch.
+ */
+void BatchPrefetcher::startEpoch(int numBatches) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++epoch_;
+        numBatches_ = numBatches;
+        produced_ = 0;
+        consumed_ = 0;
+        holding_ = false;
+        ready_.fill(false);
+    }
+    changed_.notify_all();
+}
+
+/**
+ * @brief Take the next batch of the epoch, waiting for the loader if it is not ready yet.
+ *
+ * The batch stays valid until the following call to next() or startEpoch(); taking it
+ * hands the previous batch's buffer back to the loader. Time spent waiting is added to
+ * inputStallSeconds().
+ *
+ * @return The batch.
+ */
+const PrefetchedBatch& BatchPrefetcher::next() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (holding_) {
+        ready_[(consumed_ - 1) % 2] = false;
+        holding_ = false;
+        changed_.notify_all();
+    }
+
+    const int slot = consumed_ % 2;
+    if (!ready_[slot]) {
+        auto waitStart = std::chrono::steady_clock::now();
+        changed_.wait(lock, [&] { return ready_[slot]; });
+        inputStallNanoseconds_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - waitStart).count(),
+                                         std::memory_order_relaxed);
+    }
+
+    ++consumed_;
+    holding_ = true;
+    return buffers_[slot];
+}
+
+/**
+ * @brief Zero the stall counters, e.g. at the start of an epoch.
+ */
+void BatchPrefetcher::resetStallCounters() {
+    inputStallNanoseconds_.store(0, std::memory_order_relaxed);
+    loaderStallNanoseconds_.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Body of the loader thread: fill buffers as they become free, in batch order.
+ *
+ * Time spent with both buffers full, waiting for the trainer, is added to loaderStallSeconds().
+ * Waiting because the epoch is finished is not counted.
+ */
+void BatchPrefetcher::loaderLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        changed_.wait(lock, [this] { return stopping_ || produced_ < numBatches_; });
+        if (stopping_) {
+            return;
+        }
+
+        const int slot = produced_ % 2;
+        if (ready_[slot]) {
+            auto waitStart = std::chrono::steady_clock::now();
+            changed_.wait(lock, [&] { return stopping_ || !ready_[slot] || produced_ >= numBatches_; });
+            loaderStallNanoseconds_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - waitStart).count(),
+                                              std::memory_order_relaxed);
+            continue;
+        }
+
+        const int epoch = epoch_;
+        const int batch = produced_;
+        lock.unlock();
+
+        PrefetchedBatch& buffer = buffers_[slot];
+        const int start = batch * batchSize_;
+        gather_(start, buffer.X, buffer.Y);
+        if (augment_) {
+            augment_(buffer.X, permutation_.indices().data() + start, epoch);
+        }
+
+        lock.lock();
+        // A new epoch may have started while the batch was loading; it is then loaded again
+        if (epoch == epoch_ && batch == produced_) {
+            ready_[slot] = true;
+            ++produced_;
+            changed_.notify_all();
+        }
+    }
+}
@@ -0,0 +1,209 @@
+#include "../include/checkpoint.h"
+#include "../include/model_format.h"
+
+#include <iostream>
+
+// The integers of a checkpoint that are not stored in it as arrays
+struct CheckpointCounters {
+    std::uint32_t completed;
+    std::uint32_t optimizer[2];  // type and step count
+};
+
+/**
+ * @brief Collect the integers of a checkpoint for checkpointTensors.
+ *
+ * @param checkpoint The checkpoint.
+ * @return The completed count, the optimizer type and its step count.
+ */
+static CheckpointCounters checkpointCounters(const TrainingCheckpoint& checkpoint) {
+    return {static_cast<std::uint32_t>(checkpoint.completed),
+            {static_cast<std::uint32_t>(checkpoint.optimizerState.type), checkpoint.optimizerState.steps}};
+}
+
+/**
+ * @brief List the tensors of a checkpoint, in the model file format.
+ *
+ * The parameters are stored under the same names as a saved model, so a checkpoint can also
+ * be loaded with loadParameters. The counters, optimizer type, sample order and generator
+ * state are uint32 tensors.
+ *
+ * @param checkpoint The checkpoint.
+ * @param counters Storage for the counters, which must outlive the returned list.
+ * @return The tensors, pointing into checkpoint.
+ */
+static std::vector<ModelTensor> checkpointTensors(const TrainingCheckpoint& checkpoint, const CheckpointCounters& counters) {
+    std::vector<ModelTensor> tensors = {{"W1", checkpoint.W1.data(), checkpoint.W1.rows(), checkpoint.W1.cols()},
+                                        {"b1", checkpoint.b1.data(), checkpoint.b1.rows(), 1},
+                                        {"W2", checkpoint.W2.data(), checkpoint.W2.rows(), checkpoint.W2.cols()},
+                                        {"b2", checkpoint.b2.data(), checkpoint.b2.rows(), 1},
+                                        {"completed", &counters.completed, 1, 1, TENSOR_UINT32},
+                                        {"optimizer", counters.optimizer, 2, 1, TENSOR_UINT32},
+                                        {"permutation", checkpoint.permutation.data(), static_cast<Eigen::Index>(checkpoint.permutation.size()), 1, TENSOR_UINT32},
+                                        {"generator", checkpoint.generatorState.data(), static_cast<Eigen::Index>(checkpoint.generatorState.size()), 1, TENSOR_UINT32}};
+    const std::vector<Eigen::MatrixXf>& buffers = checkpoint.optimizerState.buffers;
+    for (std::size_t i = 0; i < buffers.size(); ++i) {
+        tensors.push_back({"optimizer." + std::to_string(i), buffers[i].data(), buffers[i].rows(), buffers[i].cols()});
+    }
+    return tensors;
+}
+
+/**
+ * @brief Write a checkpoint on the calling thread.
+ *
+ * The file replaces any previous one atomically, so an interrupted save leaves the last
+ * complete checkpoint in place.
+ *
+ * @param checkpoint The training state.
+ * @param filename The checkpoint file.
+ * @return Whether the checkpoint was written.
+ */
+bool saveCheckpoint(const TrainingCheckpoint& checkpoint, const std::string& filename) {
+    const CheckpointCounters counters = checkpointCounters(checkpoint);
+    return saveModelFile(checkpointTensors(checkpoint, counters), filename);
+}
+
+/**
+ * @brief Read a checkpoint written by saveCheckpoint or a CheckpointWriter.
+ *
+ * The file's structure and checksum are verified first, so a damaged checkpoint is rejected
+ * rather than resumed from.
+ *
+ * @param filename The checkpoint file.
+ * @return The training state, or nothing if the file does not exist or is not a valid checkpoint.
+ */
+std::optional<TrainingCheckpoint> loadCheckpoint(const std::string& filename) {
+    ModelFile file(filename);
+    if (!file.hasModelHeader() || !file.isValid()) {
+        return std::nullopt;
+    }
+
+    Eigen::Map<const WordMatrix> completed = file.words("completed");
+    Eigen::Map<const WordMatrix> optimizer = file.words("optimizer");
+    if (!file.hasNetwork() || completed.size() != 1 || optimizer.size() != 2 || optimizer(0) > OPTIMIZER_ADAM) {
+        std::cerr << "Not a training checkpoint: " << filename << std::endl;
+        return std::nullopt;
+    }
+
+    TrainingCheckpoint checkpoint;
+    NetworkView network = file.network();
+    checkpoint.W1 = network.W1;
+    checkpoint.b1 = network.b1;
+    checkpoint.W2 = network.W2;
+    checkpoint.b2 = network.b2;
+    checkpoint.completed = static_cast<int>(completed(0));
+
+    Eigen::Map<const WordMatrix> permutation = file.words("permutation");
+    checkpoint.permutation.assign(permutation.data(), permutation.data() + permutation.size());
+    Eigen::Map<const WordMatrix> generator = file.words("generator");
+    checkpoint.generatorState.assign(generator.data(), generator.data() + generator.size());
+
+    checkpoint.optimizerState.type = static_cast<OptimizerType>(optimizer(0));
+    checkpoint.optimizerState.steps = optimizer(1);
+    for (int i = 0; file.findTensor("optimizer." + std::to_string(i)) != nullptr; ++i) {
+        checkpoint.optimizerState.buffers.emplace_back(file.matrix("optimizer." + std::to_string(i)));
+    }
+    return checkpoint;
+}
+
+/**
+ * @brief Start the writer thread, which idles until a checkpoint is submitted.
+ *
+ * @param filename The checkpoint file; each checkpoint replaces the previous one.
+ */
+CheckpointWriter::CheckpointWriter(const std::string& filename) : filename_(filename), temporaryName_(filename + ".tmp") {
+    worker_ = std::thread(&CheckpointWriter::workerLoop, this);
+}
+
+/**
+ * @brief Finish the submitted checkpoints, then stop the writer thread.
+ */
+CheckpointWriter::~CheckpointWriter() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+    worker_.join();
+}
+
+/**
+ * @brief Snapshot a checkpoint and return without waiting for it to be written.
+ *
+ * The complete file image is assembled on the calling thread into a buffer that is reused,
+ * so the caller may change its state as soon as this returns. Writing it, the slow part, is
+ * left to the writer thread, which does not allocate.
+ *
+ * @param checkpoint The training state; only read during the call.
+ */
+void CheckpointWriter::submit(const TrainingCheckpoint& checkpoint) {
+    const CheckpointCounters counters = checkpointCounters(checkpoint);
+    if (!assembleModelFile(checkpointTensors(checkpoint, counters), staging_)) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::swap(staging_, pending_);
+        hasPending_ = true;
+    }
+    changed_.notify_all();
+}
+
+/**
+ * @brief Block until every submitted checkpoint has been written.
+ */
+void CheckpointWriter::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return !hasPending_ && !busy_; });
+}
+
+/**
+ * @brief The number of checkpoints written so far.
+ *
+ * @return The count since construction.
+ */
+int CheckpointWriter::written() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return written_;
+}
+
+/**
+ * @brief The number of checkpoints that could not be written.
+ *
+ * @return The count since construction.
+ */
+int CheckpointWriter::failed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failed_;
+}
+
+/**
+ * @brief Body of the writer thread: write each checkpoint as it arrives.
+ */
+void CheckpointWriter::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        changed_.wait(lock, [this] { return stopping_ || hasPending_; });
+        if (!hasPending_) {
+            return;
+        }
+
+        std::swap(pending_, writing_);
+        hasPending_ = false;
+        busy_ = true;
+        lock.unlock();
+
+        const bool ok = writeFileAtomically(writing_, filename_, temporaryName_);
+
+        lock.lock();
+        if (ok) {
+            ++written_;
+        } else {
+            ++failed_;
+        }
+        busy_ = false;
+        changed_.notify_all();
+    }
+}
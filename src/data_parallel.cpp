@@ -0,0 +1,218 @@
+#include "../include/data_parallel.h"
+#include "../include/helpers.h"
+
+#include <algorithm>
+#include <utility>
+
+/**
+ * @brief Allocate the per-shard buffers for data-parallel training steps.
+ *
+ * The batch is split into one contiguous shard per thread, with sizes differing by at
+ * most one sample. Every shard owns its batch buffers and a TrainingWorkspace, so after
+ * construction a step performs no heap allocation.
+ *
+ * @param pool The thread pool that runs the shards; one shard per pool thread.
+ * @param inputSize The number of inputs (rows of X).
+ * @param hiddenSize The number of neurons in the hidden layer.
+ * @param outputSize The number of output classes.
+ * @param batchSize The number of samples per step.
+ * @param optimizer Applies the reduced gradients; nullptr for plain SGD. Must outlive the step.
+ * @param augment Optional hook run on every gathered shard, on the calling thread; see startEpoch().
+ */
+DataParallelStep::DataParallelStep(ThreadPool& pool, int inputSize, int hiddenSize, int outputSize, int batchSize, Optimizer* optimizer,
+                                   BatchAugmentation augment)
+    : pool_(pool), optimizer_(optimizer), augment_(std::move(augment)), batchSize_(batchSize) {
+    const int numShards = std::max(1, std::min(pool.size(), batchSize));
+
+    int shardStart = 0;
+    for (int shard = 0; shard < numShards; ++shard) {
+        const int shardSize = batchSize / numShards + (shard < batchSize % numShards ? 1 : 0);
+        shardStarts_.push_back(shardStart);
+        shardX_.emplace_back(inputSize, shardSize);
+        shardY_.emplace_back(shardSize);
+        workspaces_.emplace_back(inputSize, hiddenSize, outputSize, shardSize);
+        shardStart += shardSize;
+    }
+    shardCorrect_.resize(numShards);
+}
+
+/**
+ * @brief Gather every shard and compute its gradients in parallel.
+ *
+ * Each shard's gradients are the mean over its own samples; they are weighted by the
+ * shard's share of the batch so that the sum over shards is the mean over the batch.
+ * While telemetry is recording, gathering, the forward pass and the backward pass run as
+ * three parallel passes so each can be timed; otherwise every shard does all three in one task.
+ * With an augmentation hook the shards are augmented one after another between the gathering
+ * and the other two passes, as the hook may only run on one thread at a time; it can split
+ * each shard across threads of its own.
+ *
+ * @param params The current parameters, only read.
+ * @param X The full training set.
+ * @param Y The labels of the full training set.
+ * @param permutation The sample order of the current epoch.
+ * @param start The position in the permutation of the first sample of the batch.
+ * @param telemetry Optional, receives the time of each phase.
+ * @param sampleIndices The dataset index of each sample of the batch, for the augmentation hook.
+ */
+template <typename Data>
+void DataParallelStep::computeShards(const NetworkParameters& params, const Data& X, const Eigen::VectorXi& Y, const DatasetPermutation& permutation, int start,
+                                     TrainingTelemetry* telemetry, const int* sampleIndices) {
+    auto gatherTask = [&](int shard) {
+        gatherBatch(X, Y, permutation, start + shardStarts_[shard], shardX_[shard], shardY_[shard]);
+    };
+    auto forwardTask = [&](int shard) {
+        forwardPass(params, shardX_[shard], shardY_[shard], workspaces_[shard]);
+    };
+    auto backwardTask = [&](int shard) {
+        TrainingWorkspace& ws = workspaces_[shard];
+        backwardPass(params, shardX_[shard], shardY_[shard], ws);
+
+        const float weight = static_cast<float>(shardX_[shard].cols()) / static_cast<float>(batchSize_);
+        ws.dW1 *= weight;
+        ws.db1 *= weight;
+        ws.dW2 *= weight;
+        ws.db2 *= weight;
+        ws.loss *= weight;
+        shardCorrect_[shard] = countCorrectPredictions(ws.A2, shardY_[shard]);
+    };
+
+    const int numShards = static_cast<int>(workspaces_.size());
+    const bool timed = telemetry && telemetry->recording();
+    if (!timed && !augment_) {
+        auto shardTask = [&](int shard) {
+            gatherTask(shard);
+            forwardTask(shard);
+            backwardTask(shard);
+        };
+        pool_.parallelFor(numShards, shardTask);
+        return;
+    }
+
+    {
+        TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_DATA);
+        pool_.parallelFor(numShards, gatherTask);
+        if (augment_) {
+            for (int shard = 0; shard < numShards; ++shard) {
+                augment_(shardX_[shard], sampleIndices + shardStarts_[shard], epoch_);
+            }
+        }
+    }
+    if (!timed) {
+        auto computeTask = [&](int shard) {
+            forwardTask(shard);
+            backwardTask(shard);
+        };
+        pool_.parallelFor(numShards, computeTask);
+        return;
+    }
+    {
+        TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_FORWARD);
+        pool_.parallelFor(numShards, forwardTask);
+    }
+    TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_BACKWARD);
+    pool_.parallelFor(numShards, backwardTask);
+}
+
+/**
+ * @brief Sum the shard gradients into the first workspace with a pairwise tree.
+ *
+ * The pairing only depends on the number of shards, never on thread timing, so the
+ * floating point result is the same from run to run. Pairs of each level are summed in parallel.
+ */
+void DataParallelStep::reduce() {
+    const int numShards = static_cast<int>(workspaces_.size());
+
+    for (int stride = 1; stride < numShards; stride *= 2) {
+        const int numPairs = (numShards + 2 * stride - 1) / (2 * stride);
+
+        auto pairTask = [&](int pair) {
+            const int target = pair * 2 * stride;
+            const int source = target + stride;
+            if (source < numShards) {
+                workspaces_[target].dW1 += workspaces_[source].dW1;
+                workspaces_[target].db1 += workspaces_[source].db1;
+                workspaces_[target].dW2 += workspaces_[source].dW2;
+                workspaces_[target].db2 += workspaces_[source].db2;
+                workspaces_[target].loss += workspaces_[source].loss;
+            }
+        };
+        pool_.parallelFor(numPairs, pairTask);
+    }
+}
+
+/**
+ * @brief Compute, reduce and apply the gradients of one batch.
+ *
+ * @param params The parameters to update in place.
+ * @param X The full training set.
+ * @param Y The labels of the full training set.
+ * @param permutation The sample order of the current epoch.
+ * @param start The position in the permutation of the first sample of the batch.
+ * @param alpha The learning rate.
+ * @param telemetry Optional, receives the time of each phase; the reduction counts as backward.
+ * @param sampleIndices The dataset index of each sample of the batch, for the augmentation hook;
+ *                      nullptr for the permutation's entries from start.
+ */
+template <typename Data>
+void DataParallelStep::step(NetworkParameters& params, const Data& X, const Eigen::VectorXi& Y, const DatasetPermutation& permutation, int start, float alpha,
+                            TrainingTelemetry* telemetry, const int* sampleIndices) {
+    if (sampleIndices == nullptr) {
+        sampleIndices = permutation.indices().data() + start;
+    }
+    computeShards(params, X, Y, permutation, start, telemetry, sampleIndices);
+    {
+        TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_BACKWARD);
+        reduce();
+    }
+    {
+        TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_UPDATE);
+        if (optimizer_) {
+            optimizer_->step(params, workspaces_.front(), alpha);
+        } else {
+            applyGradients(params, workspaces_.front(), alpha);
+        }
+    }
+
+    numCorrect_ = 0;
+    for (int correct : shardCorrect_) {
+        numCorrect_ += correct;
+    }
+    loss_ = workspaces_.front().loss;
+}
+
+/**
+ * @brief Perform one data-parallel gradient descent step on a float dataset.
+ *
+ * @param params The parameters to update in place.
+ * @param X The full training set.
+ * @param Y The labels of the full training set.
+ * @param permutation The sample order of the current epoch.
+ * @param start The position in the permutation of the first sample of the batch.
+ * @param alpha The learning rate.
+ * @param telemetry Optional, receives the time of each phase.
+ * @param sampleIndices The dataset index of each sample of the batch, for the augmentation hook;
+ *                      nullptr for the permutation's entries from start, as for a dataset in memory.
+ */
+void DataParallelStep::run(NetworkParameters& params, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y, const DatasetPermutation& permutation, int start, float alpha,
+                           TrainingTelemetry* telemetry, const int* sampleIndices) {
+    step(params, X, Y, permutation, start, alpha, telemetry, sampleIndices);
+}
+
+/**
+ * @brief Perform one data-parallel gradient descent step on a raw 8-bit dataset.
+ *
+ * @param params The parameters to update in place.
+ * @param X The full training set as raw pixels.
+ * @param Y The labels of the full training set.
+ * @param permutation The sample order of the current epoch.
+ * @param start The position in the permutation of the first sample of the batch.
+ * @param alpha The learning rate.
+ * @param telemetry Optional, receives the time of each phase.
+ * @param sampleIndices The dataset index of each sample of the batch, for the augmentation hook;
+ *                      nullptr for the permutation's entries from start, as for a dataset in memory.
+ */
+void DataParallelStep::run(NetworkParameters& params, const PixelMatrix& X, const Eigen::VectorXi& Y, const DatasetPermutation& permutation, int start, float alpha,
+                           TrainingTelemetry* telemetry, const int* sampleIndices) {
+    step(params, X, Y, permutation, start, alpha, telemetry, sampleIndices);
+}
@@ -1,135 +1,210 @@
 #include "../include/dataset_utils.h"
+#include "../include/mapped_file.h"
 #include <iostream>
 #include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <Eigen/Dense>
+#include <numeric>
 #include <random>
+#include <sstream>
+#include <thread>
 
 /**
- * @brief Convert endianness of a 32-bit integer.
+ * @brief Read a big-endian 32-bit integer.
  *
- * This function converts the endianness of a 32-bit integer from big-endian to little-endian or vice versa.
+ * IDX headers store every field as a big-endian 32-bit integer.
  *
- * @param value The 32-bit integer whose endianness is to be converted.
- * @return The 32-bit integer with its endianness converted.
+ * @param bytes Pointer to the first of the four bytes.
+ * @return The decoded integer.
  */
-int32_t convertEndian(int32_t value) {
-    return ((value >> 24) & 0xff) | ((value << 8) & 0xff0000) |
-           ((value >> 8) & 0xff00) | ((value << 24) & 0xff000000);
+int32_t readBigEndian32(const unsigned char* bytes) {
+    return static_cast<int32_t>((static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+                                (static_cast<uint32_t>(bytes[2]) << 8) | static_cast<uint32_t>(bytes[3]));
 }
 
 /**
- * @brief Read the header of a dataset file.
+ * @brief Validate the header of a memory-mapped IDX file.
  *
- * This function reads the header of a dataset file
+ * This function checks the magic number and that the length of the file matches the
+ * dimensions declared in the header exactly, so a truncated download is rejected before
+ * any data is converted.
  *
- * @param file An input file stream connected to the dataset file.
- * @return A tuple containing the magic number, number of images, number of rows, and number of columns.
+ * @param file The mapped IDX file.
+ * @param expectedMagic 2051 for IDX3 image files, 2049 for IDX1 label files.
+ * @param dimensions Receives the declared dimensions (items, then rows and columns for IDX3).
+ * @return An empty string if the header is valid, otherwise a description of the problem.
  */
-std::tuple<int, int, int, int> readDatasetHeader(std::ifstream& file) {
-    int magicNumber, numImages, numRows, numCols;
+static std::string validateIdxHeader(const MappedFile& file, int32_t expectedMagic, std::vector<int32_t>& dimensions) {
+    const std::size_t numDimensions = expectedMagic == 2051 ? 3 : 1;
+    const std::size_t headerSize = 4 * (1 + numDimensions);
 
-    // Read the magic number, number of images, number of rows, and number of columns
-    file.read(reinterpret_cast<char*>(&magicNumber), sizeof(magicNumber));
-    file.read(reinterpret_cast<char*>(&numImages), sizeof(numImages));
-    file.read(reinterpret_cast<char*>(&numRows), sizeof(numRows));
-    file.read(reinterpret_cast<char*>(&numCols), sizeof(numCols));
+    if (file.size() < headerSize) {
+        return "file is too small to contain an IDX header";
+    }
+
+    int32_t magicNumber = readBigEndian32(file.data());
+    if (magicNumber != expectedMagic) {
+        return "invalid magic number " + std::to_string(magicNumber) + ", expected " + std::to_string(expectedMagic);
+    }
+
+    dimensions.resize(numDimensions);
+    std::size_t expectedSize = 1;
+    for (std::size_t i = 0; i < numDimensions; ++i) {
+        dimensions[i] = readBigEndian32(file.data() + 4 * (i + 1));
+        if (dimensions[i] < 0) {
+            return "negative dimension in header";
+        }
+        expectedSize *= static_cast<std::size_t>(dimensions[i]);
+    }
+    expectedSize += headerSize;
+
+    if (file.size() != expectedSize) {
+        return "file is " + std::to_string(file.size()) + " bytes but its header declares " + std::to_string(expectedSize);
+    }
+
+    return "";
+}
+
+/**
+ * @brief Convert raw pixel bytes to normalised floats.
+ *
+ * A single linear pass over contiguous memory that the compiler vectorises. Large
+ * inputs are split into contiguous ranges that are converted on separate threads.
+ *
+ * @param source The raw pixel values.
+ * @param destination Output buffer of the same length.
+ * @param count The number of pixels to convert.
+ * @param numThreads The number of threads to use, 0 to pick one based on the input size.
+ */
+static void convertPixels(const unsigned char* source, float* destination, std::size_t count, int numThreads) {
+    // Below this many pixels per thread, spawning threads costs more than it saves
+    constexpr std::size_t minPixelsPerThread = 1 << 22;
 
-    // Convert from big-endian to little-endian
-    magicNumber = convertEndian(magicNumber);
-    numImages = convertEndian(numImages);
-    numRows = convertEndian(numRows);
-    numCols = convertEndian(numCols);
+    if (numThreads <= 0) {
+        numThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    numThreads = static_cast<int>(std::min<std::size_t>(numThreads, std::max<std::size_t>(1, count / minPixelsPerThread)));
+
+    auto convertRange = [source, destination](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            destination[i] = static_cast<float>(source[i]) / 255.0f;
+        }
+    };
+
+    if (numThreads == 1) {
+        convertRange(0, count);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    const std::size_t chunk = (count + numThreads - 1) / numThreads;
+    for (int t = 1; t < numThreads; ++t) {
+        std::size_t begin = std::min(count, t * chunk);
+        std::size_t end = std::min(count, begin + chunk);
+        workers.emplace_back(convertRange, begin, end);
+    }
+    convertRange(0, std::min(count, chunk));
 
-    return std::make_tuple(magicNumber, numImages, numRows, numCols);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
 }
 
 /**
  * @brief Read image data from an IDX file into an Eigen matrix.
  *
- * This function reads mnist image data from an IDX file, normalises the pixel values
- * and stores them in an Eigen matrix.
+ * This function memory-maps an mnist IDX3 image file, validates its header against the
+ * length of the file, normalises the pixel values and stores them in an Eigen matrix.
+ * Each image is stored contiguously in the file and Eigen matrices are column-major, so
+ * the whole file converts in a single bulk pass with one image per column.
  *
  * @param filename The name of the IDX file to read.
+ * @param numThreads The number of threads used for the conversion, 0 to choose automatically.
  * @return An Eigen matrix containing the image data.
  */
-Eigen::MatrixXf readData(const std::string& filename) {
+Eigen::MatrixXf readData(const std::string& filename, int numThreads) {
 
-    // Open the file in binary mode
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
+    MappedFile file(filename);
+    if (!file.isOpen()) {
         std::cerr << "Error opening file " << filename << std::endl;
         exit(1);
     }
 
-    // Read the header of the dataset file
-    int magicNumber, numImages, numRows, numCols;
-    std::tie(magicNumber, numImages, numRows, numCols) = readDatasetHeader(file);
-
-    // Check if the magic number indicates an IDX3-ubyte file
-    if (magicNumber != 2051) {
-        std::cerr << "Invalid magic number. This might not be an IDX3-ubyte file." << std::endl;
+    // Check the header describes an IDX3-ubyte file of exactly this length
+    std::vector<int32_t> dimensions;
+    std::string error = validateIdxHeader(file, 2051, dimensions);
+    if (!error.empty()) {
+        std::cerr << "Invalid IDX3-ubyte file " << filename << ": " << error << std::endl;
         exit(1);
     }
 
-    // Initialize an Eigen matrix to store the image data
+    const int numImages = dimensions[0];
+    const int numRows = dimensions[1];
+    const int numCols = dimensions[2];
+
     Eigen::MatrixXf data(numRows * numCols, numImages);
+    convertPixels(file.data() + 16, data.data(), static_cast<std::size_t>(data.size()), numThreads);
 
-    // Read image data pixel by pixel
-    for (int i = 0; i < numImages; ++i) {
-        for (int j = 0; j < numRows * numCols; ++j) {
-            unsigned char pixel;
-            // Read a single pixel value from the file
-            file.read(reinterpret_cast<char*>(&pixel), sizeof(pixel));
-            // Normalize pixel values and store it
-            data(j, i) = static_cast<float>(pixel)/255.0f;
-        }
+    return data;
+}
+
+/**
+ * @brief Read image data from an IDX file without normalising it.
+ *
+ * This function keeps the pixels as raw bytes, one image per column, which takes a quarter
+ * of the memory of readData. The 1/255 scaling is applied later, when batches are gathered.
+ *
+ * @param filename The name of the IDX file to read.
+ * @return A byte matrix containing the image data.
+ */
+PixelMatrix readRawData(const std::string& filename) {
+
+    MappedFile file(filename);
+    if (!file.isOpen()) {
+        std::cerr << "Error opening file " << filename << std::endl;
+        exit(1);
     }
 
-    file.close();
+    std::vector<int32_t> dimensions;
+    std::string error = validateIdxHeader(file, 2051, dimensions);
+    if (!error.empty()) {
+        std::cerr << "Invalid IDX3-ubyte file " << filename << ": " << error << std::endl;
+        exit(1);
+    }
+
+    PixelMatrix data(dimensions[1] * dimensions[2], dimensions[0]);
+    std::copy(file.data() + 16, file.data() + 16 + data.size(), data.data());
+
     return data;
 }
 
 /**
  * @brief Read label data from an IDX file into an eigen matrix.
  *
- * This function reads label data from an IDX file and stores it in an eigen matrix.
+ * This function memory-maps an IDX1 label file, validates its header against the
+ * length of the file and converts the labels in a single pass.
  *
  * @param filename The name of the IDX file to read.
- * @return A matrix containing the label data.
+ * @return A matrix containing the label data, empty if the file could not be read.
  */
 Eigen::VectorXi readLabels(const std::string& filename) {
     Eigen::VectorXi labels;
-    std::ifstream file(filename, std::ios::binary);
 
-    if (!file) {
+    MappedFile file(filename);
+    if (!file.isOpen()) {
         std::cerr << "Failed to open file: " << filename << std::endl;
         return labels;
     }
 
-    // Read the magic number
-    int magic_number;
-    file.read(reinterpret_cast<char*>(&magic_number), sizeof(magic_number));
-    magic_number = __builtin_bswap32(magic_number); // Convert from big-endian to little-endian
-    if (magic_number != 2049) {
-        std::cerr << "Invalid magic number" << std::endl;
+    std::vector<int32_t> dimensions;
+    std::string error = validateIdxHeader(file, 2049, dimensions);
+    if (!error.empty()) {
+        std::cerr << "Invalid IDX1-ubyte file " << filename << ": " << error << std::endl;
         return labels;
     }
-    // Read the number of labels
-    int num_labels;
-    file.read(reinterpret_cast<char*>(&num_labels), sizeof(num_labels));
-    num_labels = __builtin_bswap32(num_labels); // Convert from big-endian to little-endian
-
-    labels.resize(num_labels);
-
-    // Read the labels
-    for (int i = 0; i < num_labels; ++i) {
-        uint8_t label_byte;
-        file.read(reinterpret_cast<char*>(&label_byte), sizeof(label_byte));
-        labels(i, 0) = static_cast<int>(label_byte);
-    }
 
+    labels = Eigen::Map<const Eigen::Matrix<unsigned char, Eigen::Dynamic, 1>>(file.data() + 8, dimensions[0]).cast<int>();
 
     return labels;
 }
@@ -171,6 +246,15 @@ void savePGM(const std::string& filename, const Eigen::MatrixXf& image) {
     file.close();
 }
 
+/**
+ * @brief Shuffle the columns of a dataset and its labels in place.
+ *
+ * This copies the whole dataset once per call. Training loops should prefer a
+ * DatasetPermutation with gatherBatch, which never touches the data matrix.
+ *
+ * @param data The data matrix whose columns are shuffled.
+ * @param labels The labels, shuffled with the same permutation as the data.
+ */
 void shuffleDataAndLabels(Eigen::MatrixXf& data, Eigen::VectorXi& labels) {
     // Create an index array
     std::vector<int> indices(data.cols());
@@ -191,3 +275,173 @@ void shuffleDataAndLabels(Eigen::MatrixXf& data, Eigen::VectorXi& labels) {
         labels(i) = tempLabels(indices[i]);
     }
 }
+
+/**
+ * @brief Construct a permutation over the columns of a dataset.
+ *
+ * The permutation starts as the identity. If a seed is given, the sequence of
+ * shuffles is reproducible; otherwise the generator is seeded from std::random_device.
+ *
+ * @param size The number of samples in the dataset.
+ * @param seed Optional seed for the shuffle generator.
+ */
+DatasetPermutation::DatasetPermutation(int size, std::optional<unsigned int> seed)
+    : indices_(size), generator_(seed ? *seed : std::random_device{}()) {
+    std::iota(indices_.begin(), indices_.end(), 0);
+}
+
+/**
+ * @brief Shuffle the permutation.
+ *
+ * Only the index array is reordered; the dataset it refers to is left untouched.
+ */
+void DatasetPermutation::shuffle() {
+    std::shuffle(indices_.begin(), indices_.end(), generator_);
+}
+
+/**
+ * @brief Capture the state of the shuffle generator.
+ *
+ * @return The generator state, as returned by saveGeneratorState().
+ */
+std::vector<std::uint32_t> DatasetPermutation::generatorState() const {
+    return saveGeneratorState(generator_);
+}
+
+/**
+ * @brief Restore the sample order and shuffle generator of a saved run.
+ *
+ * The next shuffle then continues the saved sequence of orders exactly.
+ *
+ * @param indices The saved order; must be a permutation of the same size.
+ * @param generatorState The words returned by generatorState().
+ * @return Whether the state was restored; the permutation is unchanged otherwise.
+ */
+bool DatasetPermutation::restore(const std::vector<int>& indices, const std::vector<std::uint32_t>& generatorState) {
+    std::mt19937 generator;
+    if (!isPermutation(indices, size()) || !restoreGeneratorState(generator, generatorState)) {
+        return false;
+    }
+
+    indices_ = indices;
+    generator_ = generator;
+    return true;
+}
+
+/**
+ * @brief Capture the state of a std::mt19937, e.g. a shuffle generator for a checkpoint.
+ *
+ * @param generator The generator.
+ * @return Its state as 32-bit words, in the standard text order of std::mt19937.
+ */
+std::vector<std::uint32_t> saveGeneratorState(const std::mt19937& generator) {
+    std::stringstream text;
+    text << generator;
+
+    std::vector<std::uint32_t> state;
+    std::uint32_t word;
+    while (text >> word) {
+        state.push_back(word);
+    }
+    return state;
+}
+
+/**
+ * @brief Restore a std::mt19937 from the words returned by saveGeneratorState().
+ *
+ * @param generator Receives the state.
+ * @param state The saved words.
+ * @return Whether the words were a complete generator state; the generator is unchanged otherwise.
+ */
+bool restoreGeneratorState(std::mt19937& generator, const std::vector<std::uint32_t>& state) {
+    std::stringstream text;
+    for (std::uint32_t word : state) {
+        text << word << ' ';
+    }
+    std::mt19937 restored;
+    if (!(text >> restored)) {
+        return false;
+    }
+    generator = restored;
+    return true;
+}
+
+/**
+ * @brief Check that a saved order holds every index of [0, size) exactly once.
+ *
+ * @param indices The order, e.g. read from a checkpoint.
+ * @param size The number of samples it must order.
+ * @return Whether it is a permutation of [0, size).
+ */
+bool isPermutation(const std::vector<int>& indices, int size) {
+    if (static_cast<int>(indices.size()) != size) {
+        return false;
+    }
+    std::vector<bool> seen(size, false);
+    for (int index : indices) {
+        if (index < 0 || index >= size || seen[index]) {
+            return false;
+        }
+        seen[index] = true;
+    }
+    return true;
+}
+
+/**
+ * @brief Gather a batch of samples through a permutation.
+ *
+ * This function copies the columns permutation.indices()[start, start + batchData.cols())
+ * of the dataset into the preallocated batch buffers. The size of the batch is taken
+ * from batchData, so the buffers can be allocated once and reused for every step.
+ *
+ * @param data The full dataset, one sample per column.
+ * @param labels The labels of the full dataset.
+ * @param permutation The permutation that defines the sample order.
+ * @param start The position in the permutation of the first sample of the batch.
+ * @param batchData Output buffer for the batch samples.
+ * @param batchLabels Output buffer for the batch labels, same length as batchData.cols().
+ */
+void gatherBatch(const Eigen::MatrixXf& data, const Eigen::VectorXi& labels, const DatasetPermutation& permutation, int start,
+                 Eigen::MatrixXf& batchData, Eigen::VectorXi& batchLabels) {
+    const std::vector<int>& indices = permutation.indices();
+
+    for (int i = 0; i < batchData.cols(); ++i) {
+        const int column = indices[start + i];
+        batchData.col(i) = data.col(column);
+        batchLabels(i) = labels(column);
+    }
+}
+
+/**
+ * @brief Gather a batch of raw 8-bit samples through a permutation, normalising them.
+ *
+ * Same as the float overload, but the selected columns are converted to floats in [0, 1]
+ * as they are copied, so the dataset can stay resident as bytes.
+ *
+ * @param data The full dataset as raw pixels, one sample per column.
+ * @param labels The labels of the full dataset.
+ * @param permutation The permutation that defines the sample order.
+ * @param start The position in the permutation of the first sample of the batch.
+ * @param batchData Output buffer for the normalised batch samples.
+ * @param batchLabels Output buffer for the batch labels, same length as batchData.cols().
+ */
+void gatherBatch(const PixelMatrix& data, const Eigen::VectorXi& labels, const DatasetPermutation& permutation, int start,
+                 Eigen::MatrixXf& batchData, Eigen::VectorXi& batchLabels) {
+    const std::vector<int>& indices = permutation.indices();
+
+    for (int i = 0; i < batchData.cols(); ++i) {
+        const int column = indices[start + i];
+        batchData.col(i) = data.col(column).cast<float>() / 255.0f;
+        batchLabels(i) = labels(column);
+    }
+}
+
+/**
+ * @brief Convert a block of raw pixels to normalised floats.
+ *
+ * @param pixels The raw pixels, one sample per column.
+ * @param normalised Output matrix, resized to match pixels if needed.
+ */
+void normalisePixels(const Eigen::Ref<const PixelMatrix>& pixels, Eigen::MatrixXf& normalised) {
+    normalised = pixels.cast<float>() / 255.0f;
+}
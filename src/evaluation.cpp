@@ -0,0 +1,238 @@
+#include "../include/evaluation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+/**
+ * @brief The proportion of correctly classified samples.
+ *
+ * @return The accuracy, 0 for an empty dataset.
+ */
+double EvaluationReport::accuracy() const {
+    return numSamples > 0 ? static_cast<double>(numCorrect) / numSamples : 0.0;
+}
+
+/**
+ * @brief The mean cross-entropy loss.
+ *
+ * @return The loss, 0 for an empty dataset.
+ */
+double EvaluationReport::loss() const {
+    return numSamples > 0 ? totalLoss / numSamples : 0.0;
+}
+
+/**
+ * @brief The proportion of samples predicted as a class that really belong to it.
+ *
+ * @param label The class.
+ * @return The precision, 0 if the class was never predicted.
+ */
+double EvaluationReport::precision(int label) const {
+    const int predicted = confusion.col(label).sum();
+    return predicted > 0 ? static_cast<double>(confusion(label, label)) / predicted : 0.0;
+}
+
+/**
+ * @brief The proportion of samples of a class that were predicted as it.
+ *
+ * @param label The class.
+ * @return The recall, 0 if the class does not occur.
+ */
+double EvaluationReport::recall(int label) const {
+    const int actual = confusion.row(label).sum();
+    return actual > 0 ? static_cast<double>(confusion(label, label)) / actual : 0.0;
+}
+
+/**
+ * @brief Allocate the chunk buffers for a network shape.
+ *
+ * The buffer for normalising raw 8-bit datasets is left empty until one is evaluated, so
+ * evaluators of float data do not carry an input-sized chunk they never use.
+ *
+ * @param hiddenSize The number of neurons in the hidden layer.
+ * @param numClasses The number of output classes.
+ * @param chunkSize The number of samples run through the network at once.
+ */
+Evaluator::Evaluator(int hiddenSize, int numClasses, int chunkSize)
+    : chunkSize_(std::max(1, chunkSize)), hidden_(hiddenSize, chunkSize_), logits_(numClasses, chunkSize_) {
+    report_.confusion = Eigen::MatrixXi::Zero(numClasses, numClasses);
+}
+
+/**
+ * @brief Evaluate a network on a float dataset.
+ *
+ * @param network The network, with the shape the evaluator was created for.
+ * @param X The dataset, one sample per column.
+ * @param Y The true labels; samples labelled outside [0, numClasses) are skipped.
+ * @return The report, valid until the evaluator is used again.
+ */
+const EvaluationReport& Evaluator::evaluate(const NetworkView& network, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y) {
+    reset();
+    accumulate(network, X, Y);
+    return report_;
+}
+
+/**
+ * @brief Evaluate a network on a raw 8-bit dataset, normalising it chunk by chunk.
+ *
+ * @param network The network, with the shape the evaluator was created for.
+ * @param X The dataset as raw pixels, one sample per column.
+ * @param Y The true labels; samples labelled outside [0, numClasses) are skipped.
+ * @return The report, valid until the evaluator is used again.
+ */
+const EvaluationReport& Evaluator::evaluate(const NetworkView& network, const PixelMatrix& X, const Eigen::VectorXi& Y) {
+    reset();
+    accumulate(network, X, Y);
+    return report_;
+}
+
+/**
+ * @brief Evaluate a network on a streamed dataset, one chunk of the stream at a time.
+ *
+ * Starts a new unshuffled pass over the stream, so memory stays bounded by the stream's chunks.
+ *
+ * @param network The network, with the shape the evaluator was created for.
+ * @param stream The dataset; its current chunk is invalidated.
+ * @return The report, valid until the evaluator is used again.
+ */
+const EvaluationReport& Evaluator::evaluate(const NetworkView& network, IdxStream& stream) {
+    reset();
+    stream.startEpoch(false);
+    while (stream.next()) {
+        accumulate(network, stream.chunkData().leftCols(stream.chunkCount()), stream.chunkLabels().head(stream.chunkCount()));
+    }
+    return report_;
+}
+
+/**
+ * @brief Clear the report before accumulating a new dataset.
+ */
+void Evaluator::reset() {
+    report_.numSamples = 0;
+    report_.numCorrect = 0;
+    report_.numInvalidLabels = 0;
+    report_.totalLoss = 0.0;
+    report_.confusion.setZero();
+}
+
+/**
+ * @brief Add a batch of samples of any size to the report.
+ *
+ * @param network The network, with the shape the evaluator was created for.
+ * @param X The samples, one per column.
+ * @param Y Their true labels; samples labelled outside [0, numClasses) are skipped.
+ */
+void Evaluator::accumulate(const NetworkView& network, const Eigen::Ref<const Eigen::MatrixXf>& X, const Eigen::Ref<const Eigen::VectorXi>& Y) {
+    for (Eigen::Index start = 0; start < X.cols(); start += chunkSize_) {
+        const Eigen::Index count = std::min<Eigen::Index>(chunkSize_, X.cols() - start);
+        accumulateChunk(network, X.middleCols(start, count), Y.segment(start, count));
+    }
+}
+
+/**
+ * @brief Add a batch of raw 8-bit samples of any size to the report, normalising them chunk by chunk.
+ *
+ * The normalisation buffer is allocated by the first call.
+ *
+ * @param network The network, with the shape the evaluator was created for.
+ * @param X The samples as raw pixels, one per column.
+ * @param Y Their true labels; samples labelled outside [0, numClasses) are skipped.
+ */
+void Evaluator::accumulate(const NetworkView& network, const Eigen::Ref<const PixelMatrix>& X, const Eigen::Ref<const Eigen::VectorXi>& Y) {
+    if (input_.rows() != X.rows()) {
+        input_.resize(X.rows(), chunkSize_);
+    }
+    for (Eigen::Index start = 0; start < X.cols(); start += chunkSize_) {
+        const Eigen::Index count = std::min<Eigen::Index>(chunkSize_, X.cols() - start);
+        Eigen::MatrixXf::ColsBlockXpr input = input_.leftCols(count);
+        input = X.middleCols(start, count).cast<float>() / 255.0f;
+        accumulateChunk(network, input, Y.segment(start, count));
+    }
+}
+
+/**
+ * @brief Run one chunk through the network and fold every sample into the report.
+ *
+ * Each column of logits is read once to find the largest score, which is both the prediction
+ * and the shift of the log-sum-exp, and once more for the sum of exponentials:
+ *     loss = log(sum(exp(z - m))) + m - z[y]
+ * The argmax of the logits is the argmax of the softmax, so no probabilities are formed.
+ * Samples whose label is not a class of the network are skipped and counted in
+ * numInvalidLabels rather than indexing past the confusion matrix.
+ *
+ * @param network The network.
+ * @param X The chunk, at most chunkSize columns.
+ * @param Y Its true labels.
+ */
+void Evaluator::accumulateChunk(const NetworkView& network, const Eigen::Ref<const Eigen::MatrixXf>& X, const Eigen::Ref<const Eigen::VectorXi>& Y) {
+    const Eigen::Index count = X.cols();
+    Eigen::MatrixXf::ColsBlockXpr hidden = hidden_.leftCols(count);
+    Eigen::MatrixXf::ColsBlockXpr logits = logits_.leftCols(count);
+
+    hidden.noalias() = network.W1 * X;
+    hidden = (hidden.colwise() + network.b1).cwiseMax(0.0f);
+    logits.noalias() = network.W2 * hidden;
+    logits.colwise() += network.b2;
+
+    const Eigen::Index numClasses = logits.rows();
+    for (Eigen::Index j = 0; j < count; ++j) {
+        const int label = Y(j);
+        if (label < 0 || label >= numClasses) {
+            ++report_.numInvalidLabels;
+            continue;
+        }
+        const float* scores = logits.col(j).data();
+
+        int predicted = 0;
+        float maxScore = scores[0];
+        for (Eigen::Index k = 1; k < numClasses; ++k) {
+            if (scores[k] > maxScore) {
+                maxScore = scores[k];
+                predicted = static_cast<int>(k);
+            }
+        }
+
+        float sum = 0.0f;
+        for (Eigen::Index k = 0; k < numClasses; ++k) {
+            sum += std::exp(scores[k] - maxScore);
+        }
+
+        report_.totalLoss += std::log(sum) + maxScore - scores[label];
+        report_.numCorrect += predicted == label ? 1 : 0;
+        report_.confusion(label, predicted) += 1;
+        ++report_.numSamples;
+    }
+}
+
+/**
+ * @brief Print the accuracy, loss, confusion matrix and per-class precision and recall.
+ *
+ * @param output The stream to print to.
+ * @param report The report to print.
+ */
+void printEvaluationReport(std::ostream& output, const EvaluationReport& report) {
+    output << "Samples: " << report.numSamples << ", Accuracy: " << report.accuracy() << ", Loss: " << report.loss() << std::endl;
+    if (report.numInvalidLabels > 0) {
+        output << "Skipped " << report.numInvalidLabels << " samples with labels outside [0, " << report.confusion.rows() << ")" << std::endl;
+    }
+
+    // Rows are the true labels, columns the predictions
+    output << "Confusion matrix (rows: true label, columns: predicted):" << std::endl;
+    output << "     ";
+    for (int predicted = 0; predicted < report.confusion.cols(); ++predicted) {
+        output << std::setw(6) << predicted;
+    }
+    output << std::endl;
+    for (int label = 0; label < report.confusion.rows(); ++label) {
+        output << std::setw(5) << label;
+        for (int predicted = 0; predicted < report.confusion.cols(); ++predicted) {
+            output << std::setw(6) << report.confusion(label, predicted);
+        }
+        output << std::endl;
+    }
+
+    for (int label = 0; label < report.confusion.rows(); ++label) {
+        output << "Class " << label << ": Precision: " << report.precision(label) << ", Recall: " << report.recall(label) << std::endl;
+    }
+}
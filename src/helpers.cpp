@@ -9,16 +9,17 @@
  * This function initializes the parameters (weights and biases) for the neural network with random values within a specified range.
  * The matrices and vectors are initialized with random values between -0.5 and 0.5.
  *
+ * @param seed Optional seed for the values; otherwise they are seeded from std::random_device.
+ *
  * @return A tuple containing the initialized parameters:
  *         - W1: The weight matrix for the first layer
  *         - b1: The bias vector for the first layer
  *         - W2: The weight matrix for the second layer
  *         - b2: The bias vector for the second layer
  */
-std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> initParams() {
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> initParams(std::optional<unsigned int> seed) {
     // random number generator
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    std::mt19937 gen(seed ? *seed : std::random_device{}());
     std::uniform_real_distribution<> dis(-0.5, 0.5);
 
     // Initialize parameters
@@ -36,12 +37,16 @@ std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> i
  * This function performs one-hot encoding on integer labels.
  *
  * @param Y The vector of integer labels to be one-hot encoded.
+ * @param numClasses The number of rows of the encoded matrix. If 0, it is derived from the largest label,
+ *                   which is only safe when every class is present (e.g. not for a small mini-batch).
  * @return The one-hot encoded matrix where each column represents a sample
  *         and each row represents a class.
  */
-Eigen::MatrixXi oneHotEncode(const Eigen::VectorXi& Y){
+Eigen::MatrixXi oneHotEncode(const Eigen::VectorXi& Y, int numClasses){
     int numSamples = Y.size();
-    int numClasses = Y.maxCoeff() + 1;
+    if (numClasses <= 0) {
+        numClasses = Y.maxCoeff() + 1;
+    }
 
     // Initialize the one-hot encoded matrix
     Eigen::MatrixXi oneHotY(numClasses, numSamples);
@@ -62,7 +67,9 @@ Eigen::MatrixXi oneHotEncode(const Eigen::VectorXi& Y){
  * the index of the maximum value in each column of the output matrix A2.
  *
  * The index of the maximum value also corresponds to the number(0-9) that the prediction is for,
- * if the highest score is at index 4, then it is predicting a number 4
+ * if the highest score is at index 4, then it is predicting a number 4. Each column is scanned
+ * once; on ties the first index wins. The prediction is the same for the softmax output A2 and
+ * for the scores Z2 it was computed from, so callers can skip the softmax.
  *
  * @param A2 The output matrix of shape (num_classes, num_samples) from the neural network.
  * @return A vector of predicted class labels, where each element represents the predicted class
@@ -74,17 +81,37 @@ Eigen::VectorXi getPredictions(const Eigen::MatrixXf& A2) {
     for (int i = 0; i < A2.cols(); ++i) {
 
         // Find the index of the maximum value in each column of A2
-        float maxVal = A2.col(i).maxCoeff();
-        for (int j = 0; j < A2.rows(); ++j) {
-            if (A2(j, i) == maxVal) {
-                predictions(i) = j;
-                break;
-            }
-        }
+        Eigen::Index maxIndex;
+        A2.col(i).maxCoeff(&maxIndex);
+        predictions(i) = static_cast<int>(maxIndex);
     }
     return predictions;
 }
 
+/**
+ * @brief Count the columns of a network output whose highest score is the true label.
+ *
+ * Equivalent to comparing getPredictions(A2) against Y, but without building the
+ * predictions vector, so it can be called on every training step without allocating.
+ *
+ * @param A2 The output matrix of shape (num_classes, num_samples) from the neural network.
+ * @param Y The vector of true class labels.
+ * @return The number of correctly classified samples.
+ */
+int countCorrectPredictions(const Eigen::Ref<const Eigen::MatrixXf>& A2, const Eigen::Ref<const Eigen::VectorXi>& Y) {
+    int numCorrect = 0;
+
+    for (int i = 0; i < A2.cols(); ++i) {
+        Eigen::Index prediction;
+        A2.col(i).maxCoeff(&prediction);
+        if (prediction == Y(i)) {
+            numCorrect++;
+        }
+    }
+
+    return numCorrect;
+}
+
 /**
  * @brief Calculate accuracy of predictions.
  *
@@ -113,20 +140,14 @@ double getAccuracy(const Eigen::VectorXi& predictions, const Eigen::VectorXi& Y)
  * @brief Find the index of the maximum value in a matrix.
  *
  * This function finds the index of the maximum value in the provided Eigen matrix.
- * It iterates through the matrix and returns the index of the first occurrence of the maximum value.
+ * It scans the first column once and returns the index of the first occurrence of the maximum value.
  * If multiple elements have the maximum value, it returns the index of the first occurrence.
  *
  * @param matrix The Eigen matrix to search for the maximum value.
  * @return The index of the maximum value in the matrix.
  */
 int findMaxIndex(const Eigen::MatrixXf& matrix) {
-    float maxVal = matrix.maxCoeff();
-    int maxIndex = -1;
-    for (int i = 0; i < matrix.rows(); ++i) {
-        if (matrix(i, 0) == maxVal) {
-            maxIndex = i;
-            break;
-        }
-    }
-    return maxIndex;
+    Eigen::Index maxIndex;
+    matrix.col(0).maxCoeff(&maxIndex);
+    return static_cast<int>(maxIndex);
 }
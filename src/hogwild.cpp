@@ -0,0 +1,187 @@
+#include "../include/hogwild.h"
+#include "../include/dataset_utils.h"
+#include "../include/evaluation.h"
+#include "../include/helpers.h"
+#include "../include/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+/**
+ * @brief Accuracy of a set of parameters on a float dataset.
+ *
+ * @param params The network parameters.
+ * @param X The dataset, one sample per column.
+ * @param Y The true labels.
+ * @return The proportion of correctly classified samples.
+ */
+static double parametersAccuracy(const NetworkParameters& params, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y) {
+    Evaluator evaluator(static_cast<int>(params.W1.rows()), static_cast<int>(params.W2.rows()));
+    return evaluator.evaluate(NetworkView(params), X, Y).accuracy();
+}
+
+// Private buffers of one Hogwild worker, allocated once before training
+struct HogwildWorker {
+    HogwildWorker(int inputSize, int hiddenSize, int outputSize, int batchSize)
+        : batchX(inputSize, batchSize), batchY(batchSize), workspace(inputSize, hiddenSize, outputSize, batchSize) {
+        activeInputs.reserve(inputSize);
+    }
+
+    Eigen::MatrixXf batchX;
+    Eigen::VectorXi batchY;
+    TrainingWorkspace workspace;
+    std::vector<int> activeInputs;
+    int numCorrect = 0;
+    double totalLoss = 0.0;
+};
+
+/**
+ * @brief Apply a worker's gradients to the shared parameters without locking.
+ *
+ * Column k of dW1 is the sum over the batch of dZ1 scaled by pixel k, so it is exactly
+ * zero when pixel k is zero in every image of the batch. MNIST digits leave most of the
+ * border blank, so only the columns of W1 for pixels that were lit are written, which
+ * keeps concurrent workers mostly on disjoint parts of W1.
+ *
+ * @param params The shared parameters.
+ * @param worker The worker whose workspace holds the gradients of its last batch.
+ * @param alpha The learning rate.
+ */
+static void applySparseGradients(NetworkParameters& params, HogwildWorker& worker, float alpha) {
+    const TrainingWorkspace& ws = worker.workspace;
+
+    worker.activeInputs.clear();
+    for (Eigen::Index k = 0; k < worker.batchX.rows(); ++k) {
+        if ((worker.batchX.row(k).array() != 0.0f).any()) {
+            worker.activeInputs.push_back(static_cast<int>(k));
+        }
+    }
+
+    for (int k : worker.activeInputs) {
+        params.W1.col(k) -= alpha * ws.dW1.col(k);
+    }
+    params.b1 -= alpha * ws.db1;
+    params.W2 -= alpha * ws.dW2;
+    params.b2 -= alpha * ws.db2;
+}
+
+/**
+ * @brief Train the network with Hogwild-style asynchronous SGD.
+ *
+ * config.numThreads workers claim mini-batches from a shared atomic counter (a lock-free
+ * work queue over the epoch's permutation). Each worker computes gradients against the
+ * shared parameters as they are at that moment and writes its update straight back,
+ * without any locking or reduction. Workers may therefore read weights that another
+ * worker is halfway through updating; Hogwild accepts that noise in exchange for never
+ * waiting. Updates only touch the W1 columns of pixels present in the batch.
+ *
+ * @param X The input data matrix.
+ * @param Y The vector of true class labels.
+ * @param valX The validation data matrix.
+ * @param valY The vector of validation class labels.
+ * @param config The learning rate, number of epochs, batch size, optional seed of the initial
+ *               parameters and the shuffles, and number of workers. config.optimizer is ignored:
+ *               the workers always apply plain SGD.
+ *
+ * @return A tuple containing the optimized parameters W1, b1, W2 and b2.
+ */
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> hogwildGradientDescent(const Eigen::MatrixXf& X,const Eigen::VectorXi& Y,const Eigen::MatrixXf& valX,const Eigen::VectorXi& valY, const TrainingConfig& config){
+
+    NetworkParameters params = initNetworkParameters(config.seed);
+
+    const int numSamples = static_cast<int>(X.cols());
+    const int batchSize = std::max(1, std::min(config.batchSize, numSamples));
+    const int batchesPerEpoch = numSamples / batchSize;
+    const int numWorkers = std::max(1, config.numThreads);
+
+    ThreadPool pool(numWorkers);
+    std::vector<HogwildWorker> workers;
+    for (int w = 0; w < numWorkers; ++w) {
+        workers.emplace_back(X.rows(), params.W1.rows(), params.W2.rows(), batchSize);
+    }
+
+    DatasetPermutation permutation(numSamples, config.seed);
+    std::atomic<int> nextBatch{0};
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int epoch = 0; epoch < config.epochs; epoch++) {
+
+        permutation.shuffle();
+        nextBatch.store(0);
+
+        auto workerTask = [&](int w) {
+            HogwildWorker& worker = workers[w];
+            worker.numCorrect = 0;
+            worker.totalLoss = 0.0;
+
+            for (int batch = nextBatch.fetch_add(1, std::memory_order_relaxed); batch < batchesPerEpoch;
+                 batch = nextBatch.fetch_add(1, std::memory_order_relaxed)) {
+                gatherBatch(X, Y, permutation, batch * batchSize, worker.batchX, worker.batchY);
+                computeGradients(params, worker.batchX, worker.batchY, worker.workspace);
+                applySparseGradients(params, worker, config.alpha);
+
+                worker.numCorrect += countCorrectPredictions(worker.workspace.A2, worker.batchY);
+                worker.totalLoss += worker.workspace.loss;
+            }
+        };
+        pool.parallelFor(numWorkers, workerTask);
+
+        int numCorrect = 0;
+        double totalLoss = 0.0;
+        for (const HogwildWorker& worker : workers) {
+            numCorrect += worker.numCorrect;
+            totalLoss += worker.totalLoss;
+        }
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double accuracy = static_cast<double>(numCorrect) / (static_cast<double>(batchesPerEpoch) * batchSize);
+        double valAccuracy = parametersAccuracy(params, valX, valY);
+        std::cout << "Hogwild Epoch: " << epoch+1 << ", Loss: " << totalLoss / batchesPerEpoch << ", Accuracy: " << accuracy
+                  << ", Validation Accuracy: " << valAccuracy << ", Elapsed: " << elapsed << "s" << std::endl;
+    }
+
+    return std::make_tuple(params.W1, params.b1, params.W2, params.b2);
+}
+
+/**
+ * @brief Train with synchronous mini-batch descent and with Hogwild, and compare them.
+ *
+ * Both runs use the same configuration (learning rate, epochs, batch size, seed and
+ * threads; the synchronous run splits each batch across the threads instead). As Hogwild only
+ * applies plain SGD, the synchronous run does too, whatever config.optimizer says. Prints the
+ * wall-clock time, throughput and final validation accuracy of each run.
+ *
+ * @param X The input data matrix.
+ * @param Y The vector of true class labels.
+ * @param valX The validation data matrix.
+ * @param valY The vector of validation class labels.
+ * @param config The training configuration shared by both runs.
+ */
+void compareHogwildWithSynchronous(const Eigen::MatrixXf& X,const Eigen::VectorXi& Y,const Eigen::MatrixXf& valX,const Eigen::VectorXi& valY, const TrainingConfig& config){
+    NetworkParameters synchronous, hogwild;
+    TrainingConfig synchronousConfig = config;
+    synchronousConfig.optimizer.type = OPTIMIZER_SGD;
+    if (config.optimizer.type != OPTIMIZER_SGD) {
+        std::cout << "Hogwild only supports plain SGD, so both runs use it instead of the configured optimizer" << std::endl;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::tie(synchronous.W1, synchronous.b1, synchronous.W2, synchronous.b2) = miniBatchGradientDescent(X, Y, valX, valY, synchronousConfig);
+    auto synchronousEnd = std::chrono::steady_clock::now();
+    std::tie(hogwild.W1, hogwild.b1, hogwild.W2, hogwild.b2) = hogwildGradientDescent(X, Y, valX, valY, config);
+    auto hogwildEnd = std::chrono::steady_clock::now();
+
+    double synchronousSeconds = std::chrono::duration<double>(synchronousEnd - start).count();
+    double hogwildSeconds = std::chrono::duration<double>(hogwildEnd - synchronousEnd).count();
+    double samples = static_cast<double>(config.epochs) * X.cols();
+
+    std::cout << "\nSynchronous vs Hogwild (" << config.numThreads << " threads, batch size " << config.batchSize << ")" << std::endl;
+    std::cout << "  Synchronous: " << synchronousSeconds << "s, " << samples / synchronousSeconds << " samples/sec, "
+              << "Validation Accuracy: " << parametersAccuracy(synchronous, valX, valY) << std::endl;
+    std::cout << "  Hogwild:     " << hogwildSeconds << "s, " << samples / hogwildSeconds << " samples/sec, "
+              << "Validation Accuracy: " << parametersAccuracy(hogwild, valX, valY) << std::endl;
+}
@@ -0,0 +1,312 @@
+#include "../include/idx_stream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <numeric>
+
+/**
+ * @brief Read and validate the header of an IDX file opened as a stream.
+ *
+ * Like the check done for memory-mapped files, the file length must match the dimensions
+ * declared in the header exactly, so a truncated file is rejected before training starts.
+ *
+ * @param file The open file, positioned at its start.
+ * @param filename The path of the file, for its size.
+ * @param expectedMagic 2051 for IDX3 image files, 2049 for IDX1 label files.
+ * @param dimensions Receives the declared dimensions (items, then rows and columns for IDX3).
+ * @return An empty string if the header is valid, otherwise a description of the problem.
+ */
+static std::string readIdxHeader(std::ifstream& file, const std::string& filename, int32_t expectedMagic, std::vector<int32_t>& dimensions) {
+    const std::size_t numDimensions = expectedMagic == 2051 ? 3 : 1;
+    const std::size_t headerSize = 4 * (1 + numDimensions);
+
+    unsigned char header[16];
+    if (!file.read(reinterpret_cast<char*>(header), headerSize)) {
+        return "file is too small to contain an IDX header";
+    }
+
+    int32_t magicNumber = readBigEndian32(header);
+    if (magicNumber != expectedMagic) {
+        return "invalid magic number " + std::to_string(magicNumber) + ", expected " + std::to_string(expectedMagic);
+    }
+
+    dimensions.resize(numDimensions);
+    std::uintmax_t expectedSize = 1;
+    for (std::size_t i = 0; i < numDimensions; ++i) {
+        dimensions[i] = readBigEndian32(header + 4 * (i + 1));
+        if (dimensions[i] < 0) {
+            return "negative dimension in header";
+        }
+        expectedSize *= static_cast<std::uintmax_t>(dimensions[i]);
+    }
+    expectedSize += headerSize;
+
+    std::error_code error;
+    const std::uintmax_t size = std::filesystem::file_size(filename, error);
+    if (error || size != expectedSize) {
+        return "file is " + std::to_string(size) + " bytes but its header declares " + std::to_string(expectedSize);
+    }
+
+    return "";
+}
+
+/**
+ * @brief Open an image and label file pair and start the reader thread.
+ *
+ * Only the headers are read here. Failures are reported on std::cerr and leave the stream
+ * closed, which isOpen() reports.
+ *
+ * @param imageFile The IDX3 image file.
+ * @param labelFile The IDX1 label file, with one label per image.
+ * @param chunkSize The number of samples per chunk; smaller datasets use a single chunk.
+ * @param seed Optional seed for the chunk and sample shuffles, for reproducible runs.
+ */
+IdxStream::IdxStream(const std::string& imageFile, const std::string& labelFile, int chunkSize, std::optional<unsigned int> seed)
+    : imageFile_(imageFile), images_(imageFile, std::ios::binary), labels_(labelFile, std::ios::binary),
+      generator_(seed ? *seed : std::random_device{}()) {
+    if (!images_.is_open()) {
+        std::cerr << "Failed to open file: " << imageFile << std::endl;
+        return;
+    }
+    if (!labels_.is_open()) {
+        std::cerr << "Failed to open file: " << labelFile << std::endl;
+        return;
+    }
+
+    std::vector<int32_t> imageDimensions;
+    std::string error = readIdxHeader(images_, imageFile, 2051, imageDimensions);
+    if (!error.empty()) {
+        std::cerr << "Invalid IDX3-ubyte file " << imageFile << ": " << error << std::endl;
+        return;
+    }
+
+    std::vector<int32_t> labelDimensions;
+    error = readIdxHeader(labels_, labelFile, 2049, labelDimensions);
+    if (!error.empty()) {
+        std::cerr << "Invalid IDX1-ubyte file " << labelFile << ": " << error << std::endl;
+        return;
+    }
+
+    if (labelDimensions[0] != imageDimensions[0]) {
+        std::cerr << "Label file " << labelFile << " has " << labelDimensions[0] << " labels for " << imageDimensions[0] << " images" << std::endl;
+        return;
+    }
+
+    numSamples_ = imageDimensions[0];
+    sampleSize_ = imageDimensions[1] * imageDimensions[2];
+    chunkSize_ = std::max(1, std::min(chunkSize, numSamples_));
+
+    chunkOrder_.resize((numSamples_ + chunkSize_ - 1) / chunkSize_);
+    std::iota(chunkOrder_.begin(), chunkOrder_.end(), 0);
+    sampleOrder_.resize(chunkSize_);
+    stagingPixels_.resize(static_cast<std::size_t>(sampleSize_) * chunkSize_);
+    stagingLabels_.resize(chunkSize_);
+    for (Chunk& chunk : chunks_) {
+        chunk.pixels.resize(sampleSize_, chunkSize_);
+        chunk.labels.resize(chunkSize_);
+        chunk.indices.resize(chunkSize_);
+    }
+
+    open_ = true;
+    reader_ = std::thread(&IdxStream::readerLoop, this);
+}
+
+/**
+ * @brief Finish the chunk being read, then stop the reader thread.
+ */
+IdxStream::~IdxStream() {
+    if (!reader_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+    reader_.join();
+}
+
+/**
+ * @brief Start a pass over the dataset, and the read of its first chunk.
+ *
+ * Invalidates the current chunk.
+ *
+ * @param shuffle Visit the chunks in a new random order and shuffle the samples within each
+ *                chunk; otherwise the samples come in file order.
+ */
+void IdxStream::startEpoch(bool shuffle) {
+    if (!open_) {
+        return;
+    }
+
+    finishRead();
+    shuffle_ = shuffle;
+    if (shuffle_) {
+        std::shuffle(chunkOrder_.begin(), chunkOrder_.end(), generator_);
+    } else {
+        std::iota(chunkOrder_.begin(), chunkOrder_.end(), 0);
+    }
+
+    loading_ = -1;
+    if (numChunks() > 0) {
+        startRead(0, 1 - current_);
+    }
+}
+
+/**
+ * @brief Advance to the next chunk of the epoch, and start reading the one after it.
+ *
+ * Waits only if the reader has not finished the chunk yet. A read error is reported on
+ * std::cerr and ends the epoch.
+ *
+ * @return True if a chunk is available, false at the end of the epoch.
+ */
+bool IdxStream::next() {
+    if (loading_ < 0) {
+        return false;
+    }
+
+    finishRead();
+    current_ = loading_;
+    loading_ = -1;
+
+    if (!chunks_[current_].ok) {
+        std::cerr << "Failed to read " << imageFile_ << " or its labels" << std::endl;
+        return false;
+    }
+
+    if (position_ < numChunks()) {
+        startRead(position_, 1 - current_);
+    }
+    return true;
+}
+
+/**
+ * @brief Capture the state of the shuffle generator, after any chunk being read.
+ *
+ * Taken between epochs together with chunkOrder(), it lets restore() continue the same
+ * sequence of chunk and sample orders.
+ *
+ * @return The generator state, as returned by saveGeneratorState().
+ */
+std::vector<std::uint32_t> IdxStream::generatorState() {
+    finishRead();
+    return saveGeneratorState(generator_);
+}
+
+/**
+ * @brief Restore the chunk order and shuffle generator of a saved run.
+ *
+ * Call before the next startEpoch(), which then shuffles as the saved run would have.
+ *
+ * @param chunkOrder The saved chunk order; must be a permutation of the chunks of this stream.
+ * @param generatorState The words returned by generatorState().
+ * @return Whether the state was restored; the stream is unchanged otherwise.
+ */
+bool IdxStream::restore(const std::vector<int>& chunkOrder, const std::vector<std::uint32_t>& generatorState) {
+    finishRead();
+    std::mt19937 generator;
+    if (!open_ || !isPermutation(chunkOrder, numChunks()) || !restoreGeneratorState(generator, generatorState)) {
+        return false;
+    }
+    chunkOrder_ = chunkOrder;
+    generator_ = generator;
+    return true;
+}
+
+/**
+ * @brief Hand the reader thread a chunk to fill.
+ *
+ * @param position The position in the chunk order of the chunk to read.
+ * @param buffer The buffer to read it into, which must not be the one in use.
+ */
+void IdxStream::startRead(int position, int buffer) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requestedChunk_ = chunkOrder_[position];
+        loading_ = buffer;
+    }
+    position_ = position + 1;
+    changed_.notify_all();
+}
+
+/**
+ * @brief Block until the reader thread has finished the requested chunk.
+ */
+void IdxStream::finishRead() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return requestedChunk_ < 0 && !reading_; });
+}
+
+/**
+ * @brief Read one chunk of images and labels, shuffling its samples if the epoch is shuffled.
+ *
+ * Without shuffling the images are read straight into the chunk. Otherwise they are read into
+ * the staging buffer in file order and scattered to shuffled columns, so the chunk never needs
+ * a second pass. Nothing is allocated.
+ *
+ * @param chunkIndex The index of the chunk in the files.
+ * @param chunk Receives the samples, their labels, their dataset indices and their count.
+ */
+void IdxStream::readChunk(int chunkIndex, Chunk& chunk) {
+    const int first = chunkIndex * chunkSize_;
+    const int count = std::min(chunkSize_, numSamples_ - first);
+    unsigned char* pixels = shuffle_ ? stagingPixels_.data() : chunk.pixels.data();
+
+    images_.seekg(16 + static_cast<std::streamoff>(first) * sampleSize_);
+    images_.read(reinterpret_cast<char*>(pixels), static_cast<std::streamsize>(count) * sampleSize_);
+    labels_.seekg(8 + static_cast<std::streamoff>(first));
+    labels_.read(reinterpret_cast<char*>(stagingLabels_.data()), count);
+
+    chunk.ok = images_.good() && labels_.good();
+    if (!chunk.ok) {
+        images_.clear();
+        labels_.clear();
+        chunk.count = 0;
+        return;
+    }
+
+    if (shuffle_) {
+        std::iota(sampleOrder_.begin(), sampleOrder_.begin() + count, 0);
+        std::shuffle(sampleOrder_.begin(), sampleOrder_.begin() + count, generator_);
+        for (int i = 0; i < count; ++i) {
+            std::memcpy(chunk.pixels.col(sampleOrder_[i]).data(), pixels + static_cast<std::size_t>(i) * sampleSize_, sampleSize_);
+            chunk.labels(sampleOrder_[i]) = stagingLabels_[i];
+            chunk.indices[sampleOrder_[i]] = first + i;
+        }
+    } else {
+        for (int i = 0; i < count; ++i) {
+            chunk.labels(i) = stagingLabels_[i];
+            chunk.indices[i] = first + i;
+        }
+    }
+    chunk.count = count;
+}
+
+/**
+ * @brief Body of the reader thread: read each requested chunk into the buffer not in use.
+ */
+void IdxStream::readerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        changed_.wait(lock, [this] { return stopping_ || requestedChunk_ >= 0; });
+        if (requestedChunk_ < 0) {
+            return;
+        }
+
+        const int chunkIndex = requestedChunk_;
+        Chunk& chunk = chunks_[loading_];
+        requestedChunk_ = -1;
+        reading_ = true;
+        lock.unlock();
+
+        readChunk(chunkIndex, chunk);
+
+        lock.lock();
+        reading_ = false;
+        changed_.notify_all();
+    }
+}
@@ -0,0 +1,173 @@
+#include "../include/inference_engine.h"
+#include "../include/model_registry.h"
+#include "../include/parameter_handler.h"
+#include "../include/activation_functions.h"
+
+#include <algorithm>
+#include <iostream>
+
+/**
+ * @brief Load a model from disk for inference.
+ *
+ * A version 2 model file is memory-mapped and its weights are used in place, so loading
+ * costs no parsing or copying. Legacy model files are read into memory instead.
+ * isLoaded() reports whether the model could be read.
+ *
+ * @param modelFile The model file written by saveParameters.
+ */
+InferenceModel::InferenceModel(const std::string& modelFile) {
+    auto model = std::make_unique<ModelFile>(modelFile);
+    if (model->isValid() && model->hasNetwork()) {
+        model_ = std::move(model);
+    } else if (!model->hasModelHeader()) {
+        std::tie(params_.W1, params_.b1, params_.W2, params_.b2) = loadParameters(modelFile);
+    } else if (model->isValid()) {
+        std::cerr << "Model file does not contain a two-layer network: " << modelFile << std::endl;
+    }
+    specialise();
+}
+
+/**
+ * @brief Wrap parameters that are already in memory.
+ *
+ * @param params The network parameters, e.g. straight from training.
+ */
+InferenceModel::InferenceModel(NetworkParameters params) : params_(std::move(params)) {
+    specialise();
+}
+
+/**
+ * @brief Locate the weights once, and give models with the default topology a compile-time
+ * specialised copy of them.
+ */
+void InferenceModel::specialise() {
+    network_.emplace(model_ ? model_->network() : NetworkView(params_));
+
+    const NetworkView& weights = *network_;
+    if (MnistNetwork::matches(weights)) {
+        fixedNetwork_ = std::make_unique<MnistNetwork>(weights);
+    }
+}
+
+/**
+ * @brief Compute the output scores of the network for a batch.
+ *
+ * @param batch The images, one normalised image per column.
+ * @param hidden Scratch of hiddenSize() rows and batch.cols() columns.
+ * @param output Receives the numClasses() x batch.cols() pre-softmax scores.
+ */
+void InferenceModel::logits(const Eigen::Ref<const Eigen::MatrixXf>& batch, Eigen::Ref<Eigen::MatrixXf> hidden, Eigen::Ref<Eigen::MatrixXf> output) const {
+    if (fixedNetwork_) {
+        fixedNetwork_->logits(batch, hidden, output);
+        return;
+    }
+
+    NetworkView weights = network();
+    hidden.noalias() = weights.W1 * batch;
+    hidden = (hidden.colwise() + weights.b1).cwiseMax(0.0f);
+
+    output.noalias() = weights.W2 * hidden;
+    output.colwise() += weights.b2;
+}
+
+/**
+ * @brief Load a model from disk for inference.
+ *
+ * The scratch buffers for a batch of up to maxBatchSize images are allocated up front.
+ *
+ * @param modelFile The model file written by saveParameters.
+ * @param maxBatchSize The largest number of images processed in one pass; larger batches are split.
+ */
+InferenceEngine::InferenceEngine(const std::string& modelFile, int maxBatchSize)
+    : model_(std::make_shared<const InferenceModel>(modelFile)), maxBatchSize_(std::max(1, maxBatchSize)) {
+    hidden_.resize(model_->hiddenSize(), maxBatchSize_);
+}
+
+/**
+ * @brief Create an inference engine for parameters that are already in memory.
+ *
+ * @param params The network parameters, e.g. straight from training.
+ * @param maxBatchSize The largest number of images processed in one pass; larger batches are split.
+ */
+InferenceEngine::InferenceEngine(NetworkParameters params, int maxBatchSize)
+    : model_(std::make_shared<const InferenceModel>(std::move(params))), maxBatchSize_(std::max(1, maxBatchSize)) {
+    hidden_.resize(model_->hiddenSize(), maxBatchSize_);
+}
+
+/**
+ * @brief Create an inference engine that always uses the registry's current model.
+ *
+ * Each classify call takes the model published at the time it starts and keeps it for the
+ * whole call, so a model swapped in meanwhile only affects later calls. The registry must
+ * outlive the engine.
+ *
+ * @param registry The registry publishing the model versions.
+ * @param maxBatchSize The largest number of images processed in one pass; larger batches are split.
+ */
+InferenceEngine::InferenceEngine(const ModelRegistry& registry, int maxBatchSize)
+    : registry_(&registry), maxBatchSize_(std::max(1, maxBatchSize)) {
+    hidden_.resize(registry.current()->hiddenSize(), maxBatchSize_);
+}
+
+/**
+ * @brief The model the next classify call will use.
+ *
+ * @return The engine's own model, or the registry's current one.
+ */
+std::shared_ptr<const InferenceModel> InferenceEngine::model() const {
+    return registry_ ? registry_->current() : model_;
+}
+
+/**
+ * @brief Classify a batch of images.
+ *
+ * Runs the forward pass of the network over the batch and writes the predicted digit and
+ * the softmax confidence of every class for each image. Only the hidden layer activations
+ * need scratch space, which was allocated with the engine; the output logits are computed
+ * directly in the probabilities buffer. Nothing is allocated per call, unless a newly
+ * published model has a different hidden layer size. Models with the default topology run
+ * through the fixed-size MnistNetwork kernels.
+ *
+ * @param batch The images to classify, one normalised image per column.
+ * @param labels Output, one predicted digit per image.
+ * @param probabilities Output of shape (numClasses(), batch.cols()), the confidence of each class per image.
+ * @return Whether the batch was classified. False if no model is loaded, the images do not have the
+ *         model's input size or the output buffers do not match; the outputs are then left untouched.
+ */
+bool InferenceEngine::classify(const Eigen::Ref<const Eigen::MatrixXf>& batch, Eigen::Ref<Eigen::VectorXi> labels, Eigen::Ref<Eigen::MatrixXf> probabilities) {
+    std::shared_ptr<const InferenceModel> current = model();
+    if (!current->isLoaded()) {
+        std::cerr << "InferenceEngine::classify: no model is loaded" << std::endl;
+        return false;
+    }
+    if (batch.rows() != current->inputSize()) {
+        std::cerr << "InferenceEngine::classify: images have " << batch.rows() << " values, the model expects " << current->inputSize() << std::endl;
+        return false;
+    }
+    if (labels.size() != batch.cols() || probabilities.rows() != current->numClasses() || probabilities.cols() != batch.cols()) {
+        std::cerr << "InferenceEngine::classify: output buffers do not match the batch" << std::endl;
+        return false;
+    }
+
+    if (hidden_.rows() != current->hiddenSize()) {
+        hidden_.resize(current->hiddenSize(), maxBatchSize_);
+    }
+
+    for (Eigen::Index start = 0; start < batch.cols(); start += maxBatchSize_) {
+        const Eigen::Index count = std::min<Eigen::Index>(maxBatchSize_, batch.cols() - start);
+
+        auto hidden = hidden_.leftCols(count);
+        auto output = probabilities.middleCols(start, count);
+
+        current->logits(batch.middleCols(start, count), hidden, output);
+
+        for (Eigen::Index j = 0; j < count; ++j) {
+            Eigen::Index prediction;
+            output.col(j).maxCoeff(&prediction);
+            labels(start + j) = static_cast<int>(prediction);
+        }
+
+        softmaxInPlace(output);
+    }
+    return true;
+}
@@ -0,0 +1,330 @@
+#include "../include/inference_server.h"
+#include "../include/dataset_utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * @brief Close the client socket.
+ */
+InferenceServer::Connection::~Connection() {
+    ::close(fd);
+}
+
+/**
+ * @brief Read exactly size bytes from a socket.
+ *
+ * @param fd The socket.
+ * @param buffer Receives the bytes.
+ * @param size The number of bytes to read.
+ * @return False if the peer closed the connection or an error occurred first.
+ */
+static bool readFully(int fd, unsigned char* buffer, std::size_t size) {
+    std::size_t received = 0;
+    while (received < size) {
+        ssize_t n = ::recv(fd, buffer + received, size - received, 0);
+        if (n > 0) {
+            received += static_cast<std::size_t>(n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Write exactly size bytes to a socket, without raising SIGPIPE if the peer has gone.
+ *
+ * @param fd The socket.
+ * @param buffer The bytes to send.
+ * @param size The number of bytes.
+ * @return Whether all bytes were sent.
+ */
+static bool writeFully(int fd, const unsigned char* buffer, std::size_t size) {
+    std::size_t sent = 0;
+    while (sent < size) {
+        ssize_t n = ::send(fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += static_cast<std::size_t>(n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Create a server for the registry's current model. Nothing is opened until start().
+ *
+ * @param registry The registry publishing the model; each batch runs on its current version. Must outlive the server.
+ * @param config Socket path, batching policy and queue capacity.
+ */
+InferenceServer::InferenceServer(const ModelRegistry& registry, const ServerConfig& config)
+    : registry_(registry), config_(config), queue_(std::max(1, config.queueCapacity)) {
+    config_.maxBatchSize = std::max(1, config_.maxBatchSize);
+}
+
+/**
+ * @brief Stop the server if it is still running.
+ */
+InferenceServer::~InferenceServer() {
+    stop();
+}
+
+/**
+ * @brief Listen on the socket and start the acceptor and batching threads.
+ *
+ * Any stale socket file at the path is removed first.
+ *
+ * @return Whether the server is listening.
+ */
+bool InferenceServer::start() {
+    std::shared_ptr<const InferenceModel> model = registry_.current();
+    if (!model->isLoaded() || model->network().W1.cols() != SERVER_IMAGE_SIZE) {
+        std::cerr << "InferenceServer: the model does not take " << SERVER_IMAGE_SIZE << " pixel images" << std::endl;
+        return false;
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (config_.socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "InferenceServer: socket path too long: " << config_.socketPath << std::endl;
+        return false;
+    }
+    std::memcpy(address.sun_path, config_.socketPath.c_str(), config_.socketPath.size() + 1);
+
+    listenFd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd_ < 0) {
+        std::cerr << "InferenceServer: cannot create socket: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    ::unlink(config_.socketPath.c_str());
+    if (::bind(listenFd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listenFd_, 64) != 0) {
+        std::cerr << "InferenceServer: cannot listen on " << config_.socketPath << ": " << std::strerror(errno) << std::endl;
+        ::close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+
+    stopping_ = false;
+    batcher_ = std::thread(&InferenceServer::batchLoop, this);
+    acceptor_ = std::thread(&InferenceServer::acceptLoop, this);
+    return true;
+}
+
+/**
+ * @brief Stop accepting connections, drop the pending requests and join every thread.
+ */
+void InferenceServer::stop() {
+    if (listenFd_ < 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        stopping_ = true;
+    }
+    notEmpty_.notify_all();
+    notFull_.notify_all();
+
+    // Shutting the sockets down wakes the threads blocked in accept and recv
+    ::shutdown(listenFd_, SHUT_RDWR);
+    acceptor_.join();
+    ::close(listenFd_);
+    listenFd_ = -1;
+    ::unlink(config_.socketPath.c_str());
+
+    {
+        std::lock_guard<std::mutex> lock(readersMutex_);
+        for (Reader& reader : readers_) {
+            ::shutdown(reader.connection->fd, SHUT_RDWR);
+        }
+    }
+    for (Reader& reader : readers_) {
+        reader.thread.join();
+    }
+    readers_.clear();
+    batcher_.join();
+
+    for (std::size_t i = 0; i < count_; ++i) {
+        queue_[(head_ + i) % queue_.size()].connection.reset();
+    }
+    head_ = 0;
+    count_ = 0;
+}
+
+/**
+ * @brief Accept clients until the server stops, giving each connection a reader thread.
+ */
+void InferenceServer::acceptLoop() {
+    while (!stopping_) {
+        int fd = ::accept(listenFd_, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(readersMutex_);
+
+        // Reap the readers of connections that have closed
+        for (auto it = readers_.begin(); it != readers_.end();) {
+            if (it->finished) {
+                it->thread.join();
+                it = readers_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        Reader& reader = readers_.emplace_back();
+        reader.connection = std::make_shared<Connection>(fd);
+        reader.thread = std::thread(&InferenceServer::readLoop, this, std::ref(reader));
+    }
+}
+
+/**
+ * @brief Read requests from one client and queue them until it disconnects.
+ *
+ * @param reader The connection's reader entry.
+ */
+void InferenceServer::readLoop(Reader& reader) {
+    std::array<unsigned char, SERVER_IMAGE_SIZE> pixels;
+    while (readFully(reader.connection->fd, pixels.data(), pixels.size())) {
+        if (!push(reader.connection, pixels.data())) {
+            break;
+        }
+    }
+    reader.finished = true;
+}
+
+/**
+ * @brief Append a request to the queue, waiting while it is full.
+ *
+ * Blocking here is the server's back-pressure: a client that sends faster than the
+ * model can keep up stops being read until the queue drains.
+ *
+ * @param connection The connection the response goes to.
+ * @param pixels The image.
+ * @return False if the server is stopping.
+ */
+bool InferenceServer::push(const std::shared_ptr<Connection>& connection, const unsigned char* pixels) {
+    std::unique_lock<std::mutex> lock(queueMutex_);
+    notFull_.wait(lock, [this] { return count_ < queue_.size() || stopping_; });
+    if (stopping_) {
+        return false;
+    }
+
+    Request& request = queue_[(head_ + count_) % queue_.size()];
+    request.connection = connection;
+    request.arrived = std::chrono::steady_clock::now();
+    std::memcpy(request.pixels.data(), pixels, SERVER_IMAGE_SIZE);
+    ++count_;
+
+    lock.unlock();
+    notEmpty_.notify_one();
+    return true;
+}
+
+/**
+ * @brief Wait for the next batch of requests.
+ *
+ * Waits for a first request, then for the batch to fill up, but at most until the oldest
+ * request has waited config.maxWait. Under load batches are full and never wait; when it is
+ * quiet a lone request is delayed by at most maxWait.
+ *
+ * @param batch Receives the requests; must hold at least config.maxBatchSize entries.
+ * @return The number of requests taken, 0 when the server is stopping.
+ */
+int InferenceServer::takeBatch(std::vector<Request>& batch) {
+    std::unique_lock<std::mutex> lock(queueMutex_);
+    notEmpty_.wait(lock, [this] { return count_ > 0 || stopping_; });
+    if (stopping_) {
+        return 0;
+    }
+
+    const std::size_t maxBatch = static_cast<std::size_t>(config_.maxBatchSize);
+    const auto deadline = queue_[head_].arrived + config_.maxWait;
+    notEmpty_.wait_until(lock, deadline, [&] { return count_ >= maxBatch || stopping_; });
+
+    const int taken = static_cast<int>(std::min(count_, maxBatch));
+    for (int i = 0; i < taken; ++i) {
+        Request& request = queue_[head_];
+        batch[i].connection = std::move(request.connection);
+        batch[i].pixels = request.pixels;
+        head_ = (head_ + 1) % queue_.size();
+    }
+    count_ -= taken;
+
+    lock.unlock();
+    notFull_.notify_all();
+    return taken;
+}
+
+/**
+ * @brief Run batches through the model and answer each request.
+ *
+ * All buffers are allocated once, for config.maxBatchSize images. Responses are written
+ * from this thread only, in queue order, so replies on one connection keep the order of its requests.
+ */
+void InferenceServer::batchLoop() {
+    const int maxBatch = config_.maxBatchSize;
+    InferenceEngine engine(registry_, maxBatch);
+
+    std::vector<Request> batch(maxBatch);
+    PixelMatrix pixels(SERVER_IMAGE_SIZE, maxBatch);
+    Eigen::MatrixXf images(SERVER_IMAGE_SIZE, maxBatch);
+    Eigen::VectorXi labels(maxBatch);
+    Eigen::MatrixXf probabilities(engine.numClasses(), maxBatch);
+    std::vector<unsigned char> response;
+
+    while (true) {
+        const int count = takeBatch(batch);
+        if (count == 0) {
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            std::memcpy(pixels.col(i).data(), batch[i].pixels.data(), SERVER_IMAGE_SIZE);
+        }
+        images.leftCols(count) = pixels.leftCols(count).cast<float>() / 255.0f;
+
+        const int numClasses = engine.numClasses();
+        if (probabilities.rows() != numClasses) {
+            probabilities.resize(numClasses, maxBatch);
+        }
+        // Fails if a model of another shape was swapped in meanwhile; those clients are disconnected unanswered
+        if (!engine.classify(images.leftCols(count), labels.head(count), probabilities.leftCols(count))) {
+            for (int i = 0; i < count; ++i) {
+                ::shutdown(batch[i].connection->fd, SHUT_RDWR);
+                batch[i].connection.reset();
+            }
+            continue;
+        }
+
+        response.resize(2 * sizeof(std::int32_t) + numClasses * sizeof(float));
+        for (int i = 0; i < count; ++i) {
+            const std::int32_t header[2] = {labels(i), numClasses};
+            std::memcpy(response.data(), header, sizeof(header));
+            std::memcpy(response.data() + sizeof(header), probabilities.col(i).data(), numClasses * sizeof(float));
+            writeFully(batch[i].connection->fd, response.data(), response.size());
+            batch[i].connection.reset();
+        }
+
+        requestsServed_.fetch_add(count, std::memory_order_relaxed);
+        batchesRun_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,558 @@
+#include "../include/layer_stack.h"
+#include "../include/activation_functions.h"
+#include "../include/allocation_counter.h"
+#include "../include/dataset_utils.h"
+#include "../include/helpers.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+/**
+ * @brief Describe a multi-layer perceptron as a list of layers.
+ *
+ * Each hidden width becomes a dense layer followed by ReLU, and the output is a dense
+ * layer followed by softmax. {10} with 10 outputs is the default 784-10-10 network.
+ *
+ * @param hiddenWidths The number of units of each hidden layer, from the input onwards.
+ * @param outputSize The number of classes.
+ * @return The layer list for a LayerStack.
+ */
+std::vector<LayerSpec> multiLayerPerceptron(const std::vector<int>& hiddenWidths, int outputSize) {
+    std::vector<LayerSpec> layers;
+    for (int width : hiddenWidths) {
+        layers.push_back({DENSE, width});
+        layers.push_back({RELU});
+    }
+    layers.push_back({DENSE, outputSize});
+    layers.push_back({SOFTMAX});
+    return layers;
+}
+
+/**
+ * @brief Check that a list of layers describes a network a LayerStack can build.
+ *
+ * The layer list must end with a softmax layer, which may not appear anywhere else, and
+ * every dense layer needs at least one unit. The input size, dense widths and number of
+ * layers are bounded by MAX_LAYER_STACK_WIDTH and MAX_LAYER_STACK_LAYERS, so a description
+ * read from a file can be checked before anything is allocated for it.
+ *
+ * @param inputSize The number of inputs of the first layer.
+ * @param layers The layers from input to output.
+ * @return An empty string if the layers are valid, otherwise a description of the problem.
+ */
+std::string validateLayerStack(int inputSize, const std::vector<LayerSpec>& layers) {
+    if (inputSize <= 0 || inputSize > MAX_LAYER_STACK_WIDTH) {
+        return "input size " + std::to_string(inputSize) + " is out of range";
+    }
+    if (layers.empty() || layers.size() > static_cast<std::size_t>(MAX_LAYER_STACK_LAYERS)) {
+        return "it has " + std::to_string(layers.size()) + " layers";
+    }
+    if (layers.back().type != SOFTMAX) {
+        return "it must end with a softmax layer";
+    }
+
+    for (std::size_t i = 0; i < layers.size(); ++i) {
+        const LayerSpec& layer = layers[i];
+        if (layer.type != DENSE && layer.type != RELU && layer.type != SOFTMAX) {
+            return "layer " + std::to_string(i) + " has an unknown type";
+        }
+        if (layer.type == SOFTMAX && i + 1 != layers.size()) {
+            return "softmax must be the last layer";
+        }
+        if (layer.type == DENSE && (layer.units <= 0 || layer.units > MAX_LAYER_STACK_WIDTH)) {
+            return "dense layer " + std::to_string(i) + " has " + std::to_string(layer.units) + " units";
+        }
+    }
+    return "";
+}
+
+/**
+ * @brief Count the parameters of a layer stack without building it.
+ *
+ * @param inputSize The number of inputs of the first layer.
+ * @param layers Layers accepted by validateLayerStack.
+ * @return The length of the flat parameter vector.
+ */
+long long layerStackParameterCount(int inputSize, const std::vector<LayerSpec>& layers) {
+    long long count = 0;
+    long long units = inputSize;
+    for (const LayerSpec& layer : layers) {
+        if (layer.type == DENSE) {
+            count += static_cast<long long>(layer.units) * units + layer.units;
+            units = layer.units;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Build a network from a list of layers, with freshly initialised parameters.
+ *
+ * The layers must pass validateLayerStack; the process exits otherwise. Dense weights are drawn
+ * uniformly from +-sqrt(6 / inputs) (He initialisation, so deeper ReLU stacks still train) and
+ * biases start at zero.
+ * No activation arena is allocated until reserve() or the first forward pass.
+ *
+ * @param inputSize The number of inputs of the first layer, e.g. 784 pixels.
+ * @param layers The layers from input to output.
+ * @param seed Seed for the weight initialisation; a random seed is used when not given.
+ */
+LayerStack::LayerStack(int inputSize, const std::vector<LayerSpec>& layers, std::optional<unsigned int> seed)
+    : inputSize_(inputSize), layers_(layers) {
+
+    const std::string error = validateLayerStack(inputSize_, layers_);
+    if (!error.empty()) {
+        std::cerr << "Invalid layer stack: " << error << std::endl;
+        exit(1);
+    }
+
+    Eigen::Index numParameters = 0;
+    Eigen::Index outputRows = 0;
+    int units = inputSize_;
+
+    for (std::size_t i = 0; i < layers_.size(); ++i) {
+        const LayerSpec& layer = layers_[i];
+        LayerSlot slot;
+        slot.inputs = units;
+        slot.units = layer.type == DENSE ? layer.units : units;
+        slot.weights = numParameters;
+        slot.bias = numParameters;
+        if (layer.type == DENSE) {
+            slot.bias += static_cast<Eigen::Index>(slot.units) * slot.inputs;
+            numParameters = slot.bias + slot.units;
+        }
+        slot.output = outputRows;
+        outputRows += slot.units;
+
+        slots_.push_back(slot);
+        units = slot.units;
+    }
+
+    // Gradients follow the activations; the softmax output needs none as it is folded into the loss
+    Eigen::Index gradientRows = outputRows;
+    for (std::size_t i = 0; i < slots_.size(); ++i) {
+        slots_[i].gradient = gradientRows;
+        if (layers_[i].type != SOFTMAX) {
+            gradientRows += slots_[i].units;
+        }
+    }
+    arenaRowsPerSample_ = gradientRows;
+
+    parameters_.setZero(numParameters);
+    gradients_.setZero(numParameters);
+
+    std::mt19937 generator(seed ? *seed : std::random_device{}());
+    for (int i = 0; i < numLayers(); ++i) {
+        if (layers_[i].type == DENSE) {
+            std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+            const float bound = std::sqrt(6.0f / static_cast<float>(slots_[i].inputs));
+            weights(i) = Eigen::MatrixXf::NullaryExpr(slots_[i].units, slots_[i].inputs, [&]() { return bound * distribution(generator); });
+        }
+    }
+}
+
+/**
+ * @brief Build the default two-layer network from existing parameters.
+ *
+ * @param params Parameters of a dense-ReLU-dense-softmax network, e.g. loaded from a legacy model file.
+ */
+LayerStack::LayerStack(const NetworkParameters& params)
+    : LayerStack(static_cast<int>(params.W1.cols()), multiLayerPerceptron({static_cast<int>(params.W1.rows())}, static_cast<int>(params.W2.rows())), 0u) {
+    weights(0) = params.W1;
+    bias(0) = params.b1;
+    weights(2) = params.W2;
+    bias(2) = params.b2;
+}
+
+/**
+ * @brief The weight matrix of a dense layer, viewed in place in the parameter vector.
+ *
+ * @param layer Index of a dense layer.
+ * @return A units x inputs map of the weights.
+ */
+Eigen::Map<Eigen::MatrixXf> LayerStack::weights(int layer) {
+    const LayerSlot& slot = slots_[layer];
+    return Eigen::Map<Eigen::MatrixXf>(parameters_.data() + slot.weights, slot.units, slot.inputs);
+}
+
+/**
+ * @brief The weight matrix of a dense layer, read-only.
+ *
+ * @param layer Index of a dense layer.
+ * @return A units x inputs map of the weights.
+ */
+Eigen::Map<const Eigen::MatrixXf> LayerStack::weights(int layer) const {
+    const LayerSlot& slot = slots_[layer];
+    return Eigen::Map<const Eigen::MatrixXf>(parameters_.data() + slot.weights, slot.units, slot.inputs);
+}
+
+/**
+ * @brief The bias vector of a dense layer, viewed in place in the parameter vector.
+ *
+ * @param layer Index of a dense layer.
+ * @return A map of the layer's units biases.
+ */
+Eigen::Map<Eigen::VectorXf> LayerStack::bias(int layer) {
+    const LayerSlot& slot = slots_[layer];
+    return Eigen::Map<Eigen::VectorXf>(parameters_.data() + slot.bias, slot.units);
+}
+
+/**
+ * @brief The bias vector of a dense layer, read-only.
+ *
+ * @param layer Index of a dense layer.
+ * @return A map of the layer's units biases.
+ */
+Eigen::Map<const Eigen::VectorXf> LayerStack::bias(int layer) const {
+    const LayerSlot& slot = slots_[layer];
+    return Eigen::Map<const Eigen::VectorXf>(parameters_.data() + slot.bias, slot.units);
+}
+
+/**
+ * @brief Allocate the activation and gradient arena for batches of up to batchSize samples.
+ *
+ * This is the only allocation made for a batch: every layer's activations and gradients are
+ * carved out of one contiguous buffer. Smaller batches use the leading columns of each block,
+ * and the arena only ever grows.
+ *
+ * @param batchSize The largest number of samples passed through the network at once.
+ */
+void LayerStack::reserve(int batchSize) {
+    if (batchSize <= batchCapacity_) {
+        return;
+    }
+    batchCapacity_ = batchSize;
+    arena_.resize(arenaRowsPerSample_ * batchCapacity_);
+}
+
+/**
+ * @brief A layer's activations for the current batch, viewed in the arena.
+ *
+ * @param layer The layer index.
+ * @param cols The number of samples in the batch.
+ * @return A units x cols map.
+ */
+Eigen::Map<Eigen::MatrixXf> LayerStack::output(int layer, Eigen::Index cols) {
+    const LayerSlot& slot = slots_[layer];
+    return Eigen::Map<Eigen::MatrixXf>(arena_.data() + slot.output * batchCapacity_, slot.units, cols);
+}
+
+/**
+ * @brief The gradient of the loss with respect to a layer's activations, viewed in the arena.
+ *
+ * @param layer The layer index; not the softmax layer.
+ * @param cols The number of samples in the batch.
+ * @return A units x cols map.
+ */
+Eigen::Map<Eigen::MatrixXf> LayerStack::gradient(int layer, Eigen::Index cols) {
+    const LayerSlot& slot = slots_[layer];
+    return Eigen::Map<Eigen::MatrixXf>(arena_.data() + slot.gradient * batchCapacity_, slot.units, cols);
+}
+
+/**
+ * @brief Run a batch through every layer but the final softmax.
+ *
+ * A dense layer followed by ReLU is evaluated in one fused pass (biasReLU). The arena is
+ * grown first if the batch is larger than any seen before.
+ *
+ * @param X The batch, one sample per column.
+ */
+void LayerStack::propagate(const Eigen::Ref<const Eigen::MatrixXf>& X) {
+    reserve(static_cast<int>(X.cols()));
+    const Eigen::Index cols = X.cols();
+    batchCols_ = cols;
+
+    for (int i = 0; i < numLayers() - 1; ++i) {
+        Eigen::Map<Eigen::MatrixXf> out = output(i, cols);
+
+        if (layers_[i].type == DENSE) {
+            if (i == 0) {
+                out.noalias() = weights(i) * X;
+            } else {
+                out.noalias() = weights(i) * output(i - 1, cols);
+            }
+            if (layers_[i + 1].type == RELU) {
+                biasReLU(out, bias(i), output(i + 1, cols));
+                ++i;
+            } else {
+                out.colwise() += bias(i);
+            }
+        } else {
+            out = (i == 0 ? X : output(i - 1, cols)).cwiseMax(0.0f);
+        }
+    }
+}
+
+/**
+ * @brief The scores fed to the final softmax layer for the current batch.
+ *
+ * @param X The batch that was propagated, for stacks with no layer before the softmax.
+ * @return A classes x batch view of the logits.
+ */
+Eigen::Ref<const Eigen::MatrixXf> LayerStack::logits(const Eigen::Ref<const Eigen::MatrixXf>& X) {
+    if (numLayers() == 1) {
+        return X;
+    }
+    return output(numLayers() - 2, X.cols());
+}
+
+/**
+ * @brief Run a batch through every layer.
+ *
+ * @param X The batch, one sample per column.
+ * @return The class probabilities, one column per sample, valid until the next call.
+ */
+Eigen::Map<const Eigen::MatrixXf> LayerStack::forward(const Eigen::Ref<const Eigen::MatrixXf>& X) {
+    propagate(X);
+
+    Eigen::Map<Eigen::MatrixXf> out = output(numLayers() - 1, X.cols());
+    out = logits(X);
+    softmaxInPlace(out);
+    return probabilities();
+}
+
+/**
+ * @brief The class probabilities of the last batch passed forward.
+ *
+ * @return A classes x batch map, valid until the next forward pass.
+ */
+Eigen::Map<const Eigen::MatrixXf> LayerStack::probabilities() const {
+    const LayerSlot& slot = slots_.back();
+    return Eigen::Map<const Eigen::MatrixXf>(arena_.data() + slot.output * batchCapacity_, slot.units, batchCols_);
+}
+
+/**
+ * @brief Run a batch forward for training and compute its loss.
+ *
+ * The softmax and the cross-entropy come out of one pass over the logits.
+ *
+ * @param X The batch, one sample per column.
+ * @param Y The true labels of the batch.
+ * @return The mean loss over the batch.
+ */
+float LayerStack::forwardLoss(const Eigen::Ref<const Eigen::MatrixXf>& X, const Eigen::VectorXi& Y) {
+    propagate(X);
+    Eigen::Map<Eigen::MatrixXf> probabilities = output(numLayers() - 1, X.cols());
+    return softmaxCrossEntropy(logits(X), Y, probabilities);
+}
+
+/**
+ * @brief Compute the gradients of the mean cross-entropy loss from the activations of forwardLoss.
+ *
+ * The gradients are written to the flat gradient vector, laid out like the parameters.
+ * The softmax and cross-entropy are differentiated together, so the gradient of the last
+ * layer's logits is simply (A - one_hot(Y)) / m.
+ *
+ * @param X The batch passed to forwardLoss.
+ * @param Y The true labels of the batch.
+ */
+void LayerStack::backward(const Eigen::Ref<const Eigen::MatrixXf>& X, const Eigen::VectorXi& Y) {
+    const Eigen::Index cols = X.cols();
+    const float invM = 1.0f / static_cast<float>(cols);
+    const int last = numLayers() - 1;
+
+    if (last > 0) {
+        Eigen::Map<Eigen::MatrixXf> dLogits = gradient(last - 1, cols);
+        dLogits = output(last, cols);
+        for (Eigen::Index j = 0; j < cols; ++j) {
+            dLogits(Y(j), j) -= 1.0f;
+        }
+        dLogits *= invM;
+    }
+
+    for (int i = last - 1; i >= 0; --i) {
+        Eigen::Map<Eigen::MatrixXf> dOut = gradient(i, cols);
+
+        if (layers_[i].type == DENSE) {
+            const LayerSlot& slot = slots_[i];
+            Eigen::Map<Eigen::MatrixXf> dW(gradients_.data() + slot.weights, slot.units, slot.inputs);
+            Eigen::Map<Eigen::VectorXf> db(gradients_.data() + slot.bias, slot.units);
+            if (i == 0) {
+                dW.noalias() = dOut * X.transpose();
+            } else {
+                dW.noalias() = dOut * output(i - 1, cols).transpose();
+                gradient(i - 1, cols).noalias() = weights(i).transpose() * dOut;
+            }
+            db = dOut.rowwise().sum();
+        } else if (layers_[i].type == RELU && i > 0) {
+            gradient(i - 1, cols) = (output(i, cols).array() > 0.0f).select(dOut, 0.0f);
+        }
+    }
+}
+
+/**
+ * @brief Compute the gradients of the mean cross-entropy loss for a batch.
+ *
+ * @param X The batch, one sample per column.
+ * @param Y The true labels of the batch.
+ * @return The mean loss over the batch.
+ */
+float LayerStack::computeGradients(const Eigen::Ref<const Eigen::MatrixXf>& X, const Eigen::VectorXi& Y) {
+    float loss = forwardLoss(X, Y);
+    backward(X, Y);
+    return loss;
+}
+
+/**
+ * @brief Take a gradient descent step with the gradients of the last computeGradients call.
+ *
+ * @param alpha The learning rate.
+ */
+void LayerStack::applyGradients(float alpha) {
+    parameters_ -= alpha * gradients_;
+}
+
+/**
+ * @brief Update the parameters from the gradients of the last backward pass with an optimizer.
+ *
+ * The flat parameter vector is the optimizer's only slot.
+ *
+ * @param optimizer An optimizer with one slot of parameters().size() elements.
+ * @param alpha The learning rate.
+ */
+void LayerStack::applyGradients(Optimizer& optimizer, float alpha) {
+    optimizer.beginStep();
+    optimizer.update(0, parameters_.data(), gradients_.data(), alpha);
+}
+
+/**
+ * @brief Compute the gradients for a batch and apply them.
+ *
+ * @param X The batch, one sample per column.
+ * @param Y The true labels of the batch.
+ * @param alpha The learning rate.
+ * @return The mean loss over the batch.
+ */
+float LayerStack::trainingStep(const Eigen::Ref<const Eigen::MatrixXf>& X, const Eigen::VectorXi& Y, float alpha) {
+    float loss = computeGradients(X, Y);
+    applyGradients(alpha);
+    return loss;
+}
+
+/**
+ * @brief Compute the accuracy of the network on a dataset.
+ *
+ * The dataset is run through the network in chunks of the arena's batch capacity, so
+ * no further memory is allocated once the arena exists.
+ *
+ * @param X The dataset, one sample per column.
+ * @param Y The true class labels.
+ * @return The proportion of correctly classified samples.
+ */
+double LayerStack::accuracy(const Eigen::MatrixXf& X, const Eigen::VectorXi& Y) {
+    if (batchCapacity_ == 0) {
+        reserve(std::min<int>(1000, std::max<int>(1, X.cols())));
+    }
+
+    int numCorrect = 0;
+    for (int start = 0; start < X.cols(); start += batchCapacity_) {
+        const int count = std::min<int>(batchCapacity_, X.cols() - start);
+        numCorrect += countCorrectPredictions(forward(X.middleCols(start, count)), Y.segment(start, count));
+    }
+    return static_cast<double>(numCorrect) / Y.size();
+}
+
+/**
+ * @brief Train a layer stack with mini-batch stochastic gradient descent.
+ *
+ * Follows the same schedule as miniBatchGradientDescent: each epoch shuffles a permutation
+ * of the samples and walks through it in batches gathered into buffers allocated once, and
+ * the trailing partial batch is skipped. The arena is sized for the batch up front, so the
+ * steps do not allocate whatever the depth of the network; only layers wide enough for Eigen to
+ * take the packing buffers of their products from the heap (beyond EIGEN_STACK_ALLOCATION_LIMIT)
+ * allocate per step. Training runs on one thread; config.augment, if set, is applied to each
+ * batch as it is gathered. Layer stacks cannot be checkpointed yet, so a config.checkpoint
+ * with a file is rejected rather than silently ignored.
+ *
+ * @param stack The network to train, updated in place.
+ * @param X The input data matrix.
+ * @param Y The vector of true class labels.
+ * @param valX The validation data matrix.
+ * @param valY The vector of validation class labels.
+ * @param config The learning rate, optimizer, number of epochs, batch size, optional shuffle seed, augmentation and telemetry.
+ * @return Whether the network was trained; false, with the network untouched, if config asks for checkpoints.
+ */
+bool trainLayerStack(LayerStack& stack, const Eigen::MatrixXf& X,const Eigen::VectorXi& Y,const Eigen::MatrixXf& valX,const Eigen::VectorXi& valY, const TrainingConfig& config){
+    if (!config.checkpoint.file.empty()) {
+        std::cerr << "Layer stack training does not support checkpoints; clear the checkpoint file to train without them" << std::endl;
+        return false;
+    }
+
+    const int numSamples = static_cast<int>(X.cols());
+    const int batchSize = std::max(1, std::min(config.batchSize, numSamples));
+    const int batchesPerEpoch = numSamples / batchSize;
+
+    Eigen::MatrixXf batchX(X.rows(), batchSize);
+    Eigen::VectorXi batchY(batchSize);
+    stack.reserve(batchSize);
+
+    DatasetPermutation permutation(numSamples, config.seed);
+    TrainingTelemetry* telemetry = config.telemetry;
+    std::unique_ptr<Optimizer> optimizer = makeOptimizer(config.optimizer, {stack.parameters().size()});
+
+    for(int epoch = 0; epoch < config.epochs; epoch++){
+
+        if (telemetry) {
+            telemetry->startEpoch();
+        }
+        {
+            TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_SHUFFLE);
+            permutation.shuffle();
+        }
+
+        int numCorrect = 0;
+        double totalLoss = 0.0;
+        std::size_t stepAllocations = 0;
+
+        for(int batch = 0; batch < batchesPerEpoch; batch++){
+            const bool warmUp = epoch == 0 && batch == 0;
+            const std::size_t allocationsBefore = heapAllocationCount();
+
+            {
+                TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_DATA);
+                gatherBatch(X, Y, permutation, batch * batchSize, batchX, batchY);
+                if (config.augment) {
+                    config.augment(batchX, permutation.indices().data() + batch * batchSize, epoch);
+                }
+            }
+            {
+                TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_FORWARD);
+                totalLoss += stack.forwardLoss(batchX, batchY);
+            }
+            {
+                TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_BACKWARD);
+                stack.backward(batchX, batchY);
+            }
+            numCorrect += countCorrectPredictions(stack.probabilities(), batchY);
+            {
+                TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_UPDATE);
+                stack.applyGradients(*optimizer, config.alpha);
+            }
+
+            if (!warmUp) {
+                stepAllocations += heapAllocationCount() - allocationsBefore;
+            }
+        }
+
+        double valAccuracy;
+        {
+            TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_VALIDATION);
+            valAccuracy = stack.accuracy(valX, valY);
+        }
+        double accuracy = static_cast<double>(numCorrect) / (static_cast<double>(batchesPerEpoch) * batchSize);
+        double loss = totalLoss / batchesPerEpoch;
+        std::cout << "Epoch: " << epoch+1 << ", Loss: " << loss << ", Accuracy: " << accuracy << ", Validation Accuracy: " << valAccuracy;
+        if (heapAllocationCountingSupported()) {
+            std::cout << ", Step Allocations: " << stepAllocations;
+        }
+        std::cout << std::endl;
+
+        if (telemetry) {
+            telemetry->endEpoch({epoch + 1, static_cast<long long>(batchesPerEpoch) * batchSize, loss, accuracy, valAccuracy});
+        }
+    }
+    return true;
+}
@@ -1,14 +1,31 @@
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
 
+#include "../include/augmentation.h"
 #include "../include/dataset_utils.h"
+#include "../include/evaluation.h"
 #include "../include/helpers.h"
+#include "../include/idx_stream.h"
+#include "../include/hogwild.h"
+#include "../include/inference_engine.h"
+#include "../include/inference_server.h"
+#include "../include/layer_stack.h"
+#include "../include/model_registry.h"
 #include "../include/neural_network.h"
 #include "../include/parameter_handler.h"
+#include "../include/quantization.h"
 
 enum Mode {
     TRAIN,
-    TEST
+    TEST,
+    QUANTIZE,
+    COMPARE_HOGWILD,
+    WATCH,
+    SERVE
 };
 
 int main() {
@@ -20,6 +37,61 @@ int main() {
     const int EPOCHS = 600;
     const float LEARN_RATE = 0.15;
 
+    // Optimizer applying the gradients: OPTIMIZER_SGD, OPTIMIZER_MOMENTUM, OPTIMIZER_NESTEROV or OPTIMIZER_ADAM.
+    // Adam usually needs a much smaller LEARN_RATE, around 0.001
+    const OptimizerType OPTIMIZER_TYPE = OPTIMIZER_SGD;
+
+    // Run the first layer on a sparse copy of the training images when they are mostly zero (MNIST is about 20% non-zero).
+    // Applies to full-batch training and to single-threaded mini-batch training without augmentation, where it
+    // takes precedence over PREFETCH_BATCHES
+    const bool USE_SPARSE_INPUT = true;
+
+    // Mini-batch training (set BATCH_SIZE to 0 for full-batch gradient descent over EPOCHS iterations)
+    const int BATCH_SIZE = 64;
+    const int MINI_BATCH_EPOCHS = 10;
+
+    // Widths of the hidden layers; anything other than {10} trains a deeper/wider layer stack
+    const std::vector<int> HIDDEN_LAYER_WIDTHS = {10};
+
+    // Threads each mini-batch is split across (data-parallel); larger batches scale better
+    const int TRAINING_THREADS = 1;
+
+    // Gather the next mini-batch on a background thread while the current one trains (single-threaded training,
+    // when the sparse input path is not in use)
+    const bool PREFETCH_BATCHES = true;
+
+    // Train on random shifts, rotations and elastic distortions of the images, generated per mini-batch (on the loader
+    // thread when prefetching). The same seed reproduces the same variants
+    const bool AUGMENT_TRAINING_DATA = false;
+    const unsigned int AUGMENTATION_SEED = 1;
+    const int AUGMENTATION_THREADS = 2;
+
+    // Validate each mini-batch epoch on a copy of the parameters in the background while the next epoch trains
+    const bool ASYNC_VALIDATION = true;
+
+    // Keep mini-batch training images resident as raw bytes (4x less memory), normalised per batch
+    const bool PIXELS_AS_BYTES = false;
+
+    // Stream mini-batch training and validation images from disk in chunks instead of loading them, for datasets larger than memory.
+    // Each chunk is shuffled as it is read; a multiple of BATCH_SIZE avoids skipping a partial batch per chunk
+    const bool STREAM_TRAINING_DATA = false;
+    const int STREAM_CHUNK_SIZE = 157 * 64;
+
+    // Per-epoch phase timings, throughput, loss and peak memory: TELEMETRY_OFF, TELEMETRY_CSV or TELEMETRY_JSON.
+    // The NUMBER_CLASSIFIER_TELEMETRY environment variable (off, csv or json) overrides it without rebuilding
+    const TelemetryFormat TELEMETRY_FORMAT = TELEMETRY_OFF;
+
+    // File for the telemetry records; empty writes them to standard output
+    const std::string TELEMETRY_FILE = "";
+
+    // Checkpoint file written in the background during training (empty to disable), every so many
+    // full-batch iterations or mini-batch epochs; with RESUME_TRAINING a run continues from it.
+    // Layer stacks (HIDDEN_LAYER_WIDTHS other than {10}) train without checkpoints
+    const std::string CHECKPOINT_FILE = "../models/checkpoint.bin";
+    const int CHECKPOINT_EVERY_ITERATIONS = 50;
+    const int CHECKPOINT_EVERY_EPOCHS = 1;
+    const bool RESUME_TRAINING = false;
+
     // Choose the model to load
     const std::string SAVED_MODEL = "../models/model.bin";
 
@@ -34,15 +106,11 @@ int main() {
     std::string testImageDataFile = "../data/t10k-images-idx3-ubyte";
     std::string testLabelDataFile = "../data/t10k-labels.idx1-ubyte";
 
-    // Load training images & labels
-    Eigen::MatrixXf trainingData = readData(imageDataFile);
+    // Load training & test labels (images are loaded by each mode in the format it needs)
     Eigen::VectorXi labels = readLabels(labelDataFile);
-
-    // Load test images & labels
-    Eigen::MatrixXf testingData = readData(testImageDataFile);
     Eigen::VectorXi testingLabels = readLabels(testLabelDataFile);
 
-    // Set the mode (TRAIN or TEST)
+    // Set the mode (TRAIN, TEST, QUANTIZE, COMPARE_HOGWILD, WATCH or SERVE)
     Mode mode = Mode::TEST;
     /**
      * Training Model
@@ -50,10 +118,75 @@ int main() {
      * -train the neural network and save parameters in the 'models' folder
      */
 
-    if (mode == Mode::TRAIN) {
+    TelemetryFormat telemetryFormat = TELEMETRY_FORMAT;
+    if (const char* format = std::getenv("NUMBER_CLASSIFIER_TELEMETRY")) {
+        telemetryFormat = parseTelemetryFormat(format, TELEMETRY_FORMAT);
+    }
+    std::unique_ptr<TrainingTelemetry> telemetry = TELEMETRY_FILE.empty() ? std::make_unique<TrainingTelemetry>(std::cout, telemetryFormat)
+                                                                           : std::make_unique<TrainingTelemetry>(TELEMETRY_FILE, telemetryFormat);
+
+    if (mode == Mode::TRAIN && BATCH_SIZE > 0 && HIDDEN_LAYER_WIDTHS != std::vector<int>{10}) {
+        TrainingConfig config;
+        config.alpha = LEARN_RATE;
+        config.optimizer.type = OPTIMIZER_TYPE;
+        config.epochs = MINI_BATCH_EPOCHS;
+        config.batchSize = BATCH_SIZE;
+        config.telemetry = telemetry.get();
+        if (AUGMENT_TRAINING_DATA) {
+            config.augment = makeImageAugmentation(28, 28, AugmentationConfig(), AUGMENTATION_SEED, AUGMENTATION_THREADS);
+        }
+
+        Eigen::MatrixXf trainingData = readData(imageDataFile);
+        Eigen::MatrixXf testingData = readData(testImageDataFile);
+        LayerStack stack(trainingData.rows(), multiLayerPerceptron(HIDDEN_LAYER_WIDTHS, 10));
+        if (!trainLayerStack(stack, trainingData, labels, testingData, testingLabels, config)) {
+            return 1;
+        }
+        if (!saveLayerStack(stack, "../models/"+NEW_MODEL_NAME)) {
+            return 1;
+        }
+    } else if (mode == Mode::TRAIN) {
         Eigen::MatrixXf W1, b1, W2, b2;
-        std::tie(W1, b1, W2, b2) = gradientDescent(trainingData, labels, testingData, testingLabels, LEARN_RATE, EPOCHS);
-        saveParameters(W1, b1, W2, b2, "../models/"+NEW_MODEL_NAME);
+        if (BATCH_SIZE > 0) {
+            TrainingConfig config;
+            config.alpha = LEARN_RATE;
+            config.optimizer.type = OPTIMIZER_TYPE;
+            config.epochs = MINI_BATCH_EPOCHS;
+            config.batchSize = BATCH_SIZE;
+            config.numThreads = TRAINING_THREADS;
+            config.prefetch = PREFETCH_BATCHES;
+            config.asyncValidation = ASYNC_VALIDATION;
+            config.telemetry = telemetry.get();
+            config.checkpoint = {CHECKPOINT_FILE, CHECKPOINT_EVERY_EPOCHS, RESUME_TRAINING};
+            config.sparseInput = USE_SPARSE_INPUT;
+            if (AUGMENT_TRAINING_DATA) {
+                config.augment = makeImageAugmentation(28, 28, AugmentationConfig(), AUGMENTATION_SEED, AUGMENTATION_THREADS);
+            }
+            if (STREAM_TRAINING_DATA) {
+                IdxStream trainingStream(imageDataFile, labelDataFile, STREAM_CHUNK_SIZE, config.seed);
+                IdxStream testingStream(testImageDataFile, testLabelDataFile, STREAM_CHUNK_SIZE);
+                if (!trainingStream.isOpen() || !testingStream.isOpen()) {
+                    return 1;
+                }
+                std::tie(W1, b1, W2, b2) = miniBatchGradientDescent(trainingStream, testingStream, config);
+            } else if (PIXELS_AS_BYTES) {
+                PixelMatrix trainingPixels = readRawData(imageDataFile);
+                PixelMatrix testingPixels = readRawData(testImageDataFile);
+                std::tie(W1, b1, W2, b2) = miniBatchGradientDescent(trainingPixels, labels, testingPixels, testingLabels, config);
+            } else {
+                Eigen::MatrixXf trainingData = readData(imageDataFile);
+                Eigen::MatrixXf testingData = readData(testImageDataFile);
+                std::tie(W1, b1, W2, b2) = miniBatchGradientDescent(trainingData, labels, testingData, testingLabels, config);
+            }
+        } else {
+            Eigen::MatrixXf trainingData = readData(imageDataFile);
+            Eigen::MatrixXf testingData = readData(testImageDataFile);
+            std::tie(W1, b1, W2, b2) = gradientDescent(trainingData, labels, testingData, testingLabels, LEARN_RATE, EPOCHS, telemetry.get(),
+                                                        {CHECKPOINT_FILE, CHECKPOINT_EVERY_ITERATIONS, RESUME_TRAINING}, OptimizerConfig{OPTIMIZER_TYPE}, USE_SPARSE_INPUT);
+        }
+        if (!saveParameters(W1, b1, W2, b2, "../models/"+NEW_MODEL_NAME)) {
+            return 1;
+        }
     }
 
     /**
@@ -63,6 +196,7 @@ int main() {
      */
     if (mode == Mode::TEST) {
         const int TEST_DATA_INDEX = 113;
+        Eigen::MatrixXf testingData = readData(testImageDataFile);
         Eigen::VectorXf testImage = testingData.col(TEST_DATA_INDEX);
 
         int testLabel = testingLabels(TEST_DATA_INDEX, 0);
@@ -72,10 +206,17 @@ int main() {
         // Save the item as a PGM image (to provide visual of data item)
         savePGM("image.pgm", testImage);
 
-        Eigen::MatrixXf W1, b1, W2, b2;
-        std::tie(W1, b1, W2, b2) = loadParameters(SAVED_MODEL);
+        const int TEST_BATCH_SIZE = 1000;
+        InferenceEngine engine(SAVED_MODEL, TEST_BATCH_SIZE);
+        if (!engine.isLoaded()) {
+            return 1;
+        }
 
-        Eigen::VectorXf result = runImageThroughNetwork(testImage, W1, b1, W2, b2);
+        Eigen::VectorXi predicted(1);
+        Eigen::VectorXf result(engine.numClasses());
+        if (!engine.classify(testImage, predicted, result)) {
+            return 1;
+        }
 
         // Print the confidence scores for each digit
         std::cout << "Result:" << std::endl;
@@ -85,8 +226,103 @@ int main() {
             }
         }
 
-        int maxIndex = findMaxIndex(result);
-        std::cout << "\nPredicted Number: " << maxIndex << std::endl;
+        std::cout << "\nPredicted Number: " << predicted(0) << std::endl;
+
+        // Evaluate the whole testing set: accuracy, loss, confusion matrix, precision and recall in one pass
+        std::shared_ptr<const InferenceModel> model = engine.model();
+        Evaluator evaluator(model->hiddenSize(), model->numClasses());
+        printEvaluationReport(std::cout, evaluator.evaluate(model->network(), testingData, testingLabels));
+    }
+
+    /**
+     * Quantizing Model
+     *
+     * -convert the saved model to int8 weights, save it alongside and compare it to the float model
+     */
+    if (mode == Mode::QUANTIZE) {
+        NetworkParameters params;
+        std::tie(params.W1, params.b1, params.W2, params.b2) = loadParameters(SAVED_MODEL);
+        if (params.W1.size() == 0) {
+            return 1;
+        }
+
+        QuantizedModel quantized = quantizeParameters(params);
+        saveQuantizedParameters(quantized, SAVED_MODEL + ".q8");
+
+        PixelMatrix testingPixels = readRawData(testImageDataFile);
+        printQuantizationReport(params, quantized, testingPixels, testingLabels);
+    }
+
+    /**
+     * Comparing Hogwild
+     *
+     * -train with synchronous mini-batches and with lock-free asynchronous SGD and compare them
+     */
+    if (mode == Mode::COMPARE_HOGWILD) {
+        TrainingConfig config;
+        config.alpha = LEARN_RATE;
+        config.optimizer.type = OPTIMIZER_TYPE;
+        config.epochs = MINI_BATCH_EPOCHS;
+        config.batchSize = BATCH_SIZE > 0 ? BATCH_SIZE : config.batchSize;
+        config.numThreads = TRAINING_THREADS;
+
+        Eigen::MatrixXf trainingData = readData(imageDataFile);
+        Eigen::MatrixXf testingData = readData(testImageDataFile);
+        compareHogwildWithSynchronous(trainingData, labels, testingData, testingLabels, config);
+    }
+
+    /**
+     * Watching Model
+     *
+     * -keep the saved model loaded and re-test it whenever a new version of the file is deployed
+     */
+    if (mode == Mode::WATCH) {
+        Eigen::MatrixXf testingData = readData(testImageDataFile);
+        ModelRegistry registry(SAVED_MODEL);
+        InferenceEngine engine(registry, 1000);
+
+        Eigen::VectorXi testPredictions(testingData.cols());
+        Eigen::MatrixXf testProbabilities(engine.numClasses(), testingData.cols());
+        unsigned long testedVersion = 0;
+        while (true) {
+            if (registry.version() != testedVersion) {
+                testedVersion = registry.version();
+                if (!engine.classify(testingData, testPredictions, testProbabilities)) {
+                    continue;
+                }
+                std::cout << "Model version " << testedVersion << ", Test Accuracy: " << getAccuracy(testPredictions, testingLabels) << std::endl;
+            }
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
+
+    /**
+     * Serving Model
+     *
+     * -answer classification requests on a local socket, batching concurrent requests together
+     */
+    if (mode == Mode::SERVE) {
+        ServerConfig serverConfig;
+        serverConfig.socketPath = "/tmp/number_classifier.sock";
+        serverConfig.maxBatchSize = 64;
+        serverConfig.maxWait = std::chrono::microseconds(2000);
+
+        ModelRegistry registry(SAVED_MODEL);
+        InferenceServer server(registry, serverConfig);
+        if (!server.start()) {
+            return 1;
+        }
+        std::cout << "Serving " << SAVED_MODEL << " on " << serverConfig.socketPath << std::endl;
+
+        std::size_t reportedRequests = 0;
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::seconds(10));
+            if (server.requestsServed() != reportedRequests) {
+                reportedRequests = server.requestsServed();
+                std::cout << "Requests: " << reportedRequests << ", Mean Batch Size: "
+                          << static_cast<double>(reportedRequests) / server.batchesRun() << std::endl;
+            }
+        }
     }
 
     return 0;
@@ -0,0 +1,77 @@
+#include "../include/mapped_file.h"
+
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_USE_MMAP
+#endif
+
+/**
+ * @brief Open a file for read-only access to its whole contents.
+ *
+ * On POSIX systems the file is memory-mapped, so pages are only read from disk when they
+ * are touched and no copy is made. Elsewhere, or if mapping fails, the file is read into
+ * an internal buffer with a single read call. isOpen() reports whether either succeeded.
+ *
+ * @param filename The path of the file to open.
+ */
+MappedFile::MappedFile(const std::string& filename) {
+#ifdef MAPPED_FILE_USE_MMAP
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat info{};
+    if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* address = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED) {
+            // Files are consumed front to back, let the kernel read ahead aggressively
+            ::madvise(address, static_cast<std::size_t>(info.st_size), MADV_SEQUENTIAL);
+            data_ = static_cast<const unsigned char*>(address);
+            size_ = static_cast<std::size_t>(info.st_size);
+            mapped_ = true;
+        }
+    }
+    ::close(fd);
+
+    if (mapped_) {
+        return;
+    }
+#endif
+
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return;
+    }
+
+    std::streamsize length = file.tellg();
+    if (length <= 0) {
+        return;
+    }
+    file.seekg(0);
+
+    buffer_.resize(static_cast<std::size_t>(length));
+    if (!file.read(reinterpret_cast<char*>(buffer_.data()), length)) {
+        buffer_.clear();
+        return;
+    }
+
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+}
+
+/**
+ * @brief Unmap the file, if it was mapped.
+ */
+MappedFile::~MappedFile() {
+#ifdef MAPPED_FILE_USE_MMAP
+    if (mapped_) {
+        ::munmap(const_cast<unsigned char*>(data_), size_);
+    }
+#endif
+}
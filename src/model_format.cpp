@@ -0,0 +1,332 @@
+#include "../include/model_format.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#define MODEL_FORMAT_USE_POSIX
+#endif
+
+/**
+ * @brief Compute the CRC-32 (IEEE 802.3 polynomial) of a block of memory.
+ *
+ * @param data The bytes to checksum.
+ * @param size The number of bytes.
+ * @return The checksum.
+ */
+std::uint32_t crc32(const unsigned char* data, std::size_t size) {
+    static const std::array<std::uint32_t, 256> table = [] {
+        std::array<std::uint32_t, 256> entries{};
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                value = (value & 1u) ? 0xedb88320u ^ (value >> 1) : value >> 1;
+            }
+            entries[i] = value;
+        }
+        return entries;
+    }();
+
+    std::uint32_t crc = 0xffffffffu;
+    for (std::size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xffu] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffu;
+}
+
+/**
+ * @brief Round an offset up to the tensor alignment.
+ *
+ * @param offset A byte offset.
+ * @return The smallest multiple of MODEL_FILE_ALIGNMENT not below offset.
+ */
+static std::uint64_t alignOffset(std::uint64_t offset) {
+    return (offset + MODEL_FILE_ALIGNMENT - 1) / MODEL_FILE_ALIGNMENT * MODEL_FILE_ALIGNMENT;
+}
+
+/**
+ * @brief Write named matrices to a version 2 model file.
+ *
+ * The whole file is assembled in memory, checksummed, and written to a temporary file
+ * next to the destination which is then renamed over it. Readers therefore see either
+ * the old file or the complete new one, never a partial write.
+ *
+ * @param tensors The matrices to store; names must be shorter than 32 characters.
+ * @param filename Name of the file to write.
+ * @return Whether the file was written.
+ */
+bool saveModelFile(const std::vector<ModelTensor>& tensors, const std::string& filename) {
+    std::vector<unsigned char> contents;
+    return assembleModelFile(tensors, contents) && writeFileAtomically(contents, filename, filename + ".tmp");
+}
+
+/**
+ * @brief Lay out a version 2 model file in memory: header, descriptors and aligned tensor data.
+ *
+ * The descriptors are written straight into the buffer, and the buffer is only resized if the
+ * file size changes, so assembling the same shapes again into the same buffer does not allocate.
+ *
+ * @param tensors The matrices to store; names must be shorter than 32 characters.
+ * @param contents Receives the complete file, checksum included.
+ * @return Whether the tensors could be stored.
+ */
+bool assembleModelFile(const std::vector<ModelTensor>& tensors, std::vector<unsigned char>& contents) {
+    std::uint64_t offset = sizeof(ModelFileHeader) + tensors.size() * sizeof(TensorDescriptor);
+    for (const ModelTensor& tensor : tensors) {
+        if (tensor.name.size() >= sizeof(TensorDescriptor::name)) {
+            std::cerr << "Tensor name too long: " << tensor.name << std::endl;
+            return false;
+        }
+        offset = alignOffset(offset) + static_cast<std::uint64_t>(tensor.rows) * tensor.cols * sizeof(float);
+    }
+
+    contents.resize(offset);
+    std::fill(contents.begin(), contents.end(), 0);
+
+    offset = sizeof(ModelFileHeader) + tensors.size() * sizeof(TensorDescriptor);
+    for (std::size_t i = 0; i < tensors.size(); ++i) {
+        const ModelTensor& tensor = tensors[i];
+
+        TensorDescriptor descriptor;
+        std::memset(&descriptor, 0, sizeof(descriptor));
+        std::memcpy(descriptor.name, tensor.name.data(), tensor.name.size());
+        descriptor.type = tensor.type;
+        descriptor.rows = static_cast<std::uint32_t>(tensor.rows);
+        descriptor.cols = static_cast<std::uint32_t>(tensor.cols);
+        descriptor.offset = alignOffset(offset);
+        descriptor.size = static_cast<std::uint64_t>(tensor.rows) * tensor.cols * sizeof(float);
+        offset = descriptor.offset + descriptor.size;
+
+        std::memcpy(contents.data() + sizeof(ModelFileHeader) + i * sizeof(TensorDescriptor), &descriptor, sizeof(descriptor));
+        if (descriptor.size > 0) {
+            std::memcpy(contents.data() + descriptor.offset, tensor.data, descriptor.size);
+        }
+    }
+
+    ModelFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = MODEL_FILE_MAGIC;
+    header.version = MODEL_FILE_VERSION;
+    header.endianMarker = MODEL_FILE_ENDIAN_MARKER;
+    header.numTensors = static_cast<std::uint32_t>(tensors.size());
+    header.fileSize = contents.size();
+    header.checksum = crc32(contents.data() + sizeof(ModelFileHeader), contents.size() - sizeof(ModelFileHeader));
+    std::memcpy(contents.data(), &header, sizeof(header));
+    return true;
+}
+
+/**
+ * @brief Replace a file with new contents so that readers never see a partial write.
+ *
+ * The contents go to a temporary file next to the destination, which is renamed over it once
+ * complete. On POSIX systems the data is flushed to disk before the rename, so a crash leaves
+ * either the old file or the new one; the write uses plain system calls and does not allocate.
+ *
+ * @param contents The bytes to write.
+ * @param filename The file to replace.
+ * @param temporaryName The temporary file, in the same directory as filename.
+ * @return Whether the file was replaced.
+ */
+bool writeFileAtomically(const std::vector<unsigned char>& contents, const std::string& filename, const std::string& temporaryName) {
+#ifdef MODEL_FORMAT_USE_POSIX
+    int fd = ::open(temporaryName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error opening file: " << temporaryName << std::endl;
+        return false;
+    }
+    std::size_t written = 0;
+    while (written < contents.size()) {
+        const ssize_t result = ::write(fd, contents.data() + written, contents.size() - written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        written += static_cast<std::size_t>(result);
+    }
+    const bool synced = written == contents.size() && ::fsync(fd) == 0;
+    if (::close(fd) != 0 || !synced) {
+        std::cerr << "Error writing file: " << temporaryName << std::endl;
+        std::remove(temporaryName.c_str());
+        return false;
+    }
+#else
+    std::ofstream file(temporaryName, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file: " << temporaryName << std::endl;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(contents.data()), static_cast<std::streamsize>(contents.size()));
+    file.close();
+    if (!file) {
+        std::cerr << "Error writing file: " << temporaryName << std::endl;
+        std::remove(temporaryName.c_str());
+        return false;
+    }
+#endif
+
+    if (std::rename(temporaryName.c_str(), filename.c_str()) != 0) {
+        std::cerr << "Error replacing file: " << filename << std::endl;
+        std::remove(temporaryName.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Map a version 2 model file and check its structure.
+ *
+ * Opening costs one mmap call and a walk over the tensor descriptors; tensor data is only
+ * paged in when it is used. With verifyChecksum the whole file is read once to check its
+ * CRC-32. hasModelHeader() reports whether the file starts with the v2 magic number, so
+ * callers can fall back to the legacy format; isValid() whether it passed every check.
+ * A file written on a machine of the other byte order has a model header but is invalid.
+ *
+ * @param filename The model file to open.
+ * @param verifyChecksum Whether to verify the checksum of the descriptors and tensor data.
+ */
+ModelFile::ModelFile(const std::string& filename, bool verifyChecksum) : file_(filename) {
+    if (!file_.isOpen() || file_.size() < sizeof(std::uint32_t)) {
+        return;
+    }
+
+    std::uint32_t magic;
+    std::memcpy(&magic, file_.data(), sizeof(magic));
+    if (magic == MODEL_FILE_MAGIC_SWAPPED) {
+        std::cerr << "Model file was written with a different byte order: " << filename << std::endl;
+        hasModelHeader_ = true;
+        return;
+    }
+    hasModelHeader_ = magic == MODEL_FILE_MAGIC;
+    if (hasModelHeader_) {
+        valid_ = validate(filename, verifyChecksum);
+    }
+}
+
+/**
+ * @brief Check the header, descriptors and optionally the checksum of the mapped file.
+ *
+ * @param filename The file name, for error messages.
+ * @param verifyChecksum Whether to verify the checksum.
+ * @return Whether the file can be used.
+ */
+bool ModelFile::validate(const std::string& filename, bool verifyChecksum) const {
+    if (file_.size() < sizeof(ModelFileHeader)) {
+        std::cerr << "Model file is too short: " << filename << std::endl;
+        return false;
+    }
+
+    const ModelFileHeader* fileHeader = header();
+    if (fileHeader->endianMarker != MODEL_FILE_ENDIAN_MARKER) {
+        std::cerr << "Invalid model file header: " << filename << std::endl;
+        return false;
+    }
+    if (fileHeader->version != MODEL_FILE_VERSION) {
+        std::cerr << "Unsupported model file version " << fileHeader->version << ": " << filename << std::endl;
+        return false;
+    }
+    if (fileHeader->fileSize != file_.size() ||
+        fileHeader->numTensors > (file_.size() - sizeof(ModelFileHeader)) / sizeof(TensorDescriptor)) {
+        std::cerr << "Model file is truncated: " << filename << std::endl;
+        return false;
+    }
+
+    for (std::uint32_t i = 0; i < fileHeader->numTensors; ++i) {
+        const TensorDescriptor& tensor = descriptors()[i];
+        const bool terminated = std::memchr(tensor.name, '\0', sizeof(tensor.name)) != nullptr;
+        const bool fits = tensor.offset <= file_.size() && tensor.size <= file_.size() - tensor.offset;
+        // The product of two uint32 cannot wrap in 64 bits, but scaling it to bytes can, so the
+        // element count is bounded by the file before it is compared with the tensor size
+        const std::uint64_t elements = static_cast<std::uint64_t>(tensor.rows) * tensor.cols;
+        if (!terminated || (tensor.type != TENSOR_FLOAT32 && tensor.type != TENSOR_UINT32) || tensor.offset % MODEL_FILE_ALIGNMENT != 0 || !fits ||
+            elements > file_.size() / sizeof(float) || tensor.size != elements * sizeof(float)) {
+            std::cerr << "Invalid tensor descriptor " << i << " in " << filename << std::endl;
+            return false;
+        }
+    }
+
+    if (verifyChecksum && crc32(file_.data() + sizeof(ModelFileHeader), file_.size() - sizeof(ModelFileHeader)) != fileHeader->checksum) {
+        std::cerr << "Model file checksum mismatch: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Look up a tensor by name.
+ *
+ * @param name The tensor name.
+ * @return Its descriptor, or nullptr if the file has no such tensor.
+ */
+const TensorDescriptor* ModelFile::findTensor(const std::string& name) const {
+    for (int i = 0; i < numTensors(); ++i) {
+        if (name == descriptors()[i].name) {
+            return &descriptors()[i];
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief View a tensor in place in the mapped file.
+ *
+ * @param name The tensor name.
+ * @return A map of the tensor, or an empty map if the file has no such float tensor. It stays
+ *         valid for the lifetime of the ModelFile.
+ */
+Eigen::Map<const Eigen::MatrixXf> ModelFile::matrix(const std::string& name) const {
+    const TensorDescriptor* tensor = findTensor(name);
+    if (tensor == nullptr || tensor->type != TENSOR_FLOAT32) {
+        return Eigen::Map<const Eigen::MatrixXf>(nullptr, 0, 0);
+    }
+    return Eigen::Map<const Eigen::MatrixXf>(reinterpret_cast<const float*>(file_.data() + tensor->offset), tensor->rows, tensor->cols);
+}
+
+/**
+ * @brief View an integer tensor in place in the mapped file.
+ *
+ * @param name The tensor name.
+ * @return A map of the tensor, or an empty map if the file has no such uint32 tensor. It stays
+ *         valid for the lifetime of the ModelFile.
+ */
+Eigen::Map<const WordMatrix> ModelFile::words(const std::string& name) const {
+    const TensorDescriptor* tensor = findTensor(name);
+    if (tensor == nullptr || tensor->type != TENSOR_UINT32) {
+        return Eigen::Map<const WordMatrix>(nullptr, 0, 0);
+    }
+    return Eigen::Map<const WordMatrix>(reinterpret_cast<const std::uint32_t*>(file_.data() + tensor->offset), tensor->rows, tensor->cols);
+}
+
+/**
+ * @brief Whether the file holds a two-layer network with consistent shapes.
+ *
+ * @return True if tensors W1, b1, W2 and b2 exist and fit together.
+ */
+bool ModelFile::hasNetwork() const {
+    auto W1 = matrix("W1"), b1 = matrix("b1"), W2 = matrix("W2"), b2 = matrix("b2");
+    return W1.size() > 0 && b1.cols() == 1 && b1.rows() == W1.rows() &&
+           W2.cols() == W1.rows() && b2.cols() == 1 && b2.rows() == W2.rows();
+}
+
+/**
+ * @brief View the two-layer network stored in the file, without copying it.
+ *
+ * @return The parameters; empty views if hasNetwork() is false.
+ */
+NetworkView ModelFile::network() const {
+    if (!hasNetwork()) {
+        return NetworkView({nullptr, 0, 0}, {nullptr, 0}, {nullptr, 0, 0}, {nullptr, 0});
+    }
+
+    auto b1 = matrix("b1"), b2 = matrix("b2");
+    return NetworkView(matrix("W1"), Eigen::Map<const Eigen::VectorXf>(b1.data(), b1.rows()),
+                       matrix("W2"), Eigen::Map<const Eigen::VectorXf>(b2.data(), b2.rows()));
+}
@@ -0,0 +1,99 @@
+#include "../include/model_registry.h"
+
+#include <iostream>
+#include <system_error>
+
+/**
+ * @brief Load a model file and start watching it for new versions.
+ *
+ * The file is loaded once before the constructor returns, so current() always returns a
+ * model; check its isLoaded() in case the first load failed. A background thread then
+ * checks the file's modification time and size every pollInterval and reloads it when
+ * they change.
+ *
+ * Version 2 models are used in place from a memory mapping, so new versions must be written
+ * to a new file and renamed over the old one, as saveParameters does. Rewriting the mapped
+ * file in place would pull its pages from under the model that is still being served.
+ *
+ * @param modelFile The model file to serve, as written by saveParameters.
+ * @param pollInterval How often the file is checked for a new version.
+ */
+ModelRegistry::ModelRegistry(const std::string& modelFile, std::chrono::milliseconds pollInterval)
+    : modelFile_(modelFile), pollInterval_(pollInterval) {
+    readStamp(loadedStamp_);
+    current_.store(std::make_shared<const InferenceModel>(modelFile_));
+    version_.store(1);
+    watcher_ = std::thread(&ModelRegistry::watchLoop, this);
+}
+
+/**
+ * @brief Stop the watcher thread. Models still held by callers stay valid.
+ */
+ModelRegistry::~ModelRegistry() {
+    {
+        std::lock_guard<std::mutex> lock(watchMutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    watcher_.join();
+}
+
+/**
+ * @brief Read the modification time and size of the model file.
+ *
+ * @param stamp Receives the file's stamp.
+ * @return Whether the file exists and could be inspected.
+ */
+bool ModelRegistry::readStamp(FileStamp& stamp) const {
+    std::error_code error;
+    stamp.modified = std::filesystem::last_write_time(modelFile_, error);
+    if (error) {
+        return false;
+    }
+    stamp.size = std::filesystem::file_size(modelFile_, error);
+    return !error;
+}
+
+/**
+ * @brief Load the model file again if it changed, and publish it.
+ *
+ * The new model is loaded completely, off to the side, and then swapped in with a single
+ * atomic store. Calls already running keep the model they started with (their shared_ptr
+ * keeps it alive) and calls starting afterwards get the new one, so readers never wait.
+ * A file that fails to load is not published; the previous model stays current and the
+ * file is only tried again once it changes again.
+ *
+ * @return Whether a new version was published.
+ */
+bool ModelRegistry::reload() {
+    std::lock_guard<std::mutex> lock(reloadMutex_);
+
+    FileStamp stamp;
+    if (!readStamp(stamp) || stamp == loadedStamp_ || stamp == failedStamp_) {
+        return false;
+    }
+
+    auto model = std::make_shared<const InferenceModel>(modelFile_);
+    if (!model->isLoaded()) {
+        failedStamp_ = stamp;
+        return false;
+    }
+
+    loadedStamp_ = stamp;
+    current_.store(std::move(model), std::memory_order_release);
+    unsigned long version = version_.fetch_add(1, std::memory_order_acq_rel) + 1;
+    std::cout << "Loaded model version " << version << " from " << modelFile_ << std::endl;
+    return true;
+}
+
+/**
+ * @brief Body of the watcher thread: poll the file until the registry is destroyed.
+ */
+void ModelRegistry::watchLoop() {
+    std::unique_lock<std::mutex> lock(watchMutex_);
+    while (!wake_.wait_for(lock, pollInterval_, [this] { return stopping_; })) {
+        lock.unlock();
+        reload();
+        lock.lock();
+    }
+}
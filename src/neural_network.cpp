@@ -3,12 +3,50 @@
 #include "../include/activation_functions.h"
 #include "../include/helpers.h"
 #include "../include/dataset_utils.h"
+#include "../include/allocation_counter.h"
+#include "../include/fixed_network.h"
+#include "../include/data_parallel.h"
+#include "../include/async_validator.h"
+#include "../include/checkpoint.h"
+#include "../include/evaluation.h"
+#include "../include/idx_stream.h"
+#include "../include/sparse_input.h"
 
 #include <Eigen/Core>
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <utility>
 
 
 
+/**
+ * @brief The rest of forward propagation once the first layer's pre-activations are known.
+ *
+ * @param Z1 The first layer's product W1 * X; the bias is added to it in place.
+ * @param b1 Bias vector for the first layer.
+ * @param W2 Weight matrix for the second layer.
+ * @param b2 Bias vector for the second layer.
+ * @return Z1, A1, Z2 and A2, as returned by forwardPropagation.
+ */
+static std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> forwardFromFirstLayer(Eigen::MatrixXf Z1, const Eigen::MatrixXf& b1,
+                                                                                                           const Eigen::MatrixXf& W2, const Eigen::MatrixXf& b2){
+    Eigen::MatrixXf A1(Z1.rows(), Z1.cols());
+    biasReLU(Z1, b1.col(0), A1);
+
+    // Calculate Z2
+    Eigen::MatrixXf Z2 = W2*A1;
+    Z2.colwise() += b2.col(0);
+
+    // Obtain A2 by applying softmax
+    Eigen::MatrixXf A2 = softmax(Z2);
+
+    return std::make_tuple(Z1, A1, Z2, A2);
+}
+
 /**
  * @brief Forward propagation for neural network
  *
@@ -37,25 +75,60 @@ std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> f
                                                                                                   const Eigen::MatrixXf& X){
 
 
-    // Calculate Z1
+    // Calculate Z1, then add the bias and apply ReLU in one pass to get A1
     Eigen::MatrixXf Z1 = W1*X;
-    for (int i = 0; i < Z1.cols(); ++i) {
-        Z1.col(i) += b1;
-    }
+    return forwardFromFirstLayer(std::move(Z1), b1, W2, b2);
+}
 
-    // Get A1 by passing Z1 through activation function
-    Eigen::MatrixXf A1 = ReLU(Z1);
+/**
+ * @brief Forward propagation for a dataset of sparse inputs.
+ *
+ * Same results as the dense overload; only the non-zero inputs enter the first layer.
+ *
+ * @param W1 Weight matrix for the first layer.
+ * @param b1 Bias vector for the first layer.
+ * @param W2 Weight matrix for the second layer.
+ * @param b2 Bias vector for the second layer.
+ * @param X Input data in CSC form, built once by toSparseInput.
+ *
+ * @return The activations and outputs of each layer, as for the dense overload.
+ */
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> forwardPropagation(const Eigen::MatrixXf& W1, const Eigen::MatrixXf& b1, const Eigen::MatrixXf& W2,
+                                                                                                  const Eigen::MatrixXf& b2, const SparseInputMatrix& X){
+    Eigen::MatrixXf Z1(W1.rows(), X.cols());
+    sparseInputProduct(W1, X, Z1);
+    return forwardFromFirstLayer(std::move(Z1), b1, W2, b2);
+}
 
-    // Calculate Z2
-    Eigen::MatrixXf Z2 = W2*A1;
-    for (int i = 0; i < Z2.cols(); ++i) {
-        Z2.col(i) += b2;
-    }
+/**
+ * @brief Backward propagation down to the first layer, leaving out the input-dependent dW1.
+ *
+ * @param Z1 Activation values of the first hidden layer.
+ * @param A1 Output values of the first hidden layer.
+ * @param A2 Output values of the output layer.
+ * @param W2 Weight matrix for the second layer.
+ * @param Y Vector of true labels.
+ * @return The gradient with respect to Z1, then the gradients with respect to b1, W2 and b2.
+ */
+static std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> backwardPropagationToFirstLayer(const Eigen::MatrixXf& Z1, const Eigen::MatrixXf& A1, const Eigen::MatrixXf& A2,
+                                                                                                                     const Eigen::MatrixXf& W2, const Eigen::VectorXi& Y){
+    float m = Y.size();
 
-    // Obtain A2 by applying softmax
-    Eigen::MatrixXf A2 = softmax(Z2);
+    // One hot encode labels
+    Eigen::MatrixXi oneHotY = oneHotEncode(Y, A2.rows());
 
-    return std::make_tuple(Z1, A1, Z2, A2);
+    Eigen::MatrixXf dZ2 = A2 - oneHotY.cast<float>();
+
+    Eigen::MatrixXf dW2 = (1 / m) *dZ2 *A1.transpose();
+
+    Eigen::VectorXf db2 = (1 / m) * dZ2.rowwise().sum();
+
+    Eigen::MatrixXf dZ1 =  W2.transpose() * dZ2; // Dot product
+    dZ1 = dZ1.array() * ReLU_derivative(Z1).array();    // Element-wise multiplication
+
+    Eigen::VectorXf db1 = (1 / m) * dZ1.rowwise().sum();
+
+    return std::make_tuple(dZ1, db1, dW2, db2);
 }
 
 /**
@@ -80,63 +153,334 @@ std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> f
  *         - Gradient of the cost function with respect to the weights of the second layer.
  *         - Gradient of the cost function with respect to the biases of the second layer.
  */
-std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> backwardPropagation(Eigen::MatrixXf Z1,Eigen::MatrixXf A1,Eigen::MatrixXf Z2,Eigen::MatrixXf A2,
-                                                                                                   Eigen::MatrixXf W1,Eigen::MatrixXf W2,Eigen::MatrixXf X,Eigen::VectorXi Y){
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> backwardPropagation(const Eigen::MatrixXf& Z1,const Eigen::MatrixXf& A1,const Eigen::MatrixXf& Z2,const Eigen::MatrixXf& A2,
+                                                                                                   const Eigen::MatrixXf& W1,const Eigen::MatrixXf& W2,const Eigen::MatrixXf& X,const Eigen::VectorXi& Y){
 
     // Calculate the number of training examples
     float m = Y.size();
 
-    // One hot encode labels
-    Eigen::MatrixXi oneHotY = oneHotEncode(Y);
-
-    Eigen::MatrixXf dZ2 = A2 - oneHotY.cast<float>();
+    Eigen::MatrixXf dZ1;
+    Eigen::MatrixXf db1, dW2, db2;
+    std::tie(dZ1, db1, dW2, db2) = backwardPropagationToFirstLayer(Z1, A1, A2, W2, Y);
 
-    Eigen::MatrixXf dW2 = (1 / m) *dZ2 *A1.transpose();
+    Eigen::MatrixXf dW1 = (1/m) * dZ1 * X.transpose();
 
-    Eigen::VectorXf db2 = (1 / m) * dZ2.rowwise().sum();
+    return std::make_tuple(dW1, db1, dW2, db2);
+}
 
-    Eigen::MatrixXf dZ1 =  W2.transpose() * dZ2; // Dot product
-    dZ1 = dZ1.array() * ReLU_derivative(Z1).array();    // Element-wise multiplication
+/**
+ * @brief Backward propagation for a dataset of sparse inputs.
+ *
+ * Same results as the dense overload; the first layer's weight gradient only accumulates
+ * over the non-zero inputs.
+ *
+ * @param Z1 Activation values of the first hidden layer.
+ * @param A1 Output values of the first hidden layer.
+ * @param Z2 Activation values of the output layer.
+ * @param A2 Output values of the output layer.
+ * @param W1 Weight matrix for the first layer.
+ * @param W2 Weight matrix for the second layer.
+ * @param X Input data in CSC form, built once by toSparseInput.
+ * @param Y Vector of true labels.
+ *
+ * @return The gradients with respect to W1, b1, W2 and b2, as for the dense overload.
+ */
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> backwardPropagation(const Eigen::MatrixXf& Z1,const Eigen::MatrixXf& A1,const Eigen::MatrixXf& Z2,const Eigen::MatrixXf& A2,
+                                                                                                   const Eigen::MatrixXf& W1,const Eigen::MatrixXf& W2,const SparseInputMatrix& X,const Eigen::VectorXi& Y){
+    float m = Y.size();
 
-    Eigen::MatrixXf dW1 = (1/m) * dZ1 * X.transpose();
+    Eigen::MatrixXf dZ1;
+    Eigen::MatrixXf db1, dW2, db2;
+    std::tie(dZ1, db1, dW2, db2) = backwardPropagationToFirstLayer(Z1, A1, A2, W2, Y);
 
-    Eigen::VectorXf db1 = (1 / m) * dZ1.rowwise().sum();
+    Eigen::MatrixXf dW1(W1.rows(), W1.cols());
+    sparseInputGradient(dZ1, X, 1 / m, dW1);
 
     return std::make_tuple(dW1, db1, dW2, db2);
 }
 
 /**
- * @brief Update parameters for the neural network.
+ * @brief Initialise the parameters of the network as a NetworkParameters bundle.
  *
- * This function updates the parameters (weights and biases) for the neural network based on the calculated gradients and a specified learning rate (alpha).
- * The parameters are updated using gradient descent, where each parameter is adjusted by subtracting the product of the gradient and the learning rate.
+ * @param seed Optional seed, for reproducible runs.
+ * @return The parameters produced by initParams().
+ */
+NetworkParameters initNetworkParameters(std::optional<unsigned int> seed) {
+    NetworkParameters params;
+    std::tie(params.W1, params.b1, params.W2, params.b2) = initParams(seed);
+    return params;
+}
+
+/**
+ * @brief Allocate the workspace for training steps of a fixed batch size.
  *
- * @param W1 The weight matrix for the first layer
- * @param b1 The bias vector for the first layer
- * @param W2 The weight matrix for the second layer
- * @param b2 The bias vector for the second layer
- * @param dW1 The gradient of the loss with respect to W1
- * @param db1 The gradient of the loss with respect to b1
- * @param dW2 The gradient of the loss with respect to W2
- * @param db2 The gradient of the loss with respect to b2
- * @param alpha The learning rate for gradient descent
+ * @param inputSize The number of inputs (rows of X).
+ * @param hiddenSize The number of neurons in the hidden layer.
+ * @param outputSize The number of output classes.
+ * @param batchSize The number of samples per step.
+ */
+TrainingWorkspace::TrainingWorkspace(int inputSize, int hiddenSize, int outputSize, int batchSize)
+    : Z1(hiddenSize, batchSize), A1(hiddenSize, batchSize), Z2(outputSize, batchSize), A2(outputSize, batchSize),
+      dZ1(hiddenSize, batchSize), dZ2(outputSize, batchSize),
+      dW1(hiddenSize, inputSize), dW2(outputSize, hiddenSize),
+      db1(hiddenSize), db2(outputSize) {}
+
+/**
+ * @brief The forward pass after the first layer's product: bias and ReLU, the output layer and the loss.
  *
- * @return A tuple containing the updated parameters:
- *         - W1: The updated weight matrix for the first layer
- *         - b1: The updated bias vector for the first layer
- *         - W2: The updated weight matrix for the second layer
- *         - b2: The updated bias vector for the second layer
+ * @param params The current parameters of the network.
+ * @param Y The true labels of the batch.
+ * @param ws Holds Z1 = W1 * X; receives the other activations and the loss.
  */
-std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> updateParameters(Eigen::MatrixXf W1,Eigen::MatrixXf b1,Eigen::MatrixXf W2,
-                                                                                                Eigen::MatrixXf b2,Eigen::MatrixXf dW1,Eigen::MatrixXf db1,
-                                                                                                Eigen::MatrixXf dW2,Eigen::MatrixXf db2,float alpha){
+static void forwardSecondLayer(const NetworkParameters& params, const Eigen::VectorXi& Y, TrainingWorkspace& ws) {
+    biasReLU(ws.Z1, params.b1, ws.A1);
 
-    W1 = W1 - alpha * dW1;
-    b1 = b1 - alpha * db1;
-    W2 = W2 - alpha * dW2;
-    b2 = b2 - alpha * db2;
+    ws.Z2.noalias() = params.W2 * ws.A1;
+    ws.Z2.colwise() += params.b2;
+    ws.loss = softmaxCrossEntropy(ws.Z2, Y, ws.A2);
+}
+
+/**
+ * @brief The backward pass down to the first layer: every gradient except the input-dependent dW1.
+ *
+ * @param params The current parameters of the network.
+ * @param Y The true labels of the batch.
+ * @param ws Holds the activations of the forward pass; receives dZ2, dW2, db2, dZ1 and db1.
+ */
+static void backwardToFirstLayer(const NetworkParameters& params, const Eigen::VectorXi& Y, TrainingWorkspace& ws) {
+    const float invM = 1.0f / static_cast<float>(Y.size());
 
-    return std::make_tuple(W1, b1, W2, b2);
+    // dZ2 = A2 - oneHot(Y) without building the one-hot matrix
+    ws.dZ2 = ws.A2;
+    for (int j = 0; j < ws.dZ2.cols(); ++j) {
+        ws.dZ2(Y(j), j) -= 1.0f;
+    }
+
+    ws.dW2.noalias() = invM * ws.dZ2 * ws.A1.transpose();
+    ws.db2.noalias() = invM * ws.dZ2.rowwise().sum();
+
+    ws.dZ1.noalias() = params.W2.transpose() * ws.dZ2;
+    ws.dZ1.array() *= (ws.Z1.array() > 0.0f).cast<float>();
+    ws.db1.noalias() = invM * ws.dZ1.rowwise().sum();
+}
+
+/**
+ * @brief Run the forward pass of one training step into a workspace.
+ *
+ * Computes the activations (Z1, A1, Z2, A2) and the mean cross-entropy loss of the batch
+ * into the preallocated matrices of the workspace. Networks with the default 784-10-10
+ * topology run the compile-time specialised MnistNetwork kernels; any other shape uses
+ * the dynamic path.
+ *
+ * @param params The current parameters of the network.
+ * @param X The batch of input samples, one per column.
+ * @param Y The true labels of the batch.
+ * @param workspace Receives the activations and loss.
+ */
+void forwardPass(const NetworkParameters& params, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y, TrainingWorkspace& workspace) {
+    if (MnistNetwork::matches(params) && workspace.Z1.cols() == X.cols()) {
+        MnistNetwork::forwardPass(params, X, Y, workspace);
+        return;
+    }
+
+    workspace.Z1.noalias() = params.W1 * X;
+    forwardSecondLayer(params, Y, workspace);
+}
+
+/**
+ * @brief Run the forward pass of one training step on a batch of sparse inputs.
+ *
+ * The first layer only reads the weights of the batch's non-zero inputs; the rest of the
+ * pass is the same as for dense inputs. No heap allocation takes place.
+ *
+ * @param params The current parameters of the network.
+ * @param X The batch in CSC form, one sample per column, e.g. from a SparseBatch.
+ * @param Y The true labels of the batch.
+ * @param workspace Receives the activations and loss.
+ */
+void forwardPass(const NetworkParameters& params, const SparseInputMatrix& X, const Eigen::VectorXi& Y, TrainingWorkspace& workspace) {
+    sparseInputProduct(params.W1, X, workspace.Z1);
+    forwardSecondLayer(params, Y, workspace);
+}
+
+/**
+ * @brief Run the backward pass of one training step into a workspace.
+ *
+ * @param params The current parameters of the network.
+ * @param X The batch of input samples, one per column.
+ * @param Y The true labels of the batch.
+ * @param workspace Holds the activations of forwardPass for the batch; receives the gradients (dW1, db1, dW2, db2).
+ */
+void backwardPass(const NetworkParameters& params, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y, TrainingWorkspace& workspace) {
+    if (MnistNetwork::matches(params) && workspace.Z1.cols() == X.cols()) {
+        MnistNetwork::backwardPass(params, X, Y, workspace);
+        return;
+    }
+
+    const float invM = 1.0f / static_cast<float>(X.cols());
+    backwardToFirstLayer(params, Y, workspace);
+    workspace.dW1.noalias() = invM * workspace.dZ1 * X.transpose();
+}
+
+/**
+ * @brief Run the backward pass of one training step on a batch of sparse inputs.
+ *
+ * @param params The current parameters of the network.
+ * @param X The batch in CSC form, one sample per column, as passed to forwardPass.
+ * @param Y The true labels of the batch.
+ * @param workspace Holds the activations of forwardPass for the batch; receives the gradients (dW1, db1, dW2, db2).
+ */
+void backwardPass(const NetworkParameters& params, const SparseInputMatrix& X, const Eigen::VectorXi& Y, TrainingWorkspace& workspace) {
+    const float invM = 1.0f / static_cast<float>(X.cols());
+    backwardToFirstLayer(params, Y, workspace);
+    sparseInputGradient(workspace.dZ1, X, invM, workspace.dW1);
+}
+
+/**
+ * @brief Run the forward and backward pass of one training step into a workspace.
+ *
+ * This computes the same activations and gradients as forwardPropagation followed by
+ * backwardPropagation, but every result is written into the preallocated matrices of the
+ * workspace. As long as X has the batch size the workspace was created for, no heap
+ * allocation takes place, apart from the packing buffers Eigen takes from the heap for
+ * products too large for EIGEN_STACK_ALLOCATION_LIMIT (not reached by the default network).
+ *
+ * @param params The current parameters of the network.
+ * @param X The batch of input samples, one per column.
+ * @param Y The true labels of the batch.
+ * @param workspace Receives the activations (Z1, A1, Z2, A2), gradients (dW1, db1, dW2, db2) and loss.
+ */
+void computeGradients(const NetworkParameters& params, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y, TrainingWorkspace& workspace) {
+    forwardPass(params, X, Y, workspace);
+    backwardPass(params, X, Y, workspace);
+}
+
+/**
+ * @brief Apply the gradients held in a workspace to the parameters, in place.
+ *
+ * @param params The parameters to update.
+ * @param workspace The workspace filled by computeGradients.
+ * @param alpha The learning rate.
+ */
+void applyGradients(NetworkParameters& params, const TrainingWorkspace& workspace, float alpha) {
+    params.W1 -= alpha * workspace.dW1;
+    params.b1 -= alpha * workspace.db1;
+    params.W2 -= alpha * workspace.dW2;
+    params.b2 -= alpha * workspace.db2;
+}
+
+/**
+ * @brief Perform one allocation-free gradient descent step.
+ *
+ * @param params The parameters to update in place.
+ * @param X The batch of input samples, one per column.
+ * @param Y The true labels of the batch.
+ * @param alpha The learning rate.
+ * @param workspace Preallocated workspace sized for X; holds the step's activations afterwards.
+ */
+void trainingStep(NetworkParameters& params, const Eigen::MatrixXf& X, const Eigen::VectorXi& Y, float alpha, TrainingWorkspace& workspace) {
+    computeGradients(params, X, Y, workspace);
+    applyGradients(params, workspace, alpha);
+}
+
+/**
+ * @brief Evaluate a snapshot of the parameters for an AsyncValidator.
+ *
+ * @param evaluator Chunk buffers for the network shape, only used by the validation thread.
+ * @param params The snapshot.
+ * @param X The validation set.
+ * @param Y The validation labels.
+ * @return The accuracy and loss.
+ */
+template <typename Data>
+static ValidationResult validateSnapshot(Evaluator& evaluator, const NetworkParameters& params, const Data& X, const Eigen::VectorXi& Y) {
+    const EvaluationReport& report = evaluator.evaluate(NetworkView(params), X, Y);
+    ValidationResult result;
+    result.accuracy = report.accuracy();
+    result.loss = report.loss();
+    return result;
+}
+
+/**
+ * @brief Evaluate a snapshot of the parameters on a streamed validation set for an AsyncValidator.
+ *
+ * @param evaluator Chunk buffers for the network shape, only used by the validation thread.
+ * @param params The snapshot.
+ * @param stream The validation set, only read by the validation thread.
+ * @return The accuracy and loss.
+ */
+static ValidationResult validateSnapshot(Evaluator& evaluator, const NetworkParameters& params, IdxStream& stream) {
+    const EvaluationReport& report = evaluator.evaluate(NetworkView(params), stream);
+    ValidationResult result;
+    result.accuracy = report.accuracy();
+    result.loss = report.loss();
+    return result;
+}
+
+/**
+ * @brief Print a validation result as one line, so it does not interleave with the trainer's output.
+ *
+ * Formatted into a stack buffer, so reporting from the validation thread does not allocate.
+ *
+ * @param label "Iteration" or "Epoch".
+ * @param result The result reported by an AsyncValidator.
+ */
+static void printValidationResult(const char* label, const ValidationResult& result) {
+    char line[128];
+    const int length = std::snprintf(line, sizeof(line), "%s: %d, Validation Accuracy: %g, Validation Loss: %g\n", label, result.iteration, result.accuracy, result.loss);
+    std::cout.write(line, std::min<int>(length, sizeof(line) - 1)).flush();
+}
+
+/**
+ * @brief Load the checkpoint a run should resume from.
+ *
+ * @param config The run's checkpoint settings.
+ * @param inputSize The number of inputs of the network being trained.
+ * @param hiddenSize The number of neurons in its hidden layer.
+ * @param outputSize The number of output classes.
+ * @return The checkpoint, or nothing if resuming is off, there is no valid checkpoint yet,
+ *         or it belongs to a network of another shape.
+ */
+static std::optional<TrainingCheckpoint> resumeCheckpoint(const CheckpointConfig& config, Eigen::Index inputSize, Eigen::Index hiddenSize, Eigen::Index outputSize) {
+    if (!config.resume || config.file.empty()) {
+        return std::nullopt;
+    }
+
+    std::optional<TrainingCheckpoint> checkpoint = loadCheckpoint(config.file);
+    if (!checkpoint) {
+        std::cout << "No checkpoint to resume from in " << config.file << ", starting a new run" << std::endl;
+        return std::nullopt;
+    }
+    if (checkpoint->W1.cols() != inputSize || checkpoint->W1.rows() != hiddenSize || checkpoint->W2.rows() != outputSize) {
+        std::cerr << "Checkpoint " << config.file << " is for a network of another shape, starting a new run" << std::endl;
+        return std::nullopt;
+    }
+    return checkpoint;
+}
+
+/**
+ * @brief Whether a checkpoint is due after an iteration or epoch.
+ *
+ * @param config The run's checkpoint settings.
+ * @param completed The number of iterations or epochs finished.
+ * @param total The number the run will finish; the last one is always checkpointed.
+ * @return True if a checkpoint should be written now.
+ */
+static bool checkpointDue(const CheckpointConfig& config, int completed, int total) {
+    return !config.file.empty() && config.interval > 0 && (completed % config.interval == 0 || completed == total);
+}
+
+/**
+ * @brief Restore an optimizer's state from a checkpoint, or keep its fresh state if it does not fit.
+ *
+ * @param optimizer The run's optimizer.
+ * @param state The optimizer state saved in the checkpoint.
+ * @param filename The checkpoint file, for the warning.
+ */
+static void restoreOptimizer(Optimizer& optimizer, const OptimizerState& state, const std::string& filename) {
+    if (!optimizer.restoreState(state)) {
+        std::cerr << "Optimizer state in checkpoint " << filename << " does not match the optimizer type or shapes, starting it afresh" << std::endl;
+    }
 }
 
 /**
@@ -144,12 +488,21 @@ std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> u
  *
  * This function optimizes the neural network parameters using gradient descent.
  * It updates the parameters (weights and biases) iteratively based on the gradients
- * of the cost function with respect to the parameters.
+ * of the cost function with respect to the parameters. Every 10 iterations a copy of the
+ * parameters is validated on a background thread while training continues, and the
+ * validation accuracy is printed when it is ready.
  *
  * @param X The input data matrix.
  * @param Y The vector of true class labels.
  * @param alpha The learning rate for gradient descent.
  * @param iterations The number of iterations for gradient descent.
+ * @param telemetry Optional, receives the phase timings of every iteration, each recorded as an epoch.
+ * @param checkpoint Where and how often to checkpoint the parameters in the background, and
+ *                   whether to resume from the last checkpoint. Full-batch descent has no other
+ *                   state besides the optimizer's, so a resumed run continues exactly as if it had not stopped.
+ * @param optimizerConfig The optimizer that applies the gradients in place; its state is checkpointed too.
+ * @param sparseInput Whether to run the first layer on a sparse copy of X when X is at most
+ *                    SPARSE_INPUT_MAX_DENSITY non-zero, as MNIST is.
  *
  * @return A tuple containing the optimized parameters:
  *         - W1: The optimized weight matrix for the first layer.
@@ -157,7 +510,7 @@ std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> u
  *         - W2: The optimized weight matrix for the second layer.
  *         - b2: The optimized bias vector for the second layer.
  */
-std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> gradientDescent(Eigen::MatrixXf X,Eigen::VectorXi Y,Eigen::MatrixXf valX,Eigen::VectorXi valY, float alpha, int iterations){
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> gradientDescent(const Eigen::MatrixXf& X,const Eigen::VectorXi& Y,const Eigen::MatrixXf& valX,const Eigen::VectorXi& valY, float alpha, int iterations, TrainingTelemetry* telemetry, const CheckpointConfig& checkpoint, const OptimizerConfig& optimizerConfig, bool sparseInput){
 
     // initialise parameters
     Eigen::MatrixXf W1;
@@ -167,48 +520,535 @@ std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> g
 
     std::tie(W1, b1, W2, b2) = initParams();
 
-    for(int i = 0; i<iterations; i++){
+    std::unique_ptr<Optimizer> optimizer = makeOptimizer(optimizerConfig, {W1.size(), b1.size(), W2.size(), b2.size()});
+
+    // Mostly-zero inputs, such as MNIST digits, feed the first layer from a sparse copy built once here
+    std::optional<SparseInputMatrix> sparseX;
+    if (sparseInput && inputDensity(X) <= SPARSE_INPUT_MAX_DENSITY) {
+        sparseX = toSparseInput(X);
+    }
 
-        shuffleDataAndLabels(X, Y);
-        shuffleDataAndLabels(valX, valY);
+    // A mini-batch checkpoint counts epochs and holds a sample order, so it is not resumed as iterations
+    int firstIteration = 0;
+    if (std::optional<TrainingCheckpoint> saved = resumeCheckpoint(checkpoint, W1.cols(), W1.rows(), W2.rows())) {
+        if (saved->permutation.empty() && saved->generatorState.empty()) {
+            W1 = saved->W1;
+            b1 = saved->b1;
+            W2 = saved->W2;
+            b2 = saved->b2;
+            firstIteration = saved->completed;
+            restoreOptimizer(*optimizer, saved->optimizerState, checkpoint.file);
+            std::cout << "Resuming from iteration " << firstIteration << " of " << checkpoint.file << std::endl;
+        } else {
+            std::cerr << "Checkpoint " << checkpoint.file << " is from mini-batch training, starting a new run" << std::endl;
+        }
+    }
+
+    std::unique_ptr<CheckpointWriter> checkpointWriter;
+    if (!checkpoint.file.empty() && checkpoint.interval > 0) {
+        checkpointWriter = std::make_unique<CheckpointWriter>(checkpoint.file);
+    }
+    TrainingCheckpoint snapshot;
+
+    AsyncValidator validator(
+        [&valX, &valY, evaluator = Evaluator(W1.rows(), W2.rows())](const NetworkParameters& snapshot) mutable {
+            return validateSnapshot(evaluator, snapshot, valX, valY);
+        },
+        [](const ValidationResult& result) { printValidationResult("Iteration", result); });
+
+    // Every iteration uses the whole dataset, so its order does not affect the gradient and no shuffling is needed
+    for(int i = firstIteration; i<iterations; i++){
+
+        if (telemetry) {
+            telemetry->startEpoch();
+        }
 
         Eigen::MatrixXf Z1; // pre activation value of neurons in first hidden layer
         Eigen::MatrixXf A1; // activated/output value of neurons in first hidden layer
         Eigen::MatrixXf Z2; // pre activation value of neurons in second hidden layer
         Eigen::MatrixXf A2; // activated/output value of neurons in second hidden layer
 
-        std::tie(Z1, A1, Z2, A2) = forwardPropagation(W1, b1, W2, b2, X);
+        {
+            TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_FORWARD);
+            std::tie(Z1, A1, Z2, A2) = sparseX ? forwardPropagation(W1, b1, W2, b2, *sparseX) : forwardPropagation(W1, b1, W2, b2, X);
+        }
 
         Eigen::MatrixXf dW1; // gradient of the cost function with respect to the weights of the first layer.
         Eigen::MatrixXf db1; // gradient of the cost function with respect to the biases of the first layer.
         Eigen::MatrixXf dW2; // gradient of the cost function with respect to the weights of the second layer.
         Eigen::MatrixXf db2; // gradient of the cost function with respect to the biases of the second layer.
 
-        std::tie(dW1, db1, dW2, db2) = backwardPropagation(Z1, A1, Z2, A2, W1, W2, X, Y);
+        {
+            TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_BACKWARD);
+            std::tie(dW1, db1, dW2, db2) = sparseX ? backwardPropagation(Z1, A1, Z2, A2, W1, W2, *sparseX, Y) : backwardPropagation(Z1, A1, Z2, A2, W1, W2, X, Y);
+        }
 
-        std::tie(W1, b1, W2, b2) = updateParameters(W1, b1, W2, b2, dW1, db1, dW2, db2, alpha);
+        {
+            TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_UPDATE);
+            optimizer->beginStep();
+            optimizer->update(0, W1.data(), dW1.data(), alpha);
+            optimizer->update(1, b1.data(), db1.data(), alpha);
+            optimizer->update(2, W2.data(), dW2.data(), alpha);
+            optimizer->update(3, b2.data(), db2.data(), alpha);
+        }
 
-        if((i+1)%10 == 0 || i == 0){
-            // Calculate accuracy on validation set
-            Eigen::MatrixXf valZ1; // pre activation value of neurons in first hidden layer
-            Eigen::MatrixXf valA1; // activated/output value of neurons in first hidden layer
-            Eigen::MatrixXf valZ2; // pre activation value of neurons in second hidden layer
-            Eigen::MatrixXf valA2;
-            std::tie(valZ1, valA1, valZ2, valA2) = forwardPropagation(W1, b1, W2, b2, valX);
-            Eigen::VectorXi valPredictions = getPredictions(valA2);
-            double valAccuracy = getAccuracy(valPredictions, valY);
+        // Full-batch iterations visit every sample, so a checkpoint needs no sample order or generator
+        if (checkpointWriter && checkpointDue(checkpoint, i + 1, iterations)) {
+            snapshot.W1 = W1;
+            snapshot.b1 = b1;
+            snapshot.W2 = W2;
+            snapshot.b2 = b2;
+            snapshot.optimizerState = optimizer->state();
+            snapshot.completed = i + 1;
+            checkpointWriter->submit(snapshot);
+        }
 
+        // Validation runs every 10 iterations; telemetry records every iteration with the latest validation accuracy
+        const bool report = (i+1)%10 == 0 || i == 0;
+        if(report){
+            // Only the snapshot copy is on the training thread; the validation pass runs in the background
+            TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_VALIDATION);
+            validator.submit(i + 1, NetworkView(Eigen::Map<const Eigen::MatrixXf>(W1.data(), W1.rows(), W1.cols()), Eigen::Map<const Eigen::VectorXf>(b1.data(), b1.size()),
+                                                Eigen::Map<const Eigen::MatrixXf>(W2.data(), W2.rows(), W2.cols()), Eigen::Map<const Eigen::VectorXf>(b2.data(), b2.size())));
+        }
+
+        if(report || (telemetry && telemetry->recording())){
             Eigen::VectorXi predictions = getPredictions(A2);
             double accuracy = getAccuracy(predictions, Y);
-            std::cout << "Iteration: " << i+1 << ", Accuracy: " << accuracy << ", Validation Accuracy: " << valAccuracy << std::endl;
+            float loss = crossEntropyFromLogits(Z2, Y);
+            if (report) {
+                std::ostringstream line;
+                line << "Iteration: " << i+1 << ", Loss: " << loss << ", Accuracy: " << accuracy << "\n";
+                std::cout << line.str() << std::flush;
+            }
+            if (telemetry) {
+                std::optional<ValidationResult> validation = validator.latest();
+                telemetry->endEpoch({i + 1, static_cast<long long>(X.cols()), loss, accuracy, validation ? validation->accuracy : 0.0});
+            }
         }
 
 
     }
 
+    validator.wait();
     return std::tie(W1, b1, W2, b2);
 }
 
+/*
+ * Batch sources for trainMiniBatches
+ *
+ * A source hands the trainer its training set one block at a time, each block with the sample
+ * order to take batches in: a dataset held in memory is a single block per epoch, in the order
+ * of a shuffled permutation, while a streamed dataset is one block per chunk, which the stream
+ * has already shuffled. sampleIndices(start) gives the dataset index of each sample of the
+ * batch at start, which selects its augmentation, and saveState/restoreState checkpoint the
+ * order. Only resident sources are read through a batch prefetcher or a sparse copy, as those
+ * keep referring to the data across the whole epoch.
+ */
+
+/**
+ * @brief A training set held in memory, visited in a new random order every epoch.
+ *
+ * @tparam Data Eigen::MatrixXf or PixelMatrix; gatherBatch normalises the latter per batch.
+ */
+template <typename Data>
+class ResidentBatches {
+public:
+    static constexpr bool resident = true;
+
+    ResidentBatches(const Data& X, const Eigen::VectorXi& Y, std::optional<unsigned int> seed) : X_(X), Y_(Y), permutation_(static_cast<int>(X.cols()), seed) {}
+
+    int inputSize() const { return static_cast<int>(X_.rows()); }
+    int maxBlockSize() const { return static_cast<int>(X_.cols()); }
+
+    void startEpoch() {
+        permutation_.shuffle();
+        pending_ = true;
+    }
+    bool nextBlock() { return std::exchange(pending_, false); }
+    int blockSize() const { return static_cast<int>(X_.cols()); }
+
+    const Data& data() const { return X_; }
+    const Eigen::VectorXi& labels() const { return Y_; }
+    const DatasetPermutation& order() const { return permutation_; }
+    const int* sampleIndices(int start) const { return permutation_.indices().data() + start; }
+
+    // A resumed run continues from the sample order and shuffle generator of its checkpoint
+    void saveState(TrainingCheckpoint& snapshot) const {
+        snapshot.permutation = permutation_.indices();
+        snapshot.generatorState = permutation_.generatorState();
+    }
+    bool restoreState(const TrainingCheckpoint& saved) { return permutation_.restore(saved.permutation, saved.generatorState); }
+
+private:
+    const Data& X_;
+    const Eigen::VectorXi& Y_;
+    DatasetPermutation permutation_;
+    bool pending_ = false;
+};
+
+/**
+ * @brief A training set streamed from IDX files, one shuffled chunk at a time.
+ */
+class StreamedBatches {
+public:
+    static constexpr bool resident = false;
+
+    // Chunks arrive already shuffled, so batches are taken from them in order
+    explicit StreamedBatches(IdxStream& stream) : stream_(stream), chunkOrder_(stream.chunkSize()) {}
+
+    int inputSize() const { return stream_.sampleSize(); }
+    int maxBlockSize() const { return stream_.chunkSize(); }
+
+    void startEpoch() { stream_.startEpoch(true); }
+    bool nextBlock() { return stream_.next(); }
+    int blockSize() const { return stream_.chunkCount(); }
+
+    const PixelMatrix& data() const { return stream_.chunkData(); }
+    const Eigen::VectorXi& labels() const { return stream_.chunkLabels(); }
+    const DatasetPermutation& order() const { return chunkOrder_; }
+    const int* sampleIndices(int start) const { return stream_.chunkIndices().data() + start; }
+
+    // A resumed run continues from the chunk order and shuffle generator of its checkpoint
+    void saveState(TrainingCheckpoint& snapshot) {
+        snapshot.permutation = stream_.chunkOrder();
+        snapshot.generatorState = stream_.generatorState();
+    }
+    bool restoreState(const TrainingCheckpoint& saved) { return stream_.restore(saved.permutation, saved.generatorState); }
+
+private:
+    IdxStream& stream_;
+    DatasetPermutation chunkOrder_;
+};
+
+/**
+ * @brief Mini-batch training loop shared by the in-memory and streamed overloads of miniBatchGradientDescent.
+ *
+ * @tparam Source ResidentBatches or StreamedBatches.
+ * @tparam Validate Callable as validate(evaluator, params), returning the ValidationResult of the validation set.
+ */
+template <typename Source, typename Validate>
+static std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> trainMiniBatches(Source& source, Validate validate, const TrainingConfig& config){
+    NetworkParameters params = initNetworkParameters(config.seed);
+    std::unique_ptr<Optimizer> optimizer = makeOptimizer(config.optimizer, params);
+
+    const int inputSize = source.inputSize();
+    const int batchSize = std::max(1, std::min(config.batchSize, source.maxBlockSize()));
+
+    // Batch buffers and step workspace, reused for every step
+    Eigen::MatrixXf batchX(inputSize, batchSize);
+    Eigen::VectorXi batchY(batchSize);
+    TrainingWorkspace workspace(inputSize, params.W1.rows(), params.W2.rows(), batchSize);
+
+    // With several threads each batch is split into shards with their own buffers instead
+    std::unique_ptr<ThreadPool> pool;
+    std::unique_ptr<DataParallelStep> parallelStep;
+    if (config.numThreads > 1) {
+        pool = std::make_unique<ThreadPool>(config.numThreads);
+        parallelStep = std::make_unique<DataParallelStep>(*pool, inputSize, params.W1.rows(), params.W2.rows(), batchSize, optimizer.get(), config.augment);
+    }
+
+    // A resumed run continues from the parameters, optimizer and sample order of its last checkpoint
+    int firstEpoch = 0;
+    if (std::optional<TrainingCheckpoint> saved = resumeCheckpoint(config.checkpoint, inputSize, params.W1.rows(), params.W2.rows())) {
+        if (source.restoreState(*saved)) {
+            params.W1 = saved->W1;
+            params.b1 = saved->b1;
+            params.W2 = saved->W2;
+            params.b2 = saved->b2;
+            firstEpoch = saved->completed;
+            restoreOptimizer(*optimizer, saved->optimizerState, config.checkpoint.file);
+            std::cout << "Resuming from epoch " << firstEpoch << " of " << config.checkpoint.file << std::endl;
+        } else {
+            std::cerr << "Checkpoint " << config.checkpoint.file << " is for another training set, starting a new run" << std::endl;
+        }
+    }
+
+    std::unique_ptr<CheckpointWriter> checkpointWriter;
+    if (!config.checkpoint.file.empty() && config.checkpoint.interval > 0) {
+        checkpointWriter = std::make_unique<CheckpointWriter>(config.checkpoint.file);
+    }
+    TrainingCheckpoint snapshot;
+
+    // Otherwise, when the inputs are mostly zero, batches are gathered from a sparse copy of X built
+    // once here. This takes precedence over prefetching, as a sparse gather is cheaper than a dense one
+    // even when hidden behind training; augmented inputs are not sparse, so augmentation rules it out
+    std::optional<SparseInputMatrix> sparseX;
+    std::unique_ptr<SparseBatch> sparseBatch;
+    if (Source::resident && config.sparseInput && !parallelStep && !config.augment && inputDensity(source.data()) <= SPARSE_INPUT_MAX_DENSITY) {
+        sparseX = toSparseInput(source.data());
+        sparseBatch = std::make_unique<SparseBatch>(inputSize, batchSize);
+    }
+
+    // Or batches of a resident dataset can be gathered on a background thread, one step ahead of training
+    std::unique_ptr<BatchPrefetcher> prefetcher;
+    if (Source::resident && !parallelStep && !sparseBatch && (config.prefetch || config.augment)) {
+        prefetcher = std::make_unique<BatchPrefetcher>(source.data(), source.labels(), source.order(), batchSize, config.augment, firstEpoch);
+    }
+
+    TrainingTelemetry* telemetry = config.telemetry;
+
+    // Validation of the parameters after each epoch can run on a snapshot while the next epoch trains
+    Evaluator evaluator(params.W1.rows(), params.W2.rows());
+    std::unique_ptr<AsyncValidator> validator;
+    if (config.asyncValidation) {
+        validator = std::make_unique<AsyncValidator>(
+            [validate, evaluator](const NetworkParameters& snapshot) mutable {
+                return validate(evaluator, snapshot);
+            },
+            [](const ValidationResult& result) { printValidationResult("Epoch", result); });
+    }
+
+    for(int epoch = firstEpoch; epoch < config.epochs; epoch++){
+
+        if (telemetry) {
+            telemetry->startEpoch();
+        }
+        {
+            TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_SHUFFLE);
+            source.startEpoch();
+        }
+        if (prefetcher) {
+            prefetcher->resetStallCounters();
+        }
+        if (parallelStep) {
+            parallelStep->startEpoch(epoch);
+        }
+
+        int numBatches = 0;
+        int numCorrect = 0;
+        double totalLoss = 0.0;
+        std::size_t stepAllocations = 0;
+
+        while (true) {
+            {
+                // For a stream, waiting here means reading the chunk took longer than training on the previous one
+                TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_DATA);
+                if (!source.nextBlock()) {
+                    break;
+                }
+            }
+            const auto& X = source.data();
+            const Eigen::VectorXi& Y = source.labels();
+            const DatasetPermutation& order = source.order();
+            const int batchesInBlock = source.blockSize() / batchSize;
+            if (prefetcher) {
+                prefetcher->startEpoch(batchesInBlock);
+            }
+
+            for(int batch = 0; batch < batchesInBlock; batch++){
+
+                // The first step warms up anything allocated lazily; every step after it should not allocate
+                const bool warmUp = epoch == firstEpoch && numBatches == 0;
+                const std::size_t allocationsBefore = heapAllocationCount();
+
+                if (parallelStep) {
+                    parallelStep->run(params, X, Y, order, batch * batchSize, config.alpha, telemetry, source.sampleIndices(batch * batchSize));
+                    numCorrect += parallelStep->numCorrect();
+                    totalLoss += parallelStep->loss();
+                } else if (sparseBatch) {
+                    {
+                        TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_DATA);
+                        sparseBatch->gather(*sparseX, Y, order, batch * batchSize, batchY);
+                    }
+                    {
+                        TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_FORWARD);
+                        forwardPass(params, sparseBatch->matrix(), batchY, workspace);
+                    }
+                    {
+                        TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_BACKWARD);
+                        backwardPass(params, sparseBatch->matrix(), batchY, workspace);
+                    }
+                    {
+                        TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_UPDATE);
+                        optimizer->step(params, workspace, config.alpha);
+                    }
+                    numCorrect += countCorrectPredictions(workspace.A2, batchY);
+                    totalLoss += workspace.loss;
+                } else {
+                    const Eigen::MatrixXf* stepX = &batchX;
+                    const Eigen::VectorXi* stepY = &batchY;
+                    {
+                        TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_DATA);
+                        if (prefetcher) {
+                            const PrefetchedBatch& prefetched = prefetcher->next();
+                            stepX = &prefetched.X;
+                            stepY = &prefetched.Y;
+                        } else {
+                            gatherBatch(X, Y, order, batch * batchSize, batchX, batchY);
+                            if (config.augment) {
+                                config.augment(batchX, source.sampleIndices(batch * batchSize), epoch);
+                            }
+                        }
+                    }
+                    {
+                        TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_FORWARD);
+                        forwardPass(params, *stepX, *stepY, workspace);
+                    }
+                    {
+                        TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_BACKWARD);
+                        backwardPass(params, *stepX, *stepY, workspace);
+                    }
+                    {
+                        TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_UPDATE);
+                        optimizer->step(params, workspace, config.alpha);
+                    }
+                    numCorrect += countCorrectPredictions(workspace.A2, *stepY);
+                    totalLoss += workspace.loss;
+                }
+
+                if (!warmUp) {
+                    stepAllocations += heapAllocationCount() - allocationsBefore;
+                }
+                ++numBatches;
+            }
+        }
+
+        // Calculate accuracy on validation set, or hand a snapshot to the background validator
+        std::optional<double> valAccuracy;
+        {
+            TrainingTelemetry::PhaseTimer timer(telemetry, PHASE_VALIDATION);
+            if (validator) {
+                validator->submit(epoch + 1, NetworkView(params));
+            } else {
+                valAccuracy = validate(evaluator, params).accuracy;
+            }
+        }
+
+        if (checkpointWriter && checkpointDue(config.checkpoint, epoch + 1, config.epochs)) {
+            snapshot.W1 = params.W1;
+            snapshot.b1 = params.b1;
+            snapshot.W2 = params.W2;
+            snapshot.b2 = params.b2;
+            snapshot.optimizerState = optimizer->state();
+            snapshot.completed = epoch + 1;
+            source.saveState(snapshot);
+            checkpointWriter->submit(snapshot);
+        }
+
+        // Training accuracy is accumulated over the batches seen during the epoch
+        const long long samples = static_cast<long long>(numBatches) * batchSize;
+        double accuracy = samples > 0 ? static_cast<double>(numCorrect) / samples : 0.0;
+        double loss = numBatches > 0 ? totalLoss / numBatches : 0.0;
+        std::ostringstream line;
+        line << "Epoch: " << epoch+1 << ", Loss: " << loss << ", Accuracy: " << accuracy;
+        if (valAccuracy) {
+            line << ", Validation Accuracy: " << *valAccuracy;
+        }
+        if (heapAllocationCountingSupported()) {
+            line << ", Step Allocations: " << stepAllocations;
+        }
+        if (prefetcher) {
+            // Input stall: training waited for data. Loader stall: data waited for training
+            line << ", Input Stall: " << prefetcher->inputStallSeconds() << "s, Loader Stall: " << prefetcher->loaderStallSeconds() << "s";
+        }
+        std::cout << line.str() << std::endl;
+
+        if (telemetry) {
+            // With background validation this is the latest finished result, usually of an earlier epoch
+            std::optional<ValidationResult> validation = validator ? validator->latest() : std::nullopt;
+            double recordedAccuracy = valAccuracy ? *valAccuracy : (validation ? validation->accuracy : 0.0);
+            telemetry->endEpoch({epoch + 1, samples, loss, accuracy, recordedAccuracy});
+        }
+    }
+
+    if (validator) {
+        validator->wait();
+    }
+
+    return std::make_tuple(params.W1, params.b1, params.W2, params.b2);
+}
+
+/**
+ * @brief Perform mini-batch stochastic gradient descent for the neural network.
+ *
+ * Each epoch shuffles a permutation of the sample indices and then walks through it in batches
+ * of config.batchSize columns, gathering each batch into buffers that are allocated once up
+ * front and reused for every step. The data matrix itself is never copied or reordered.
+ * If the number of samples is not a multiple of the batch size, the trailing partial batch of
+ * each epoch is skipped; since the order changes every epoch those samples are still seen in other epochs.
+ * On a single thread without augmentation, with config.sparseInput, inputs that are at most
+ * SPARSE_INPUT_MAX_DENSITY non-zero (MNIST is about 20%) are copied once into CSC form and
+ * batches are gathered from it, so the first layer only touches the non-zero pixels.
+ * Otherwise with config.prefetch (or an augmentation hook) on a single thread, batches are
+ * gathered by a BatchPrefetcher one step ahead, and the epoch report includes its stall times.
+ * With several threads, config.augment is applied to each shard of a batch once it is gathered.
+ * With config.asyncValidation, the validation accuracy of each epoch is computed on a copy of
+ * the parameters on a background thread and printed on its own line when ready.
+ * With config.telemetry, each epoch's phase timings, throughput, loss and peak memory are
+ * also written as a structured record.
+ * The gradients are applied in place by config.optimizer: plain SGD, momentum, Nesterov or Adam.
+ * With config.checkpoint, the parameters, optimizer state, sample order and shuffle generator are
+ * written to a checkpoint file in the background every few epochs, and a run can resume from it exactly.
+ *
+ * @param X The input data matrix.
+ * @param Y The vector of true class labels.
+ * @param valX The validation data matrix.
+ * @param valY The vector of validation class labels.
+ * @param config The learning rate, number of epochs, batch size, optional shuffle seed,
+ *               number of threads each batch is split across, prefetching, validation, telemetry and checkpoint options.
+ *
+ * @return A tuple containing the optimized parameters:
+ *         - W1: The optimized weight matrix for the first layer.
+ *         - b1: The optimized bias vector for the first layer.
+ *         - W2: The optimized weight matrix for the second layer.
+ *         - b2: The optimized bias vector for the second layer.
+ */
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> miniBatchGradientDescent(const Eigen::MatrixXf& X,const Eigen::VectorXi& Y,const Eigen::MatrixXf& valX,const Eigen::VectorXi& valY, const TrainingConfig& config){
+    ResidentBatches<Eigen::MatrixXf> batches(X, Y, config.seed);
+    return trainMiniBatches(batches, [&valX, &valY](Evaluator& evaluator, const NetworkParameters& params) {
+        return validateSnapshot(evaluator, params, valX, valY);
+    }, config);
+}
+
+/**
+ * @brief Perform mini-batch stochastic gradient descent on a dataset kept as raw 8-bit pixels.
+ *
+ * Identical to the float overload, except that each batch is normalised as it is gathered
+ * and validation runs in chunks, so the datasets stay resident at one byte per pixel.
+ *
+ * @param X The input data as raw pixels.
+ * @param Y The vector of true class labels.
+ * @param valX The validation data as raw pixels.
+ * @param valY The vector of validation class labels.
+ * @param config The learning rate, number of epochs, batch size and optional shuffle seed.
+ *
+ * @return A tuple containing the optimized parameters W1, b1, W2 and b2.
+ */
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> miniBatchGradientDescent(const PixelMatrix& X,const Eigen::VectorXi& Y,const PixelMatrix& valX,const Eigen::VectorXi& valY, const TrainingConfig& config){
+    ResidentBatches<PixelMatrix> batches(X, Y, config.seed);
+    return trainMiniBatches(batches, [&valX, &valY](Evaluator& evaluator, const NetworkParameters& params) {
+        return validateSnapshot(evaluator, params, valX, valY);
+    }, config);
+}
+
+/**
+ * @brief Perform mini-batch stochastic gradient descent on datasets streamed from IDX files.
+ *
+ * Only the stream's chunks are resident, so the training set may be larger than memory. Each
+ * epoch visits the chunks in a new random order, with the samples of each chunk shuffled, and
+ * walks through every chunk in batches that are normalised as they are gathered; that order
+ * comes from the stream, so construct it with config.seed for a reproducible run. The next chunk is read in the background while the
+ * current one trains, so no batch prefetcher or sparse copy is used and config.prefetch and
+ * config.sparseInput are ignored; config.augment is applied to each batch as it is gathered,
+ * keyed by the samples' indices in the file. Checkpoints hold the stream's chunk order and
+ * shuffle generator instead of a sample permutation, so a resumed run continues exactly. The trailing partial
+ * batch of each chunk is skipped, so the chunk size should be a multiple of the batch size.
+ * Otherwise the training loop is the one of the in-memory overloads.
+ *
+ * @param training The training set.
+ * @param validation The validation set, read once per epoch.
+ * @param config The learning rate, number of epochs, batch size, number of threads, validation, telemetry and checkpoint options.
+ *
+ * @return A tuple containing the optimized parameters W1, b1, W2 and b2.
+ */
+std::tuple<Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf, Eigen::MatrixXf> miniBatchGradientDescent(IdxStream& training, IdxStream& validation, const TrainingConfig& config){
+    StreamedBatches batches(training);
+    return trainMiniBatches(batches, [&validation](Evaluator& evaluator, const NetworkParameters& params) {
+        return validateSnapshot(evaluator, params, validation);
+    }, config);
+}
+
 /**
  * @brief Run an image through the neural network and obtain the output.
  *
@@ -0,0 +1,246 @@
+#include "../include/optimizer.h"
+#include "../include/neural_network.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Elements updated together: small enough that a tile of parameters, gradients and state stays
+// in L1 cache between the statements of a kernel, large enough to vectorise well
+static const Eigen::Index TILE_SIZE = 512;
+
+/**
+ * @brief Run a kernel over an array one tile at a time.
+ *
+ * A kernel of several array statements then touches memory as if it were a single fused loop:
+ * each tile is loaded from memory once, and later statements find it in cache.
+ *
+ * @param size The number of elements.
+ * @param kernel Called with the start and length of each tile.
+ */
+template <typename Kernel>
+static void forEachTile(Eigen::Index size, Kernel kernel) {
+    for (Eigen::Index start = 0; start < size; start += TILE_SIZE) {
+        kernel(start, std::min(TILE_SIZE, size - start));
+    }
+}
+
+/**
+ * @brief Update the parameters of a two-layer network from the gradients of a training step.
+ *
+ * @param params The parameters, updated in place.
+ * @param workspace The workspace filled by computeGradients.
+ * @param alpha The learning rate.
+ */
+void Optimizer::step(NetworkParameters& params, const TrainingWorkspace& workspace, float alpha) {
+    beginStep();
+    update(0, params.W1.data(), workspace.dW1.data(), alpha);
+    update(1, params.b1.data(), workspace.db1.data(), alpha);
+    update(2, params.W2.data(), workspace.dW2.data(), alpha);
+    update(3, params.b2.data(), workspace.db2.data(), alpha);
+}
+
+/**
+ * @brief Plain gradient descent step on one slot.
+ *
+ * @param slot The index of the parameter array.
+ * @param parameters The parameters, updated in place.
+ * @param gradients Their gradients.
+ * @param alpha The learning rate.
+ */
+void SgdOptimizer::update(int slot, float* parameters, const float* gradients, float alpha) {
+    const Eigen::Index size = slotSizes_[slot];
+    Eigen::Map<Eigen::ArrayXf>(parameters, size) -= alpha * Eigen::Map<const Eigen::ArrayXf>(gradients, size);
+}
+
+/**
+ * @brief Allocate a zero velocity for every slot.
+ *
+ * @param slotSizes The number of elements of each parameter array.
+ * @param momentum The decay of the velocity, typically 0.9.
+ * @param nesterov Whether to step with the Nesterov look-ahead.
+ */
+MomentumOptimizer::MomentumOptimizer(std::vector<Eigen::Index> slotSizes, float momentum, bool nesterov)
+    : Optimizer(std::move(slotSizes)), momentum_(momentum), nesterov_(nesterov) {
+    for (Eigen::Index size : slotSizes_) {
+        velocity_.push_back(Eigen::VectorXf::Zero(size));
+    }
+}
+
+/**
+ * @brief Momentum step on one slot: the velocity and the parameters are updated in one pass.
+ *
+ * @param slot The index of the parameter array.
+ * @param parameters The parameters, updated in place.
+ * @param gradients Their gradients.
+ * @param alpha The learning rate.
+ */
+void MomentumOptimizer::update(int slot, float* parameters, const float* gradients, float alpha) {
+    float* velocity = velocity_[slot].data();
+    forEachTile(slotSizes_[slot], [&](Eigen::Index start, Eigen::Index count) {
+        Eigen::Map<Eigen::ArrayXf> p(parameters + start, count);
+        Eigen::Map<const Eigen::ArrayXf> g(gradients + start, count);
+        Eigen::Map<Eigen::ArrayXf> v(velocity + start, count);
+
+        v = momentum_ * v + g;
+        if (nesterov_) {
+            p -= alpha * (g + momentum_ * v);
+        } else {
+            p -= alpha * v;
+        }
+    });
+}
+
+/**
+ * @brief The velocity of every slot, tagged as momentum or Nesterov.
+ *
+ * @return One column vector per slot.
+ */
+OptimizerState MomentumOptimizer::state() const {
+    return {type(), 0, std::vector<Eigen::MatrixXf>(velocity_.begin(), velocity_.end())};
+}
+
+/**
+ * @brief Restore the velocities saved by state().
+ *
+ * @param state The state of an optimizer of the same type, one column vector per slot.
+ * @return Whether the state matched the type and slots; the optimizer is unchanged otherwise.
+ */
+bool MomentumOptimizer::restoreState(const OptimizerState& state) {
+    if (state.type != type() || state.buffers.size() != velocity_.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < state.buffers.size(); ++i) {
+        if (state.buffers[i].size() != slotSizes_[i]) {
+            return false;
+        }
+    }
+    for (std::size_t i = 0; i < state.buffers.size(); ++i) {
+        velocity_[i] = state.buffers[i].reshaped();
+    }
+    return true;
+}
+
+/**
+ * @brief Allocate zero moment estimates for every slot.
+ *
+ * @param slotSizes The number of elements of each parameter array.
+ * @param beta1 The decay of the mean of the gradients, typically 0.9.
+ * @param beta2 The decay of the mean of the squared gradients, typically 0.999.
+ * @param epsilon Added to the root of the second moment, typically 1e-8.
+ */
+AdamOptimizer::AdamOptimizer(std::vector<Eigen::Index> slotSizes, float beta1, float beta2, float epsilon)
+    : Optimizer(std::move(slotSizes)), beta1_(beta1), beta2_(beta2), epsilon_(epsilon) {
+    for (Eigen::Index size : slotSizes_) {
+        mean_.push_back(Eigen::VectorXf::Zero(size));
+        squaredMean_.push_back(Eigen::VectorXf::Zero(size));
+    }
+}
+
+/**
+ * @brief Advance the step count and the bias corrections that depend on it.
+ */
+void AdamOptimizer::beginStep() {
+    ++steps_;
+    correction1_ = 1.0f - std::pow(beta1_, static_cast<float>(steps_));
+    correction2_ = 1.0f - std::pow(beta2_, static_cast<float>(steps_));
+}
+
+/**
+ * @brief Adam step on one slot: both moments and the parameters are updated in one pass.
+ *
+ * The bias corrections are applied to the step size and epsilon once per step instead of to
+ * every moment (Kingma and Ba, section 2):
+ *     p -= alpha * sqrt(c2) / c1 * m / (sqrt(v) + epsilon * sqrt(c2))
+ *
+ * @param slot The index of the parameter array.
+ * @param parameters The parameters, updated in place.
+ * @param gradients Their gradients.
+ * @param alpha The learning rate.
+ */
+void AdamOptimizer::update(int slot, float* parameters, const float* gradients, float alpha) {
+    const float stepSize = alpha * std::sqrt(correction2_) / correction1_;
+    const float epsilon = epsilon_ * std::sqrt(correction2_);
+    float* mean = mean_[slot].data();
+    float* squaredMean = squaredMean_[slot].data();
+
+    forEachTile(slotSizes_[slot], [&](Eigen::Index start, Eigen::Index count) {
+        Eigen::Map<Eigen::ArrayXf> p(parameters + start, count);
+        Eigen::Map<const Eigen::ArrayXf> g(gradients + start, count);
+        Eigen::Map<Eigen::ArrayXf> m(mean + start, count);
+        Eigen::Map<Eigen::ArrayXf> v(squaredMean + start, count);
+
+        m = beta1_ * m + (1.0f - beta1_) * g;
+        v = beta2_ * v + (1.0f - beta2_) * g.square();
+        p -= stepSize * m / (v.sqrt() + epsilon);
+    });
+}
+
+/**
+ * @brief The moment estimates of every slot and the step count.
+ *
+ * @return The first moments, then the second moments, one column vector per slot.
+ */
+OptimizerState AdamOptimizer::state() const {
+    OptimizerState state{type(), steps_, std::vector<Eigen::MatrixXf>(mean_.begin(), mean_.end())};
+    state.buffers.insert(state.buffers.end(), squaredMean_.begin(), squaredMean_.end());
+    return state;
+}
+
+/**
+ * @brief Restore the moments and step count saved by state().
+ *
+ * @param state The state of an Adam optimizer with the same slots.
+ * @return Whether the state matched the type and slots; the optimizer is unchanged otherwise.
+ */
+bool AdamOptimizer::restoreState(const OptimizerState& state) {
+    const std::size_t numSlots = slotSizes_.size();
+    if (state.type != type() || state.buffers.size() != 2 * numSlots) {
+        return false;
+    }
+    for (std::size_t i = 0; i < numSlots; ++i) {
+        if (state.buffers[i].size() != slotSizes_[i] || state.buffers[numSlots + i].size() != slotSizes_[i]) {
+            return false;
+        }
+    }
+
+    for (std::size_t i = 0; i < numSlots; ++i) {
+        mean_[i] = state.buffers[i].reshaped();
+        squaredMean_[i] = state.buffers[numSlots + i].reshaped();
+    }
+    steps_ = state.steps;
+    correction1_ = 1.0f - std::pow(beta1_, static_cast<float>(steps_));
+    correction2_ = 1.0f - std::pow(beta2_, static_cast<float>(steps_));
+    return true;
+}
+
+/**
+ * @brief Create an optimizer for parameter arrays of the given sizes.
+ *
+ * @param config The optimizer type and its hyperparameters.
+ * @param slotSizes The number of elements of each parameter array, in update order.
+ * @return The optimizer, with its state allocated.
+ */
+std::unique_ptr<Optimizer> makeOptimizer(const OptimizerConfig& config, std::vector<Eigen::Index> slotSizes) {
+    switch (config.type) {
+        case OPTIMIZER_MOMENTUM:
+            return std::make_unique<MomentumOptimizer>(std::move(slotSizes), config.momentum, false);
+        case OPTIMIZER_NESTEROV:
+            return std::make_unique<MomentumOptimizer>(std::move(slotSizes), config.momentum, true);
+        case OPTIMIZER_ADAM:
+            return std::make_unique<AdamOptimizer>(std::move(slotSizes), config.beta1, config.beta2, config.epsilon);
+        case OPTIMIZER_SGD:
+        default:
+            return std::make_unique<SgdOptimizer>(std::move(slotSizes));
+    }
+}
+
+/**
+ * @brief Create an optimizer for a two-layer network, with slots W1, b1, W2 and b2.
+ *
+ * @param config The optimizer type and its hyperparameters.
+ * @param params The network; only the shapes are used.
+ * @return The optimizer, ready for Optimizer::step.
+ */
+std::unique_ptr<Optimizer> makeOptimizer(const OptimizerConfig& config, const NetworkParameters& params) {
+    return makeOptimizer(config, {params.W1.size(), params.b1.size(), params.W2.size(), params.b2.size()});
+}
@@ -3,64 +3,15 @@
 #include "Eigen/Dense"
 
 #include "../include/parameter_handler.h"
+#include "../include/model_format.h"
 
 /**
- * @brief Save neural network parameters to a file
- *
- * This function saves the parameters of a neural network to a binary file,
- * including the weight matrices and bias vectors of each layer.
- *
- * @param W1 Weight matrix for the first layer.
- * @param b1 Bias vector for the first layer.
- * @param W2 Weight matrix for the second layer.
- * @param b2 Bias vector for the second layer.
- * @param filename Name of the file to save the parameters.
- */
-void saveParameters(const Eigen::MatrixXf& W1, const Eigen::VectorXf& b1, const Eigen::MatrixXf& W2, const Eigen::VectorXf& b2, const std::string& filename) {
-    std::ofstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Error opening file: " << filename << std::endl;
-        return;
-    }
-
-    // Write matrix dimensions
-    int rows_W1 = W1.rows(), cols_W1 = W1.cols();
-    int rows_W2 = W2.rows(), cols_W2 = W2.cols();
-    int rows_b1 = b1.rows();
-    int rows_b2 = b2.rows();
-
-    file.write(reinterpret_cast<const char*>(&rows_W1), sizeof(int));
-    file.write(reinterpret_cast<const char*>(&cols_W1), sizeof(int));
-    file.write(reinterpret_cast<const char*>(&rows_W2), sizeof(int));
-    file.write(reinterpret_cast<const char*>(&cols_W2), sizeof(int));
-    file.write(reinterpret_cast<const char*>(&rows_b1), sizeof(int));
-    file.write(reinterpret_cast<const char*>(&rows_b2), sizeof(int));
-
-    // Write matrix data
-    file.write(reinterpret_cast<const char*>(W1.data()), sizeof(float) * W1.size());
-    file.write(reinterpret_cast<const char*>(W2.data()), sizeof(float) * W2.size());
-    file.write(reinterpret_cast<const char*>(b1.data()), sizeof(float) * b1.size());
-    file.write(reinterpret_cast<const char*>(b2.data()), sizeof(float) * b2.size());
-
-    file.close();
-}
-
-/**
- * @brief Load neural network parameters from a file
- *
- * This function reads neural network parameters from a binary file,
- * including the weight matrices and bias vectors of each layer.
+ * @brief Load neural network parameters from a file in the original headerless format
  *
  * @param filename Name of the file containing the parameters.
- * @return A tuple containing the loaded parameters:
- *         - Weight matrix for the first layer.
- *         - Bias vector for the first layer.
- *         - Weight matrix for the second layer.
- *         - Bias vector for the second layer.
- * If the file fails to open or there's an error during reading,
- * empty matrices and vectors are returned.
+ * @return A tuple of W1, b1, W2 and b2, or empty matrices and vectors if the file cannot be read.
  */
-std::tuple<Eigen::MatrixXf, Eigen::VectorXf, Eigen::MatrixXf, Eigen::VectorXf>loadParameters(const std::string& filename) {
+static std::tuple<Eigen::MatrixXf, Eigen::VectorXf, Eigen::MatrixXf, Eigen::VectorXf> loadLegacyParameters(const std::string& filename) {
     Eigen::MatrixXf W1, W2;
     Eigen::VectorXf b1, b2;
 
@@ -78,6 +29,10 @@ std::tuple<Eigen::MatrixXf, Eigen::VectorXf, Eigen::MatrixXf, Eigen::VectorXf>lo
     file.read(reinterpret_cast<char*>(&cols_W2), sizeof(int));
     file.read(reinterpret_cast<char*>(&rows_b1), sizeof(int));
     file.read(reinterpret_cast<char*>(&rows_b2), sizeof(int));
+    if (!file || rows_W1 <= 0 || cols_W1 <= 0 || rows_W2 <= 0 || cols_W2 <= 0 || rows_b1 <= 0 || rows_b2 <= 0) {
+        std::cerr << "Invalid model file: " << filename << std::endl;
+        return std::make_tuple(W1, b1, W2, b2);
+    }
 
     // Resize matrices and vectors
     W1.resize(rows_W1, cols_W1);
@@ -90,7 +45,206 @@ std::tuple<Eigen::MatrixXf, Eigen::VectorXf, Eigen::MatrixXf, Eigen::VectorXf>lo
     file.read(reinterpret_cast<char*>(W2.data()), sizeof(float) * W2.size());
     file.read(reinterpret_cast<char*>(b1.data()), sizeof(float) * b1.size());
     file.read(reinterpret_cast<char*>(b2.data()), sizeof(float) * b2.size());
+    if (!file) {
+        std::cerr << "Model file is truncated: " << filename << std::endl;
+        return std::make_tuple(Eigen::MatrixXf(), Eigen::VectorXf(), Eigen::MatrixXf(), Eigen::VectorXf());
+    }
 
     file.close();
     return std::make_tuple(W1, b1, W2, b2);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Save neural network parameters to a file
+ *
+ * The parameters are written as a version 2 model file (see model_format.h): a header
+ * with a magic number, version, byte order marker and checksum, one descriptor per
+ * tensor, and the weight matrices and bias vectors on 64-byte boundaries.
+ *
+ * @param W1 Weight matrix for the first layer.
+ * @param b1 Bias vector for the first layer.
+ * @param W2 Weight matrix for the second layer.
+ * @param b2 Bias vector for the second layer.
+ * @param filename Name of the file to save the parameters.
+ * @return Whether the file was written; an existing file is left untouched otherwise.
+ */
+bool saveParameters(const Eigen::MatrixXf& W1, const Eigen::VectorXf& b1, const Eigen::MatrixXf& W2, const Eigen::VectorXf& b2, const std::string& filename) {
+    return saveModelFile({{"W1", W1.data(), W1.rows(), W1.cols()},
+                   {"b1", b1.data(), b1.rows(), 1},
+                   {"W2", W2.data(), W2.rows(), W2.cols()},
+                   {"b2", b2.data(), b2.rows(), 1}}, filename);
+}
+
+/**
+ * @brief Load neural network parameters from a file
+ *
+ * Reads version 2 model files, checking their structure and checksum, as well as the
+ * headerless files written by earlier versions (six ints giving the shapes of W1, W2,
+ * b1 and b2, followed by their data).
+ *
+ * @param filename Name of the file containing the parameters.
+ * @return A tuple containing the loaded parameters:
+ *         - Weight matrix for the first layer.
+ *         - Bias vector for the first layer.
+ *         - Weight matrix for the second layer.
+ *         - Bias vector for the second layer.
+ * If the file fails to open or there's an error during reading,
+ * empty matrices and vectors are returned.
+ */
+std::tuple<Eigen::MatrixXf, Eigen::VectorXf, Eigen::MatrixXf, Eigen::VectorXf>loadParameters(const std::string& filename) {
+    Eigen::MatrixXf W1, W2;
+    Eigen::VectorXf b1, b2;
+
+    ModelFile model(filename);
+    if (model.hasModelHeader()) {
+        if (!model.isValid()) {
+            return std::make_tuple(W1, b1, W2, b2);
+        }
+        if (!model.hasNetwork()) {
+            std::cerr << "Model file does not contain a two-layer network: " << filename << std::endl;
+            return std::make_tuple(W1, b1, W2, b2);
+        }
+        NetworkView network = model.network();
+        return std::make_tuple(Eigen::MatrixXf(network.W1), Eigen::VectorXf(network.b1), Eigen::MatrixXf(network.W2), Eigen::VectorXf(network.b2));
+    }
+
+    return loadLegacyParameters(filename);
+}
+
+/**
+ * @brief The name of a tensor of one dense layer of a layer stack in a model file.
+ *
+ * @param layer The layer index.
+ * @param part "weights" or "bias".
+ * @return E.g. "layer0.weights".
+ */
+static std::string layerTensorName(int layer, const char* part) {
+    return "layer" + std::to_string(layer) + "." + part;
+}
+
+/**
+ * @brief Save a layer stack of any width and depth to a file
+ *
+ * The network is written as a version 2 model file (see model_format.h), with the same
+ * checksum and atomic replacement as saveParameters. Besides a weights and a bias tensor per
+ * dense layer ("layer<i>.weights", "layer<i>.bias"), it holds two uint32 tensors describing
+ * the network: "input_size", and "layers" with the type and units of each layer as its columns.
+ *
+ * @param stack The network to save.
+ * @param filename Name of the file to save the network.
+ * @return Whether the file was written; an existing file is left untouched otherwise.
+ */
+bool saveLayerStack(const LayerStack& stack, const std::string& filename) {
+    const std::uint32_t inputSize = static_cast<std::uint32_t>(stack.inputSize());
+    WordMatrix layers(2, stack.numLayers());
+    for (int i = 0; i < stack.numLayers(); ++i) {
+        layers(0, i) = static_cast<std::uint32_t>(stack.layers()[i].type);
+        layers(1, i) = static_cast<std::uint32_t>(stack.layers()[i].units);
+    }
+
+    std::vector<ModelTensor> tensors = {{"input_size", &inputSize, 1, 1, TENSOR_UINT32},
+                                        {"layers", layers.data(), layers.rows(), layers.cols(), TENSOR_UINT32}};
+    for (int i = 0; i < stack.numLayers(); ++i) {
+        if (stack.layers()[i].type == DENSE) {
+            Eigen::Map<const Eigen::MatrixXf> W = stack.weights(i);
+            Eigen::Map<const Eigen::VectorXf> b = stack.bias(i);
+            tensors.push_back({layerTensorName(i, "weights"), W.data(), W.rows(), W.cols()});
+            tensors.push_back({layerTensorName(i, "bias"), b.data(), b.rows(), 1});
+        }
+    }
+    return saveModelFile(tensors, filename);
+}
+
+/**
+ * @brief Build a layer stack from the tensors of a version 2 model file.
+ *
+ * @param model A valid model file with "input_size" and "layers" tensors.
+ * @param filename The file name, for error messages.
+ * @return The network, or nothing if the description is invalid or a layer's tensors are missing or misshapen.
+ */
+static std::optional<LayerStack> layerStackFromModelFile(const ModelFile& model, const std::string& filename) {
+    Eigen::Map<const WordMatrix> inputSize = model.words("input_size");
+    Eigen::Map<const WordMatrix> description = model.words("layers");
+    if (inputSize.size() != 1 || inputSize(0) > static_cast<std::uint32_t>(MAX_LAYER_STACK_WIDTH) ||
+        description.rows() != 2 || description.cols() > MAX_LAYER_STACK_LAYERS) {
+        std::cerr << "Invalid layer stack description in " << filename << std::endl;
+        return std::nullopt;
+    }
+
+    std::vector<LayerSpec> layers(description.cols());
+    for (Eigen::Index i = 0; i < description.cols(); ++i) {
+        if (description(0, i) > SOFTMAX || description(1, i) > static_cast<std::uint32_t>(MAX_LAYER_STACK_WIDTH)) {
+            std::cerr << "Invalid layer description in " << filename << std::endl;
+            return std::nullopt;
+        }
+        layers[i].type = static_cast<LayerType>(description(0, i));
+        layers[i].units = static_cast<int>(description(1, i));
+    }
+    const std::string error = validateLayerStack(static_cast<int>(inputSize(0)), layers);
+    if (!error.empty()) {
+        std::cerr << "Invalid layer stack in " << filename << ": " << error << std::endl;
+        return std::nullopt;
+    }
+
+    // Check every tensor before building the network, so nothing is allocated for a bad file
+    int inputs = static_cast<int>(inputSize(0));
+    for (int i = 0; i < static_cast<int>(layers.size()); ++i) {
+        if (layers[i].type != DENSE) {
+            continue;
+        }
+        Eigen::Map<const Eigen::MatrixXf> W = model.matrix(layerTensorName(i, "weights"));
+        Eigen::Map<const Eigen::MatrixXf> b = model.matrix(layerTensorName(i, "bias"));
+        if (W.rows() != layers[i].units || W.cols() != inputs || b.rows() != layers[i].units || b.cols() != 1) {
+            std::cerr << "Missing or misshapen tensors for layer " << i << " in " << filename << std::endl;
+            return std::nullopt;
+        }
+        inputs = layers[i].units;
+    }
+
+    LayerStack stack(static_cast<int>(inputSize(0)), layers, 0u);
+    for (int i = 0; i < stack.numLayers(); ++i) {
+        if (layers[i].type == DENSE) {
+            stack.weights(i) = model.matrix(layerTensorName(i, "weights"));
+            stack.bias(i) = model.matrix(layerTensorName(i, "bias")).col(0);
+        }
+    }
+    return stack;
+}
+
+/**
+ * @brief Load a layer stack from a file
+ *
+ * Reads files written by saveLayerStack, checking their structure and checksum. Files written
+ * by saveParameters, in either format, are also accepted and loaded as the two-layer network
+ * they describe. The layer list is checked with validateLayerStack and the tensor shapes
+ * against it before the network is built, so a malformed file is rejected without
+ * allocating for it.
+ *
+ * @param filename Name of the file containing the network.
+ * @return The network, or nothing if the file cannot be opened or is malformed.
+ */
+std::optional<LayerStack> loadLayerStack(const std::string& filename) {
+    {
+        ModelFile model(filename);
+        if (model.hasModelHeader()) {
+            if (!model.isValid()) {
+                return std::nullopt;
+            }
+            if (model.findTensor("layers") != nullptr) {
+                return layerStackFromModelFile(model, filename);
+            }
+        }
+    }
+
+    // A two-layer model, in either format
+    NetworkParameters params;
+    std::tie(params.W1, params.b1, params.W2, params.b2) = loadParameters(filename);
+    if (params.W1.size() == 0) {
+        return std::nullopt;
+    }
+    if (params.b1.size() != params.W1.rows() || params.W2.cols() != params.W1.rows() || params.b2.size() != params.W2.rows()) {
+        std::cerr << "Model file layers do not fit together: " << filename << std::endl;
+        return std::nullopt;
+    }
+    return LayerStack(params);
+}
@@ -0,0 +1,275 @@
+#include "../include/quantization.h"
+#include "../include/helpers.h"
+#include "../include/inference_engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+// "NCQ8" in the first four bytes identifies a quantized model file
+static const int32_t QUANTIZED_MODEL_MAGIC = 0x3851434e;
+
+// Largest layer width or input size accepted from a quantized model file
+static const int32_t MAX_QUANTIZED_DIMENSION = 1 << 20;
+
+// Largest input size whose integer dot products cannot overflow the int32 accumulator of
+// dotInt16: every product of an int8 weight and a pixel is at most 128 * 255 in magnitude
+static const int32_t MAX_QUANTIZED_INPUT_SIZE = INT32_MAX / (128 * 255);
+
+/**
+ * @brief Quantize a weight matrix to int8 with one scale per row.
+ *
+ * Symmetric quantization: each row is scaled so that its largest absolute weight maps to
+ * 127, and weights are rounded to the nearest integer. A row of zeros gets a scale of 1.
+ *
+ * @param weights The float weight matrix.
+ * @param quantized Receives the int8 weights.
+ * @param scales Receives the scale of each row, so that weights(i, j) ~ quantized(i, j) * scales(i).
+ */
+static void quantizeRows(const Eigen::MatrixXf& weights, QuantizedWeights& quantized, Eigen::VectorXf& scales) {
+    quantized.resize(weights.rows(), weights.cols());
+    scales.resize(weights.rows());
+
+    for (Eigen::Index i = 0; i < weights.rows(); ++i) {
+        float maxAbs = weights.row(i).cwiseAbs().maxCoeff();
+        scales(i) = maxAbs > 0.0f ? maxAbs / 127.0f : 1.0f;
+
+        for (Eigen::Index j = 0; j < weights.cols(); ++j) {
+            float value = std::round(weights(i, j) / scales(i));
+            quantized(i, j) = static_cast<int8_t>(std::clamp(value, -127.0f, 127.0f));
+        }
+    }
+}
+
+/**
+ * @brief Post-training quantization of a trained network.
+ *
+ * Converts W1 and W2 to int8 with per-row scales. Biases are tiny and stay float.
+ *
+ * @param params The float parameters, as produced by training or loadParameters.
+ * @return The quantized model.
+ */
+QuantizedModel quantizeParameters(const NetworkParameters& params) {
+    QuantizedModel model;
+    quantizeRows(params.W1, model.W1, model.W1Scales);
+    quantizeRows(params.W2, model.W2, model.W2Scales);
+    model.b1 = params.b1;
+    model.b2 = params.b2;
+    return model;
+}
+
+/**
+ * @brief Save a quantized model to a file.
+ *
+ * The file starts with a magic number and the matrix dimensions, followed by the int8
+ * weights (row-major) and the float scales and biases.
+ *
+ * @param model The quantized model.
+ * @param filename Name of the file to save the model to.
+ */
+void saveQuantizedParameters(const QuantizedModel& model, const std::string& filename) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return;
+    }
+
+    int32_t header[5] = {QUANTIZED_MODEL_MAGIC, static_cast<int32_t>(model.W1.rows()), static_cast<int32_t>(model.W1.cols()),
+                         static_cast<int32_t>(model.W2.rows()), static_cast<int32_t>(model.W2.cols())};
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    file.write(reinterpret_cast<const char*>(model.W1.data()), model.W1.size());
+    file.write(reinterpret_cast<const char*>(model.W2.data()), model.W2.size());
+    file.write(reinterpret_cast<const char*>(model.W1Scales.data()), sizeof(float) * model.W1Scales.size());
+    file.write(reinterpret_cast<const char*>(model.b1.data()), sizeof(float) * model.b1.size());
+    file.write(reinterpret_cast<const char*>(model.W2Scales.data()), sizeof(float) * model.W2Scales.size());
+    file.write(reinterpret_cast<const char*>(model.b2.data()), sizeof(float) * model.b2.size());
+
+    file.close();
+}
+
+/**
+ * @brief Load a quantized model from a file.
+ *
+ * The dimensions in the header are checked before anything is allocated: they must be
+ * positive and at most MAX_QUANTIZED_DIMENSION, the input size at most MAX_QUANTIZED_INPUT_SIZE,
+ * the layers must fit together, and the file must be exactly as long as they imply.
+ *
+ * @param filename Name of the file written by saveQuantizedParameters.
+ * @return The quantized model. If the file fails to open or is not a valid quantized model,
+ *         a model with empty matrices is returned.
+ */
+QuantizedModel loadQuantizedParameters(const std::string& filename) {
+    QuantizedModel model;
+
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return model;
+    }
+    const std::streamoff fileSize = file.tellg();
+    file.seekg(0);
+
+    int32_t header[5];
+    if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != QUANTIZED_MODEL_MAGIC) {
+        std::cerr << "Not a quantized model file: " << filename << std::endl;
+        return model;
+    }
+
+    const int64_t hiddenSize = header[1], inputSize = header[2], outputSize = header[3], W2Inputs = header[4];
+    for (int i = 1; i < 5; ++i) {
+        if (header[i] <= 0 || header[i] > MAX_QUANTIZED_DIMENSION) {
+            std::cerr << "Invalid quantized model dimensions in " << filename << std::endl;
+            return model;
+        }
+    }
+    if (inputSize > MAX_QUANTIZED_INPUT_SIZE) {
+        std::cerr << "Quantized model input size " << inputSize << " exceeds " << MAX_QUANTIZED_INPUT_SIZE << " in " << filename << std::endl;
+        return model;
+    }
+    if (W2Inputs != hiddenSize) {
+        std::cerr << "Quantized model layers do not fit together in " << filename << std::endl;
+        return model;
+    }
+    const int64_t expectedSize = static_cast<int64_t>(sizeof(header)) + hiddenSize * inputSize + outputSize * hiddenSize +
+                                 static_cast<int64_t>(sizeof(float)) * 2 * (hiddenSize + outputSize);
+    if (fileSize != expectedSize) {
+        std::cerr << "Quantized model file has " << fileSize << " bytes, its header implies " << expectedSize << ": " << filename << std::endl;
+        return model;
+    }
+
+    model.W1.resize(header[1], header[2]);
+    model.W2.resize(header[3], header[4]);
+    model.W1Scales.resize(header[1]);
+    model.b1.resize(header[1]);
+    model.W2Scales.resize(header[3]);
+    model.b2.resize(header[3]);
+
+    file.read(reinterpret_cast<char*>(model.W1.data()), model.W1.size());
+    file.read(reinterpret_cast<char*>(model.W2.data()), model.W2.size());
+    file.read(reinterpret_cast<char*>(model.W1Scales.data()), sizeof(float) * model.W1Scales.size());
+    file.read(reinterpret_cast<char*>(model.b1.data()), sizeof(float) * model.b1.size());
+    file.read(reinterpret_cast<char*>(model.W2Scales.data()), sizeof(float) * model.W2Scales.size());
+    file.read(reinterpret_cast<char*>(model.b2.data()), sizeof(float) * model.b2.size());
+
+    if (!file) {
+        std::cerr << "Quantized model file is truncated: " << filename << std::endl;
+        return QuantizedModel();
+    }
+
+    return model;
+}
+
+/**
+ * @brief Integer dot product of two int16 vectors.
+ *
+ * A plain loop over contiguous memory that the compiler turns into SIMD multiply-adds
+ * (pmaddwd and friends). Weights are within [-128, 127] and pixels within [0, 255], so
+ * the sum fits in 32 bits for up to MAX_QUANTIZED_INPUT_SIZE elements, which
+ * loadQuantizedParameters enforces.
+ *
+ * @param weights The widened int8 weights.
+ * @param pixels The widened pixels.
+ * @param length The number of elements.
+ * @return The exact integer dot product.
+ */
+static int32_t dotInt16(const int16_t* weights, const int16_t* pixels, Eigen::Index length) {
+    int32_t sum = 0;
+    for (Eigen::Index k = 0; k < length; ++k) {
+        sum += static_cast<int32_t>(weights[k]) * static_cast<int32_t>(pixels[k]);
+    }
+    return sum;
+}
+
+/**
+ * @brief Classify raw 8-bit images with a quantized model.
+ *
+ * The 784->hidden layer runs entirely in integer arithmetic on the unnormalised pixels;
+ * the row scale and the 1/255 pixel normalisation are applied once to each accumulated
+ * sum. Weights and each image are widened to int16 once, which is the widest multiply-add
+ * available on baseline x86 SIMD. The small hidden->output layer is dequantized up front
+ * and runs in float. Softmax is monotonic, so the prediction is the argmax of the logits.
+ *
+ * @param model The quantized model.
+ * @param pixels The images as raw pixels, one per column.
+ * @param predictions Output, one predicted digit per image.
+ */
+void quantizedClassify(const QuantizedModel& model, const Eigen::Ref<const PixelMatrix>& pixels, Eigen::Ref<Eigen::VectorXi> predictions) {
+    const Eigen::Index hiddenSize = model.W1.rows();
+    const Eigen::Index inputSize = model.W1.cols();
+
+    // Per call setup, independent of the number of images
+    const Eigen::Matrix<int16_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> wideW1 = model.W1.cast<int16_t>();
+    const Eigen::VectorXf hiddenScales = model.W1Scales / 255.0f;  // fold in the pixel normalisation
+    const Eigen::MatrixXf W2 = model.W2Scales.asDiagonal() * model.W2.cast<float>();
+
+    Eigen::Matrix<int16_t, Eigen::Dynamic, 1> image(inputSize);
+    Eigen::VectorXf hidden(hiddenSize);
+    Eigen::VectorXf output(W2.rows());
+
+    for (Eigen::Index j = 0; j < pixels.cols(); ++j) {
+        image = pixels.col(j).cast<int16_t>();
+
+        for (Eigen::Index i = 0; i < hiddenSize; ++i) {
+            float z = static_cast<float>(dotInt16(wideW1.row(i).data(), image.data(), inputSize)) * hiddenScales(i) + model.b1(i);
+            hidden(i) = std::max(z, 0.0f);
+        }
+
+        output.noalias() = W2 * hidden;
+        output += model.b2;
+
+        Eigen::Index prediction;
+        output.maxCoeff(&prediction);
+        predictions(j) = static_cast<int>(prediction);
+    }
+}
+
+/**
+ * @brief Compare a quantized model against the float model it was produced from.
+ *
+ * Prints the accuracy of both models on a labelled dataset (normally t10k), the fraction
+ * of images on which their predictions agree, the size of each model's weights and the
+ * throughput of each inference path.
+ *
+ * @param params The float parameters.
+ * @param model The quantized model.
+ * @param pixels The images as raw pixels, one per column.
+ * @param labels The true labels.
+ */
+void printQuantizationReport(const NetworkParameters& params, const QuantizedModel& model, const PixelMatrix& pixels, const Eigen::VectorXi& labels) {
+    const Eigen::Index numImages = pixels.cols();
+
+    Eigen::MatrixXf images;
+    normalisePixels(pixels, images);
+
+    InferenceEngine engine(params, 1000);
+    Eigen::VectorXi floatPredictions(numImages);
+    Eigen::MatrixXf probabilities(engine.numClasses(), numImages);
+
+    auto start = std::chrono::steady_clock::now();
+    if (!engine.classify(images, floatPredictions, probabilities)) {
+        return;
+    }
+    auto floatEnd = std::chrono::steady_clock::now();
+
+    Eigen::VectorXi int8Predictions(numImages);
+    quantizedClassify(model, pixels, int8Predictions);
+    auto int8End = std::chrono::steady_clock::now();
+
+    double floatSeconds = std::chrono::duration<double>(floatEnd - start).count();
+    double int8Seconds = std::chrono::duration<double>(int8End - floatEnd).count();
+    long agreeing = (floatPredictions.array() == int8Predictions.array()).count();
+
+    std::size_t floatBytes = sizeof(float) * (params.W1.size() + params.b1.size() + params.W2.size() + params.b2.size());
+    std::size_t int8Bytes = model.W1.size() + model.W2.size() +
+                            sizeof(float) * (model.W1Scales.size() + model.b1.size() + model.W2Scales.size() + model.b2.size());
+
+    std::cout << "Quantization report (" << numImages << " images)" << std::endl;
+    std::cout << "  Float accuracy: " << getAccuracy(floatPredictions, labels) << std::endl;
+    std::cout << "  Int8 accuracy:  " << getAccuracy(int8Predictions, labels) << std::endl;
+    std::cout << "  Agreement:      " << static_cast<double>(agreeing) / numImages << std::endl;
+    std::cout << "  Weight bytes:   " << floatBytes << " float, " << int8Bytes << " int8" << std::endl;
+    std::cout << "  Images/sec:     " << numImages / floatSeconds << " float, " << numImages / int8Seconds << " int8" << std::endl;
+}
@@ -0,0 +1,237 @@
+#include "../include/sparse_input.h"
+#include "../include/fixed_network.h"
+
+#include <algorithm>
+
+/**
+ * @brief Measure the fraction of non-zero values of a dataset.
+ *
+ * @param data The dataset, one sample per column.
+ * @return The density, between 0 and 1.
+ */
+template <typename Data>
+static double measureDensity(const Data& data) {
+    if (data.size() == 0) {
+        return 1.0;
+    }
+    return static_cast<double>((data.array() != 0).count()) / static_cast<double>(data.size());
+}
+
+/**
+ * @brief Compress a dense dataset column by column, converting the values kept.
+ *
+ * Every value is written to the next free slot and the slot is only kept if the value is
+ * non-zero, so the scan does not branch on the pixels, which would mispredict constantly.
+ *
+ * @param data The dataset, one sample per column.
+ * @param convert Maps a stored value to the float the network sees.
+ * @return The CSC copy of the dataset.
+ */
+template <typename Data, typename Convert>
+static SparseInputMatrix compressColumns(const Data& data, Convert convert) {
+    const Eigen::Index nonZeros = static_cast<Eigen::Index>((data.array() != 0).count());
+    SparseInputMatrix sparse(data.rows(), data.cols());
+    // One spare slot for the write past the last non-zero
+    sparse.resizeNonZeros(nonZeros + 1);
+
+    int* outerStarts = sparse.outerIndexPtr();
+    int* innerIndices = sparse.innerIndexPtr();
+    float* values = sparse.valuePtr();
+
+    int count = 0;
+    for (Eigen::Index j = 0; j < data.cols(); ++j) {
+        outerStarts[j] = count;
+        const typename Data::Scalar* column = data.data() + j * data.rows();
+        for (int i = 0; i < data.rows(); ++i) {
+            innerIndices[count] = i;
+            values[count] = convert(column[i]);
+            count += column[i] != 0;
+        }
+    }
+    outerStarts[data.cols()] = count;
+    sparse.resizeNonZeros(nonZeros);
+    return sparse;
+}
+
+/**
+ * @brief Measure the fraction of non-zero values of a dataset.
+ *
+ * @param data The dataset, one sample per column.
+ * @return The density, between 0 and 1; compare against SPARSE_INPUT_MAX_DENSITY.
+ */
+double inputDensity(const Eigen::MatrixXf& data) {
+    return measureDensity(data);
+}
+
+/**
+ * @brief Measure the fraction of non-zero pixels of a raw 8-bit dataset.
+ *
+ * @param data The raw pixels, one sample per column.
+ * @return The density, between 0 and 1; compare against SPARSE_INPUT_MAX_DENSITY.
+ */
+double inputDensity(const PixelMatrix& data) {
+    return measureDensity(data);
+}
+
+/**
+ * @brief Build the sparse copy of a dataset, once, before training from it.
+ *
+ * @param data The dataset, one sample per column.
+ * @return The same samples in CSC form.
+ */
+SparseInputMatrix toSparseInput(const Eigen::MatrixXf& data) {
+    return compressColumns(data, [](float value) { return value; });
+}
+
+/**
+ * @brief Build the sparse copy of a raw 8-bit dataset, normalised as gatherBatch does.
+ *
+ * @param data The raw pixels, one sample per column.
+ * @return The samples in CSC form, with values in [0, 1].
+ */
+SparseInputMatrix toSparseInput(const PixelMatrix& data) {
+    return compressColumns(data, [](unsigned char value) { return static_cast<float>(value) / 255.0f; });
+}
+
+/**
+ * @brief Allocate a batch with room for every input of every sample.
+ *
+ * @param inputSize The number of inputs per sample.
+ * @param batchSize The number of samples per batch.
+ */
+SparseBatch::SparseBatch(int inputSize, int batchSize) : matrix_(inputSize, batchSize) {
+    matrix_.reserve(static_cast<Eigen::Index>(inputSize) * batchSize);
+}
+
+/**
+ * @brief Gather a batch of sparse samples through a permutation.
+ *
+ * The sparse counterpart of gatherBatch: the columns permutation.indices()[start, start + batch size)
+ * are copied into the reserved storage, non-zeros only.
+ *
+ * @param data The full dataset in CSC form.
+ * @param labels The labels of the full dataset.
+ * @param permutation The permutation that defines the sample order.
+ * @param start The position in the permutation of the first sample of the batch.
+ * @param batchLabels Output buffer for the batch labels, one per batch column.
+ */
+void SparseBatch::gather(const SparseInputMatrix& data, const Eigen::VectorXi& labels, const DatasetPermutation& permutation, int start, Eigen::VectorXi& batchLabels) {
+    const std::vector<int>& indices = permutation.indices();
+    const int* sourceStarts = data.outerIndexPtr();
+    const int* sourceIndices = data.innerIndexPtr();
+    const float* sourceValues = data.valuePtr();
+
+    int* outerStarts = matrix_.outerIndexPtr();
+    int* innerIndices = matrix_.innerIndexPtr();
+    float* values = matrix_.valuePtr();
+
+    int count = 0;
+    for (int i = 0; i < matrix_.cols(); ++i) {
+        const int column = indices[start + i];
+        const int begin = sourceStarts[column];
+        const int end = sourceStarts[column + 1];
+
+        outerStarts[i] = count;
+        std::copy(sourceIndices + begin, sourceIndices + end, innerIndices + count);
+        std::copy(sourceValues + begin, sourceValues + end, values + count);
+        count += end - begin;
+        batchLabels(i) = labels(column);
+    }
+    outerStarts[matrix_.cols()] = count;
+    matrix_.resizeNonZeros(count);
+}
+
+/**
+ * @brief out = W * X, one output column per sample.
+ *
+ * Each output column is the sum of the columns of W selected by the sample's non-zero inputs,
+ * accumulated in registers when the number of rows is known at compile time.
+ *
+ * @tparam Rows The rows of W, or Eigen::Dynamic.
+ */
+template <int Rows>
+static void productKernel(const Eigen::MatrixXf& W, const SparseInputMatrix& X, Eigen::MatrixXf& out) {
+    typedef Eigen::Matrix<float, Rows, 1> Column;
+    Eigen::Map<const Eigen::Matrix<float, Rows, Eigen::Dynamic>> weights(W.data(), W.rows(), W.cols());
+    Eigen::Map<Eigen::Matrix<float, Rows, Eigen::Dynamic>> result(out.data(), out.rows(), out.cols());
+
+    for (Eigen::Index j = 0; j < X.outerSize(); ++j) {
+        if constexpr (Rows == Eigen::Dynamic) {
+            result.col(j).setZero();
+            for (SparseInputMatrix::InnerIterator it(X, j); it; ++it) {
+                result.col(j).noalias() += it.value() * weights.col(it.index());
+            }
+        } else {
+            Column sum = Column::Zero();
+            for (SparseInputMatrix::InnerIterator it(X, j); it; ++it) {
+                sum.noalias() += it.value() * weights.col(it.index());
+            }
+            result.col(j) = sum;
+        }
+    }
+}
+
+/**
+ * @brief dW = scale * dZ * X^T.
+ *
+ * Each sample adds its scaled column of dZ to the columns of dW selected by its non-zero
+ * inputs; columns of dW for inputs that are zero in the whole batch stay 0.
+ *
+ * @tparam Rows The rows of dZ, or Eigen::Dynamic.
+ */
+template <int Rows>
+static void gradientKernel(const Eigen::MatrixXf& dZ, const SparseInputMatrix& X, float scale, Eigen::MatrixXf& dW) {
+    typedef Eigen::Matrix<float, Rows, 1> Column;
+    Eigen::Map<const Eigen::Matrix<float, Rows, Eigen::Dynamic>> delta(dZ.data(), dZ.rows(), dZ.cols());
+    Eigen::Map<Eigen::Matrix<float, Rows, Eigen::Dynamic>> result(dW.data(), dW.rows(), dW.cols());
+
+    result.setZero();
+    for (Eigen::Index j = 0; j < X.outerSize(); ++j) {
+        if constexpr (Rows == Eigen::Dynamic) {
+            for (SparseInputMatrix::InnerIterator it(X, j); it; ++it) {
+                result.col(it.index()).noalias() += (scale * it.value()) * delta.col(j);
+            }
+        } else {
+            const Column scaled = scale * delta.col(j);
+            for (SparseInputMatrix::InnerIterator it(X, j); it; ++it) {
+                result.col(it.index()).noalias() += it.value() * scaled;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Multiply a dense weight matrix by a batch of sparse inputs.
+ *
+ * The hidden width of the default topology gets a fixed-size kernel; any other width uses
+ * the dynamic one.
+ *
+ * @param W The weights, one column per input.
+ * @param X The inputs, one sample per column.
+ * @param out Preallocated W.rows() x X.cols() result.
+ */
+void sparseInputProduct(const Eigen::MatrixXf& W, const SparseInputMatrix& X, Eigen::MatrixXf& out) {
+    constexpr int HIDDEN = MnistNetwork::FirstBias::RowsAtCompileTime;
+    if (W.rows() == HIDDEN) {
+        productKernel<HIDDEN>(W, X, out);
+    } else {
+        productKernel<Eigen::Dynamic>(W, X, out);
+    }
+}
+
+/**
+ * @brief Compute the weight gradient of a layer fed by a batch of sparse inputs.
+ *
+ * @param dZ The gradient of the layer's pre-activations, one column per sample.
+ * @param X The inputs, one sample per column.
+ * @param scale Applied to the whole product, typically 1 / batch size.
+ * @param dW Preallocated dZ.rows() x X.rows() result.
+ */
+void sparseInputGradient(const Eigen::MatrixXf& dZ, const SparseInputMatrix& X, float scale, Eigen::MatrixXf& dW) {
+    constexpr int HIDDEN = MnistNetwork::FirstBias::RowsAtCompileTime;
+    if (dZ.rows() == HIDDEN) {
+        gradientKernel<HIDDEN>(dZ, X, scale, dW);
+    } else {
+        gradientKernel<Eigen::Dynamic>(dZ, X, scale, dW);
+    }
+}
@@ -0,0 +1,100 @@
+#include "../include/thread_pool.h"
+
+#include <algorithm>
+
+/**
+ * @brief Start a thread pool.
+ *
+ * @param numThreads The total number of threads that run tasks, including the thread that
+ *                   calls parallelFor; numThreads - 1 worker threads are started.
+ */
+ThreadPool::ThreadPool(int numThreads) {
+    for (int i = 1; i < std::max(1, numThreads); ++i) {
+        workers_.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+/**
+ * @brief Stop and join the worker threads.
+ */
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+/**
+ * @brief Run every task of the current generation that has not been claimed yet.
+ *
+ * Tasks are claimed one at a time from a shared atomic counter, so uneven tasks balance
+ * themselves across threads.
+ */
+void ThreadPool::runTasks() {
+    for (int index = nextTask_.fetch_add(1); index < numTasks_; index = nextTask_.fetch_add(1)) {
+        invoke_(context_, index);
+    }
+}
+
+/**
+ * @brief Publish a set of tasks to the workers, help run them and wait for completion.
+ *
+ * @param numTasks The number of tasks.
+ * @param invoke Calls the task with the given index.
+ * @param context The task object passed to invoke.
+ */
+void ThreadPool::run(int numTasks, void (*invoke)(void*, int), void* context) {
+    if (workers_.empty() || numTasks <= 1) {
+        for (int index = 0; index < numTasks; ++index) {
+            invoke(context, index);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        invoke_ = invoke;
+        context_ = context;
+        numTasks_ = numTasks;
+        nextTask_.store(0);
+        busyWorkers_ = static_cast<int>(workers_.size());
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    runTasks();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return busyWorkers_ == 0; });
+}
+
+/**
+ * @brief Body of each worker thread: wait for a new generation of tasks and help run it.
+ */
+void ThreadPool::workerLoop() {
+    unsigned long seenGeneration = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&] { return stopping_ || generation_ != seenGeneration; });
+            if (stopping_) {
+                return;
+            }
+            seenGeneration = generation_;
+        }
+
+        runTasks();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --busyWorkers_;
+        }
+        done_.notify_one();
+    }
+}
@@ -0,0 +1,164 @@
+#include "../include/training_telemetry.h"
+
+#include <iostream>
+
+#include <sys/resource.h>
+
+/**
+ * @brief Write telemetry records to a stream.
+ *
+ * @param output The stream, e.g. std::cout. Must outlive the telemetry.
+ * @param format The initial record format; TELEMETRY_OFF records nothing until changed.
+ */
+TrainingTelemetry::TrainingTelemetry(std::ostream& output, TelemetryFormat format)
+    : output_(output), format_(format) {}
+
+/**
+ * @brief Write telemetry records to a file.
+ *
+ * The file is created, replacing any previous contents, when the first record is written,
+ * so a run that never records leaves it untouched.
+ *
+ * @param filename The file to write.
+ * @param format The initial record format; TELEMETRY_OFF records nothing until changed.
+ */
+TrainingTelemetry::TrainingTelemetry(const std::string& filename, TelemetryFormat format)
+    : filename_(filename), output_(file_), format_(format) {}
+
+/**
+ * @brief Start timing a new epoch with the format currently selected.
+ *
+ * Changing the format during an epoch only takes effect at the next one, so every record
+ * covers a whole epoch.
+ */
+void TrainingTelemetry::startEpoch() {
+    recording_ = format();
+    phaseTimes_.fill(std::chrono::steady_clock::duration::zero());
+    epochStart_ = std::chrono::steady_clock::now();
+}
+
+/**
+ * @brief Finish the epoch and write its record, if the epoch is being recorded.
+ *
+ * @param summary The epoch number, samples processed, loss and accuracies.
+ */
+void TrainingTelemetry::endEpoch(const EpochSummary& summary) {
+    if (!recording()) {
+        return;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - epochStart_).count();
+
+    if (!filename_.empty() && !file_.is_open()) {
+        file_.open(filename_);
+        if (!file_.is_open()) {
+            std::cerr << "Error opening file: " << filename_ << std::endl;
+        }
+    }
+
+    if (recording_ == TELEMETRY_CSV) {
+        writeCsv(summary, seconds, peakResidentSetKilobytes());
+    } else {
+        writeJson(summary, seconds, peakResidentSetKilobytes());
+    }
+    output_.flush();
+    recording_ = TELEMETRY_OFF;
+}
+
+/**
+ * @brief Write one epoch as a CSV line, preceded by the header the first time.
+ *
+ * @param summary The epoch figures.
+ * @param seconds The wall time of the epoch.
+ * @param peakRssKilobytes The peak resident set size of the process so far.
+ */
+void TrainingTelemetry::writeCsv(const EpochSummary& summary, double seconds, long peakRssKilobytes) {
+    if (!csvHeaderWritten_) {
+        output_ << "epoch,samples,seconds,samples_per_second,loss,accuracy,validation_accuracy";
+        for (int phase = 0; phase < NUM_TRAINING_PHASES; ++phase) {
+            output_ << "," << trainingPhaseName(static_cast<TrainingPhase>(phase)) << "_seconds";
+        }
+        output_ << ",peak_rss_kb\n";
+        csvHeaderWritten_ = true;
+    }
+
+    output_ << summary.epoch << "," << summary.samples << "," << seconds << "," << summary.samples / seconds << ","
+            << summary.loss << "," << summary.accuracy << "," << summary.validationAccuracy;
+    for (const auto& elapsed : phaseTimes_) {
+        output_ << "," << std::chrono::duration<double>(elapsed).count();
+    }
+    output_ << "," << peakRssKilobytes << "\n";
+}
+
+/**
+ * @brief Write one epoch as a single-line JSON object.
+ *
+ * @param summary The epoch figures.
+ * @param seconds The wall time of the epoch.
+ * @param peakRssKilobytes The peak resident set size of the process so far.
+ */
+void TrainingTelemetry::writeJson(const EpochSummary& summary, double seconds, long peakRssKilobytes) {
+    output_ << "{\"epoch\": " << summary.epoch << ", \"samples\": " << summary.samples << ", \"seconds\": " << seconds
+            << ", \"samples_per_second\": " << summary.samples / seconds << ", \"loss\": " << summary.loss
+            << ", \"accuracy\": " << summary.accuracy << ", \"validation_accuracy\": " << summary.validationAccuracy
+            << ", \"phase_seconds\": {";
+    for (int phase = 0; phase < NUM_TRAINING_PHASES; ++phase) {
+        output_ << (phase > 0 ? ", " : "") << "\"" << trainingPhaseName(static_cast<TrainingPhase>(phase)) << "\": "
+                << std::chrono::duration<double>(phaseTimes_[phase]).count();
+    }
+    output_ << "}, \"peak_rss_kb\": " << peakRssKilobytes << "}\n";
+}
+
+/**
+ * @brief The name of a phase as used in the telemetry records.
+ *
+ * @param phase The phase.
+ * @return The lower-case name.
+ */
+const char* trainingPhaseName(TrainingPhase phase) {
+    switch (phase) {
+        case PHASE_SHUFFLE: return "shuffle";
+        case PHASE_DATA: return "data";
+        case PHASE_FORWARD: return "forward";
+        case PHASE_BACKWARD: return "backward";
+        case PHASE_UPDATE: return "update";
+        case PHASE_VALIDATION: return "validation";
+        default: return "unknown";
+    }
+}
+
+/**
+ * @brief Parse a telemetry format name, e.g. from an environment variable.
+ *
+ * @param name "csv", "json" or "off".
+ * @param fallback The format returned for any other name.
+ * @return The format.
+ */
+TelemetryFormat parseTelemetryFormat(const std::string& name, TelemetryFormat fallback) {
+    if (name == "csv") {
+        return TELEMETRY_CSV;
+    }
+    if (name == "json") {
+        return TELEMETRY_JSON;
+    }
+    if (name == "off") {
+        return TELEMETRY_OFF;
+    }
+    return fallback;
+}
+
+/**
+ * @brief The peak resident set size of the process.
+ *
+ * @return The high-water mark of physical memory use in kilobytes, or 0 if unavailable.
+ */
+long peakResidentSetKilobytes() {
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;  // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+}
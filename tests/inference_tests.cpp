@@ -0,0 +1,61 @@
+#include "test_framework.h"
+#include "test_data.h"
+#include "../include/evaluation.h"
+#include "../include/inference_engine.h"
+
+TEST_CASE("inference.classify_matches_forward_propagation") {
+    const NetworkParameters params = randomNetwork(784, 10, 10, 11);
+    const Eigen::MatrixXf images = randomImages(784, 25, 12);
+    InferenceEngine engine(params, 8);
+
+    Eigen::VectorXi labels(25);
+    Eigen::MatrixXf probabilities(10, 25);
+    CHECK(engine.classify(images, labels, probabilities));
+
+    const Eigen::MatrixXf expected = runImageThroughNetwork(images, params.W1, params.b1, params.W2, params.b2);
+    CHECK(probabilities.isApprox(expected, 1e-5f));
+    for (int j = 0; j < 25; ++j) {
+        Eigen::Index best;
+        expected.col(j).maxCoeff(&best);
+        CHECK(labels(j) == best);
+    }
+}
+
+TEST_CASE("inference.classify_rejects_mismatched_buffers") {
+    InferenceEngine engine(randomNetwork(784, 10, 10, 13), 8);
+    Eigen::VectorXi labels = Eigen::VectorXi::Constant(4, -1);
+    Eigen::MatrixXf probabilities = Eigen::MatrixXf::Constant(10, 4, -1.0f);
+
+    // Images of the wrong size, and output buffers for another batch size, leave the outputs untouched
+    CHECK(!engine.classify(randomImages(100, 4, 14), labels, probabilities));
+    CHECK(!engine.classify(randomImages(784, 3, 15), labels, probabilities));
+    CHECK((labels.array() == -1).all());
+    CHECK((probabilities.array() == -1.0f).all());
+
+    InferenceEngine missing("does-not-exist.bin", 8);
+    CHECK(!missing.isLoaded());
+    CHECK(!missing.classify(randomImages(784, 4, 16), labels, probabilities));
+}
+
+TEST_CASE("inference.evaluator_skips_invalid_labels") {
+    const NetworkParameters params = randomNetwork(784, 10, 10, 16);
+    const Eigen::MatrixXf images = randomImages(784, 30, 17);
+    Eigen::VectorXi labels = randomLabels(30, 10, 18);
+    labels(3) = -1;
+    labels(20) = 10;
+
+    Evaluator evaluator(10, 10, 8);
+    const EvaluationReport& report = evaluator.evaluate(NetworkView(params), images, labels);
+    CHECK(report.numInvalidLabels == 2);
+    CHECK(report.numSamples == 28);
+    CHECK(report.confusion.sum() == 28);
+    CHECK(report.numCorrect == report.confusion.trace());
+
+    // Raw pixels are normalised into a buffer allocated on first use, with the same result
+    const PixelMatrix pixels = (images * 255.0f).array().round().cast<unsigned char>().matrix();
+    const Eigen::MatrixXf normalised = pixels.cast<float>() / 255.0f;
+    const EvaluationReport floatReport = evaluator.evaluate(NetworkView(params), normalised, labels);
+    const EvaluationReport& byteReport = evaluator.evaluate(NetworkView(params), pixels, labels);
+    CHECK(byteReport.numInvalidLabels == 2 && byteReport.confusion == floatReport.confusion);
+    CHECK_NEAR(byteReport.totalLoss, floatReport.totalLoss, 1e-4);
+}
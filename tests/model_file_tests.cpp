@@ -0,0 +1,223 @@
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "test_framework.h"
+#include "test_data.h"
+#include "../include/checkpoint.h"
+#include "../include/model_format.h"
+#include "../include/parameter_handler.h"
+#include "../include/quantization.h"
+
+TEST_CASE("model_files.quantized_round_trip") {
+    const QuantizedModel model = quantizeParameters(randomNetwork(784, 10, 10, 21));
+    const std::string filename = temporaryFile("model.q8");
+    saveQuantizedParameters(model, filename);
+
+    const QuantizedModel loaded = loadQuantizedParameters(filename);
+    CHECK(loaded.W1 == model.W1);
+    CHECK(loaded.W2 == model.W2);
+    CHECK(loaded.W1Scales == model.W1Scales);
+    CHECK(loaded.b1 == model.b1);
+    CHECK(loaded.W2Scales == model.W2Scales);
+    CHECK(loaded.b2 == model.b2);
+}
+
+TEST_CASE("model_files.quantized_rejects_bad_headers") {
+    const std::string filename = temporaryFile("model.q8");
+    saveQuantizedParameters(quantizeParameters(randomNetwork(784, 10, 10, 22)), filename);
+    const std::vector<char> valid = readFileBytes(filename);
+
+    // Header words 1 to 4 are the rows and columns of W1 and W2
+    auto withHeaderWord = [&](int index, std::int32_t value) {
+        std::vector<char> bytes = valid;
+        std::memcpy(bytes.data() + index * sizeof(std::int32_t), &value, sizeof(value));
+        return bytes;
+    };
+    const std::vector<std::vector<char>> corrupted = {
+        withHeaderWord(1, 0),           // no hidden units
+        withHeaderWord(2, -784),        // negative input size
+        withHeaderWord(2, 0x7fffffff),  // absurd input size, which must not be allocated
+        withHeaderWord(4, 11),          // W2 does not take W1's outputs
+        std::vector<char>(valid.begin(), valid.end() - 1),  // truncated
+    };
+    for (const std::vector<char>& bytes : corrupted) {
+        writeFileBytes(filename, bytes);
+        const QuantizedModel loaded = loadQuantizedParameters(filename);
+        CHECK(loaded.W1.size() == 0 && loaded.W2.size() == 0 && loaded.b1.size() == 0);
+    }
+
+    // A consistent file whose inputs are too many for the int32 dot products is rejected too
+    saveQuantizedParameters(quantizeParameters(randomNetwork(70000, 2, 10, 23)), filename);
+    CHECK(loadQuantizedParameters(filename).W1.size() == 0);
+}
+
+TEST_CASE("model_files.layer_stack_round_trip") {
+    LayerStack stack(784, multiLayerPerceptron({32, 16}, 10), 23u);
+    const std::string filename = temporaryFile("stack.bin");
+    CHECK(saveLayerStack(stack, filename));
+    ModelFile model(filename);
+    CHECK(model.hasModelHeader() && model.isValid());
+
+    std::optional<LayerStack> loaded = loadLayerStack(filename);
+    CHECK(loaded.has_value());
+    CHECK(loaded->inputSize() == 784 && loaded->numLayers() == stack.numLayers() && loaded->outputSize() == 10);
+    for (int i = 0; i < stack.numLayers(); ++i) {
+        CHECK(loaded->layers()[i].type == stack.layers()[i].type && loaded->layers()[i].units == stack.layers()[i].units);
+    }
+    CHECK(loaded->parameters() == stack.parameters());
+}
+
+TEST_CASE("model_files.layer_stack_loads_two_layer_models") {
+    const NetworkParameters params = randomNetwork(784, 10, 10, 24);
+    const std::string filename = temporaryFile("model.bin");
+    CHECK(saveParameters(params.W1, params.b1, params.W2, params.b2, filename));
+
+    std::optional<LayerStack> loaded = loadLayerStack(filename);
+    CHECK(loaded.has_value());
+    CHECK(loaded->weights(0) == params.W1 && loaded->bias(0) == params.b1);
+    CHECK(loaded->weights(2) == params.W2 && loaded->bias(2) == params.b2);
+}
+
+TEST_CASE("model_files.rejects_corrupt_model_files") {
+    const NetworkParameters params = randomNetwork(784, 10, 10, 25);
+    const std::string filename = temporaryFile("model.bin");
+    CHECK(saveParameters(params.W1, params.b1, params.W2, params.b2, filename));
+    const std::vector<char> valid = readFileBytes(filename);
+
+    // One flipped bit in the last tensor fails the checksum
+    std::vector<char> bytes = valid;
+    bytes.back() ^= 1;
+    writeFileBytes(filename, bytes);
+    CHECK(!ModelFile(filename).isValid());
+    CHECK(std::get<0>(loadParameters(filename)).size() == 0);
+    CHECK(!loadLayerStack(filename).has_value());
+
+    // A file from a machine of the other byte order is recognised, not read as a legacy file
+    bytes = valid;
+    std::swap(bytes[0], bytes[3]);
+    std::swap(bytes[1], bytes[2]);
+    writeFileBytes(filename, bytes);
+    ModelFile swapped(filename);
+    CHECK(swapped.hasModelHeader() && !swapped.isValid());
+    CHECK(std::get<0>(loadParameters(filename)).size() == 0);
+
+    // A descriptor whose byte size wraps to 0 is rejected even with a matching checksum
+    bytes = valid;
+    TensorDescriptor descriptor;
+    std::memcpy(&descriptor, bytes.data() + sizeof(ModelFileHeader), sizeof(descriptor));
+    descriptor.rows = descriptor.cols = 1u << 31;
+    descriptor.size = 0;
+    std::memcpy(bytes.data() + sizeof(ModelFileHeader), &descriptor, sizeof(descriptor));
+    ModelFileHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    header.checksum = crc32(reinterpret_cast<const unsigned char*>(bytes.data()) + sizeof(header), bytes.size() - sizeof(header));
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    writeFileBytes(filename, bytes);
+    CHECK(!ModelFile(filename).isValid());
+
+    LayerStack stack(20, multiLayerPerceptron({10}, 10), 26u);
+    CHECK(saveLayerStack(stack, filename));
+    bytes = readFileBytes(filename);
+    bytes.back() ^= 1;
+    writeFileBytes(filename, bytes);
+    CHECK(!loadLayerStack(filename).has_value());
+}
+
+TEST_CASE("model_files.layer_stack_rejects_mismatched_tensors") {
+    const std::string filename = temporaryFile("stack.bin");
+    const std::uint32_t inputSize = 20;
+    const WordMatrix layers = (WordMatrix(2, 2) << DENSE, SOFTMAX, 10, 0).finished();
+    const Eigen::MatrixXf W = Eigen::MatrixXf::Zero(10, 19);
+    const Eigen::VectorXf b = Eigen::VectorXf::Zero(10);
+    CHECK(saveModelFile({{"input_size", &inputSize, 1, 1, TENSOR_UINT32},
+                         {"layers", layers.data(), layers.rows(), layers.cols(), TENSOR_UINT32},
+                         {"layer0.weights", W.data(), W.rows(), W.cols()},
+                         {"layer0.bias", b.data(), b.rows(), 1}}, filename));
+    CHECK(!loadLayerStack(filename).has_value());
+
+    // The description alone, without the tensors of its dense layer
+    CHECK(saveModelFile({{"input_size", &inputSize, 1, 1, TENSOR_UINT32},
+                         {"layers", layers.data(), layers.rows(), layers.cols(), TENSOR_UINT32}}, filename));
+    CHECK(!loadLayerStack(filename).has_value());
+}
+
+TEST_CASE("model_files.layer_stack_validation") {
+    CHECK(validateLayerStack(784, multiLayerPerceptron({10}, 10)).empty());
+    CHECK(!validateLayerStack(0, multiLayerPerceptron({10}, 10)).empty());
+    CHECK(!validateLayerStack(784, {}).empty());
+    CHECK(!validateLayerStack(784, {{DENSE, 10}, {RELU}}).empty());
+    CHECK(!validateLayerStack(784, {{DENSE, 10}, {SOFTMAX}, {SOFTMAX}}).empty());
+    CHECK(!validateLayerStack(784, {{DENSE, 0}, {SOFTMAX}}).empty());
+    CHECK(!validateLayerStack(784, {{DENSE, MAX_LAYER_STACK_WIDTH + 1}, {SOFTMAX}}).empty());
+    CHECK(layerStackParameterCount(784, multiLayerPerceptron({10}, 10)) == 784 * 10 + 10 + 10 * 10 + 10);
+}
+
+/**
+ * @brief Write a model file holding only the description of a layer stack, without its tensors.
+ *
+ * @param filename The file to write.
+ * @param inputSize The "input_size" tensor.
+ * @param layers The (type, units) pairs of the "layers" tensor.
+ */
+static void writeLayerStackDescription(const std::string& filename, std::uint32_t inputSize, const std::vector<std::pair<int, int>>& layers) {
+    WordMatrix description(2, layers.size());
+    for (std::size_t i = 0; i < layers.size(); ++i) {
+        description(0, i) = static_cast<std::uint32_t>(layers[i].first);
+        description(1, i) = static_cast<std::uint32_t>(layers[i].second);
+    }
+    saveModelFile({{"input_size", &inputSize, 1, 1, TENSOR_UINT32},
+                   {"layers", description.data(), description.rows(), description.cols(), TENSOR_UINT32}}, filename);
+}
+
+TEST_CASE("model_files.layer_stack_rejects_malformed_files") {
+    const std::string filename = temporaryFile("stack.bin");
+
+    // Each of these used to exit the process or throw from an allocation instead of returning nothing
+    const std::vector<std::pair<std::uint32_t, std::vector<std::pair<int, int>>>> malformed = {
+        {20, {{DENSE, 0}, {RELU, 0}, {DENSE, 10}, {SOFTMAX, 0}}},        // dense layer without units
+        {20, {{DENSE, 10}, {RELU, 0}, {DENSE, 10}, {RELU, 0}}},          // no softmax at the end
+        {20, {{DENSE, 10}, {SOFTMAX, 0}, {DENSE, 10}, {SOFTMAX, 0}}},    // softmax in the middle
+        {20, {{SOFTMAX + 1, 10}, {SOFTMAX, 0}}},                         // unknown layer type
+        {0x7fffffff, {{DENSE, 10}, {SOFTMAX, 0}}},                       // absurd input size
+        {1 << 20, {{DENSE, 1 << 20}, {DENSE, 1 << 20}, {SOFTMAX, 0}}},   // 2^40 parameters, not in the file
+        {20, std::vector<std::pair<int, int>>(MAX_LAYER_STACK_LAYERS + 1, {RELU, 0})},  // too many layers
+    };
+    for (const auto& [inputSize, layers] : malformed) {
+        writeLayerStackDescription(filename, inputSize, layers);
+        CHECK(!loadLayerStack(filename).has_value());
+    }
+}
+
+TEST_CASE("model_files.checkpoint_round_trip") {
+    const NetworkParameters params = randomNetwork(784, 10, 10, 27);
+    DatasetPermutation permutation(30, 28u);
+    permutation.shuffle();
+
+    TrainingCheckpoint checkpoint;
+    checkpoint.W1 = params.W1;
+    checkpoint.b1 = params.b1;
+    checkpoint.W2 = params.W2;
+    checkpoint.b2 = params.b2;
+    checkpoint.optimizerState = {OPTIMIZER_ADAM, 1000003, {Eigen::MatrixXf::Constant(10, 784, 0.25f), Eigen::MatrixXf::Constant(10, 1, -1.0f)}};
+    checkpoint.completed = 7;
+    checkpoint.permutation = permutation.indices();
+    checkpoint.generatorState = permutation.generatorState();
+
+    const std::string filename = temporaryFile("checkpoint.bin");
+    CHECK(saveCheckpoint(checkpoint, filename));
+    std::optional<TrainingCheckpoint> loaded = loadCheckpoint(filename);
+    CHECK(loaded.has_value());
+    CHECK(loaded->W1 == checkpoint.W1 && loaded->b1 == checkpoint.b1 && loaded->W2 == checkpoint.W2 && loaded->b2 == checkpoint.b2);
+    CHECK(loaded->completed == 7);
+    CHECK(loaded->permutation == checkpoint.permutation && loaded->generatorState == checkpoint.generatorState);
+    CHECK(loaded->optimizerState.type == OPTIMIZER_ADAM && loaded->optimizerState.steps == 1000003);
+    const std::vector<Eigen::MatrixXf>& buffers = loaded->optimizerState.buffers;
+    CHECK(buffers.size() == 2 && buffers[0] == checkpoint.optimizerState.buffers[0] && buffers[1] == checkpoint.optimizerState.buffers[1]);
+
+    // A damaged checkpoint is not resumed from
+    std::vector<char> bytes = readFileBytes(filename);
+    bytes[bytes.size() / 2] ^= 1;
+    writeFileBytes(filename, bytes);
+    CHECK(!loadCheckpoint(filename).has_value());
+}
@@ -0,0 +1,81 @@
+#ifndef TEST_DATA
+#define TEST_DATA
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+
+#include "../include/neural_network.h"
+
+// Synthetic digit-like inputs: pixels in [0, 1], of which roughly density are non-zero
+inline Eigen::MatrixXf randomImages(int rows, int cols, unsigned int seed, double density = 0.2) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> value(0.0f, 1.0f);
+    std::bernoulli_distribution nonZero(density);
+    return Eigen::MatrixXf::NullaryExpr(rows, cols, [&]() { return nonZero(generator) ? value(generator) : 0.0f; });
+}
+
+inline Eigen::VectorXi randomLabels(int size, int numClasses, unsigned int seed) {
+    std::mt19937 generator(seed);
+    std::uniform_int_distribution<int> label(0, numClasses - 1);
+    return Eigen::VectorXi::NullaryExpr(size, [&]() { return label(generator); });
+}
+
+// A two-layer network of any shape with small random parameters
+inline NetworkParameters randomNetwork(int inputSize, int hiddenSize, int outputSize, unsigned int seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> value(-0.5f, 0.5f);
+    auto draw = [&]() { return value(generator); };
+    NetworkParameters params;
+    params.W1 = Eigen::MatrixXf::NullaryExpr(hiddenSize, inputSize, draw);
+    params.b1 = Eigen::VectorXf::NullaryExpr(hiddenSize, draw);
+    params.W2 = Eigen::MatrixXf::NullaryExpr(outputSize, hiddenSize, draw);
+    params.b2 = Eigen::VectorXf::NullaryExpr(outputSize, draw);
+    return params;
+}
+
+// A path in the temp directory for a test to write; any file left there by an earlier run is removed
+inline std::string temporaryFile(const std::string& name) {
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / ("number_classifier_test_" + name);
+    std::filesystem::remove(path);
+    return path.string();
+}
+
+// Write images with values in [0, 1] and their labels as an IDX3 image file and an IDX1 label file
+inline void writeIdxFiles(const std::string& imageFile, const std::string& labelFile, const Eigen::MatrixXf& images, int width, const Eigen::VectorXi& labels) {
+    auto writeBigEndian32 = [](std::ofstream& file, int value) {
+        const char bytes[4] = {static_cast<char>(value >> 24), static_cast<char>(value >> 16), static_cast<char>(value >> 8), static_cast<char>(value)};
+        file.write(bytes, 4);
+    };
+
+    std::ofstream imageStream(imageFile, std::ios::binary | std::ios::trunc);
+    writeBigEndian32(imageStream, 2051);
+    writeBigEndian32(imageStream, static_cast<int>(images.cols()));
+    writeBigEndian32(imageStream, static_cast<int>(images.rows()) / width);
+    writeBigEndian32(imageStream, width);
+    for (float value : images.reshaped()) {
+        imageStream.put(static_cast<char>(static_cast<unsigned char>(value * 255.0f + 0.5f)));
+    }
+
+    std::ofstream labelStream(labelFile, std::ios::binary | std::ios::trunc);
+    writeBigEndian32(labelStream, 2049);
+    writeBigEndian32(labelStream, static_cast<int>(labels.size()));
+    for (int label : labels) {
+        labelStream.put(static_cast<char>(label));
+    }
+}
+
+inline std::vector<char> readFileBytes(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+inline void writeFileBytes(const std::string& filename, const std::vector<char>& bytes) {
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef TEST_FRAMEWORK
+#define TEST_FRAMEWORK
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * A minimal test harness: TEST_CASE registers a function under a name, CHECK fails the
+ * running test with the file, line and condition. test_main.cpp runs every test whose name
+ * starts with the first command line argument, or all of them.
+ */
+
+struct TestFailure : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+struct TestCase {
+    std::string name;
+    void (*run)();
+};
+
+std::vector<TestCase>& testRegistry();
+
+struct TestRegistration {
+    TestRegistration(const char* name, void (*run)()) { testRegistry().push_back({name, run}); }
+};
+
+#define TEST_CONCAT_INNER(a, b) a##b
+#define TEST_CONCAT(a, b) TEST_CONCAT_INNER(a, b)
+
+#define TEST_CASE(name)                                                                      \
+    static void TEST_CONCAT(testFunction, __LINE__)();                                       \
+    static TestRegistration TEST_CONCAT(testRegistration, __LINE__)(name, TEST_CONCAT(testFunction, __LINE__)); \
+    static void TEST_CONCAT(testFunction, __LINE__)()
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::ostringstream message;                                                      \
+            message << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed";      \
+            throw TestFailure(message.str());                                                \
+        }                                                                                    \
+    } while (false)
+
+#define CHECK_NEAR(a, b, tolerance) CHECK(std::abs((a) - (b)) <= (tolerance))
+
+#endif
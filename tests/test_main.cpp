@@ -0,0 +1,37 @@
+#include <exception>
+#include <iostream>
+
+#include "test_framework.h"
+
+/**
+ * @brief The tests registered by TEST_CASE, in registration order.
+ *
+ * @return The registry, created on first use so registration order across files does not matter.
+ */
+std::vector<TestCase>& testRegistry() {
+    static std::vector<TestCase> tests;
+    return tests;
+}
+
+int main(int argc, char** argv) {
+    const std::string prefix = argc > 1 ? argv[1] : "";
+
+    int run = 0;
+    int failed = 0;
+    for (const TestCase& test : testRegistry()) {
+        if (test.name.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        ++run;
+        try {
+            test.run();
+            std::cout << "[pass] " << test.name << std::endl;
+        } catch (const std::exception& error) {
+            ++failed;
+            std::cout << "[FAIL] " << test.name << ": " << error.what() << std::endl;
+        }
+    }
+
+    std::cout << run - failed << " of " << run << " tests passed" << std::endl;
+    return failed == 0 && run > 0 ? 0 : 1;
+}
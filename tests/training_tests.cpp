@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "test_framework.h"
+#include "test_data.h"
+#include "../include/allocation_counter.h"
+#include "../include/data_parallel.h"
+#include "../include/idx_stream.h"
+#include "../include/layer_stack.h"
+#include "../include/neural_network.h"
+#include "../include/optimizer.h"
+#include "../include/sparse_input.h"
+
+/**
+ * @brief Count the heap allocations of warmed-up training steps.
+ *
+ * @param params The network to train; its shape selects the fixed-size or the dynamic kernels.
+ * @return The allocations made by five steps after a first warm-up step.
+ */
+static std::size_t stepAllocations(NetworkParameters params) {
+    const int batchSize = 64;
+    Eigen::MatrixXf X = randomImages(static_cast<int>(params.W1.cols()), batchSize, 1);
+    Eigen::VectorXi Y = randomLabels(batchSize, static_cast<int>(params.W2.rows()), 2);
+    TrainingWorkspace workspace(static_cast<int>(params.W1.cols()), static_cast<int>(params.W1.rows()), static_cast<int>(params.W2.rows()), batchSize);
+
+    trainingStep(params, X, Y, 0.1f, workspace);
+    const std::size_t before = heapAllocationCount();
+    for (int step = 0; step < 5; ++step) {
+        trainingStep(params, X, Y, 0.1f, workspace);
+    }
+    return heapAllocationCount() - before;
+}
+
+TEST_CASE("training.step_does_not_allocate") {
+    if (!heapAllocationCountingSupported()) {
+        std::cout << "  allocation counting is not supported on this platform, skipped" << std::endl;
+        return;
+    }
+
+    // The default 784-10-10 network runs the fixed-size kernels, any other shape the dynamic ones.
+    // Products larger than EIGEN_STACK_ALLOCATION_LIMIT take their packing buffers from the heap,
+    // so the dynamic shape is kept small
+    CHECK(stepAllocations(randomNetwork(784, 10, 10, 3)) == 0);
+    CHECK(stepAllocations(randomNetwork(196, 16, 10, 4)) == 0);
+}
+
+TEST_CASE("training.layer_stack_step_does_not_allocate") {
+    if (!heapAllocationCountingSupported()) {
+        std::cout << "  allocation counting is not supported on this platform, skipped" << std::endl;
+        return;
+    }
+
+    // A deeper stack than the default network still takes all of its buffers from the arena
+    LayerStack stack(196, multiLayerPerceptron({16, 16}, 10), 26u);
+    const Eigen::MatrixXf X = randomImages(196, 64, 27);
+    const Eigen::VectorXi Y = randomLabels(64, 10, 28);
+    stack.reserve(64);
+
+    stack.trainingStep(X, Y, 0.1f);
+    const std::size_t before = heapAllocationCount();
+    for (int step = 0; step < 5; ++step) {
+        stack.trainingStep(X, Y, 0.1f);
+    }
+    CHECK(heapAllocationCount() - before == 0);
+}
+
+TEST_CASE("training.workspace_step_matches_tuple_api") {
+    const NetworkParameters params = randomNetwork(784, 10, 10, 5);
+    const Eigen::MatrixXf X = randomImages(784, 50, 6);
+    const Eigen::VectorXi Y = randomLabels(50, 10, 7);
+
+    TrainingWorkspace workspace(784, 10, 10, 50);
+    computeGradients(params, X, Y, workspace);
+
+    Eigen::MatrixXf Z1, A1, Z2, A2, dW1, db1, dW2, db2;
+    std::tie(Z1, A1, Z2, A2) = forwardPropagation(params.W1, params.b1, params.W2, params.b2, X);
+    std::tie(dW1, db1, dW2, db2) = backwardPropagation(Z1, A1, Z2, A2, params.W1, params.W2, X, Y);
+
+    CHECK(workspace.A2.isApprox(A2, 1e-5f));
+    CHECK(workspace.dW1.isApprox(dW1, 1e-4f));
+    CHECK(workspace.db1.isApprox(db1, 1e-4f));
+    CHECK(workspace.dW2.isApprox(dW2, 1e-4f));
+    CHECK(workspace.db2.isApprox(db2, 1e-4f));
+}
+
+TEST_CASE("training.sparse_step_matches_dense_step") {
+    const NetworkParameters params = randomNetwork(784, 10, 10, 23);
+    const Eigen::MatrixXf X = randomImages(784, 50, 24);
+    const Eigen::VectorXi Y = randomLabels(50, 10, 25);
+    const SparseInputMatrix sparseX = toSparseInput(X);
+
+    TrainingWorkspace dense(784, 10, 10, 50);
+    forwardPass(params, X, Y, dense);
+    backwardPass(params, X, Y, dense);
+    TrainingWorkspace sparse(784, 10, 10, 50);
+    forwardPass(params, sparseX, Y, sparse);
+    backwardPass(params, sparseX, Y, sparse);
+
+    CHECK_NEAR(sparse.loss, dense.loss, 1e-5f);
+    CHECK(sparse.A2.isApprox(dense.A2, 1e-5f));
+    CHECK(sparse.dW1.isApprox(dense.dW1, 1e-4f));
+    CHECK(sparse.db1.isApprox(dense.db1, 1e-4f));
+    CHECK(sparse.dW2.isApprox(dense.dW2, 1e-4f));
+    CHECK(sparse.db2.isApprox(dense.db2, 1e-4f));
+}
+
+TEST_CASE("training.layer_stack_matches_two_layer_network") {
+    const NetworkParameters params = randomNetwork(784, 10, 10, 8);
+    const Eigen::MatrixXf X = randomImages(784, 40, 9);
+    const Eigen::VectorXi Y = randomLabels(40, 10, 10);
+
+    TrainingWorkspace workspace(784, 10, 10, 40);
+    computeGradients(params, X, Y, workspace);
+
+    LayerStack stack(params);
+    const float loss = stack.computeGradients(X, Y);
+    CHECK_NEAR(loss, workspace.loss, 1e-5f);
+
+    // The flat gradient vector holds each dense layer's weights then its bias, like the parameters
+    const Eigen::VectorXf& gradients = stack.gradients();
+    CHECK(gradients.segment(0, 7840).isApprox(workspace.dW1.reshaped(), 1e-4f));
+    CHECK(gradients.segment(7840, 10).isApprox(workspace.db1, 1e-4f));
+    CHECK(gradients.segment(7850, 100).isApprox(workspace.dW2.reshaped(), 1e-4f));
+    CHECK(gradients.segment(7950, 10).isApprox(workspace.db2, 1e-4f));
+}
+
+TEST_CASE("training.data_parallel_step_augments_every_shard") {
+    NetworkParameters params = randomNetwork(784, 10, 10, 11);
+    const Eigen::MatrixXf X = randomImages(784, 40, 12);
+    const Eigen::VectorXi Y = randomLabels(40, 10, 13);
+    DatasetPermutation permutation(40, 14u);
+    permutation.shuffle();
+
+    // Halves every image, and records which samples it saw in which epoch
+    std::vector<int> augmented;
+    int augmentedEpoch = -1;
+    BatchAugmentation halve = [&](Eigen::MatrixXf& batch, const int* sampleIndices, int epoch) {
+        batch *= 0.5f;
+        augmented.insert(augmented.end(), sampleIndices, sampleIndices + batch.cols());
+        augmentedEpoch = epoch;
+    };
+
+    ThreadPool pool(3);
+    DataParallelStep step(pool, 784, 10, 10, 16, nullptr, halve);
+    step.startEpoch(2);
+    step.run(params, X, Y, permutation, 8, 0.0f);
+
+    std::vector<int> expected(permutation.indices().begin() + 8, permutation.indices().begin() + 24);
+    std::sort(augmented.begin(), augmented.end());
+    std::sort(expected.begin(), expected.end());
+    CHECK(augmented == expected);
+    CHECK(augmentedEpoch == 2);
+
+    // The reduced gradients are those of the whole augmented batch
+    Eigen::MatrixXf batchX(784, 16);
+    Eigen::VectorXi batchY(16);
+    gatherBatch(X, Y, permutation, 8, batchX, batchY);
+    batchX *= 0.5f;
+    TrainingWorkspace workspace(784, 10, 10, 16);
+    computeGradients(params, batchX, batchY, workspace);
+    CHECK(step.reducedGradients().dW1.isApprox(workspace.dW1, 1e-4f));
+    CHECK(step.reducedGradients().db2.isApprox(workspace.db2, 1e-4f));
+}
+
+TEST_CASE("training.resumed_run_matches_uninterrupted_run") {
+    const Eigen::MatrixXf X = randomImages(784, 120, 15);
+    const Eigen::VectorXi Y = randomLabels(120, 10, 16);
+    TrainingConfig config;
+    config.batchSize = 20;
+    config.seed = 17u;
+    config.optimizer.type = OPTIMIZER_MOMENTUM;
+
+    config.epochs = 4;
+    const auto uninterrupted = miniBatchGradientDescent(X, Y, X, Y, config);
+
+    // Stop after two epochs, then resume from the checkpoint to the fourth
+    config.checkpoint = {temporaryFile("checkpoint.bin"), 1, false};
+    config.epochs = 2;
+    miniBatchGradientDescent(X, Y, X, Y, config);
+    config.checkpoint.resume = true;
+    config.epochs = 4;
+    const auto resumed = miniBatchGradientDescent(X, Y, X, Y, config);
+
+    CHECK(std::get<0>(resumed) == std::get<0>(uninterrupted));
+    CHECK(std::get<1>(resumed) == std::get<1>(uninterrupted));
+    CHECK(std::get<2>(resumed) == std::get<2>(uninterrupted));
+    CHECK(std::get<3>(resumed) == std::get<3>(uninterrupted));
+}
+
+TEST_CASE("training.full_batch_does_not_resume_mini_batch_checkpoints") {
+    const Eigen::MatrixXf X = randomImages(784, 40, 29);
+    const Eigen::VectorXi Y = randomLabels(40, 10, 30);
+    TrainingConfig config;
+    config.batchSize = 20;
+    config.epochs = 1;
+    config.checkpoint = {temporaryFile("checkpoint.bin"), 1, false};
+    miniBatchGradientDescent(X, Y, X, Y, config);
+
+    // Resumed as iteration 1 of 1, the run would do nothing and leave the epoch checkpoint in place
+    config.checkpoint.resume = true;
+    gradientDescent(X, Y, X, Y, 0.1f, 1, nullptr, config.checkpoint);
+    std::optional<TrainingCheckpoint> saved = loadCheckpoint(config.checkpoint.file);
+    CHECK(saved.has_value() && saved->completed == 1 && saved->permutation.empty() && saved->generatorState.empty());
+}
+
+TEST_CASE("training.resumed_stream_matches_uninterrupted_run") {
+    const std::string imageFile = temporaryFile("images.idx3");
+    const std::string labelFile = temporaryFile("labels.idx1");
+    writeIdxFiles(imageFile, labelFile, randomImages(784, 90, 18), 28, randomLabels(90, 10, 19));
+    TrainingConfig config;
+    config.batchSize = 10;
+    config.seed = 20u;
+
+    // Each run reads a new stream with the same seed; 90 samples in chunks of 20 leave a short last chunk
+    auto train = [&]() {
+        IdxStream training(imageFile, labelFile, 20, config.seed);
+        IdxStream validation(imageFile, labelFile, 20);
+        return miniBatchGradientDescent(training, validation, config);
+    };
+
+    config.epochs = 3;
+    const auto uninterrupted = train();
+
+    config.checkpoint = {temporaryFile("checkpoint.bin"), 1, false};
+    config.epochs = 1;
+    train();
+    config.checkpoint.resume = true;
+    config.epochs = 3;
+    const auto resumed = train();
+
+    CHECK(std::get<0>(resumed) == std::get<0>(uninterrupted));
+    CHECK(std::get<3>(resumed) == std::get<3>(uninterrupted));
+}
+
+TEST_CASE("training.permutation_restore_rejects_other_orders") {
+    DatasetPermutation saved(5, 21u);
+    saved.shuffle();
+    DatasetPermutation permutation(5, 22u);
+    CHECK(permutation.restore(saved.indices(), saved.generatorState()));
+    CHECK(permutation.indices() == saved.indices());
+
+    // Wrong size, a repeated index and an index out of range leave the permutation as it was
+    CHECK(!permutation.restore({0, 1, 2, 3}, saved.generatorState()));
+    CHECK(!permutation.restore({0, 1, 2, 3, 3}, saved.generatorState()));
+    CHECK(!permutation.restore({0, 1, 2, 3, 5}, saved.generatorState()));
+    CHECK(!permutation.restore({4, 3, 2, 1, 0}, {}));
+    CHECK(permutation.indices() == saved.indices());
+}
+
+/**
+ * @brief Take optimizer steps on one parameter array with a constant gradient.
+ *
+ * @param config The optimizer.
+ * @param steps The number of steps.
+ * @return The parameters, started at 1 and stepped with gradient 0.5 and learning rate 0.1.
+ */
+static Eigen::ArrayXf optimizeConstantGradient(const OptimizerConfig& config, int steps) {
+    std::unique_ptr<Optimizer> optimizer = makeOptimizer(config, std::vector<Eigen::Index>{3});
+    Eigen::ArrayXf parameters = Eigen::ArrayXf::Ones(3);
+    const Eigen::ArrayXf gradients = Eigen::ArrayXf::Constant(3, 0.5f);
+    for (int i = 0; i < steps; ++i) {
+        optimizer->beginStep();
+        optimizer->update(0, parameters.data(), gradients.data(), 0.1f);
+    }
+    return parameters;
+}
+
+TEST_CASE("training.optimizer_updates") {
+    OptimizerConfig config;
+    CHECK_NEAR(optimizeConstantGradient(config, 2)(0), 0.9f, 1e-6f);
+
+    // Velocity 0.5 then 0.95
+    config.type = OPTIMIZER_MOMENTUM;
+    CHECK_NEAR(optimizeConstantGradient(config, 2)(1), 0.855f, 1e-6f);
+    config.type = OPTIMIZER_NESTEROV;
+    CHECK_NEAR(optimizeConstantGradient(config, 2)(1), 0.7695f, 1e-6f);
+
+    // With a constant gradient the bias-corrected moments are g and g^2, so every step is alpha
+    config.type = OPTIMIZER_ADAM;
+    CHECK_NEAR(optimizeConstantGradient(config, 1)(2), 0.9f, 1e-5f);
+    CHECK_NEAR(optimizeConstantGradient(config, 3)(2), 0.7f, 1e-5f);
+}
+
+TEST_CASE("training.optimizer_restore_checks_type") {
+    const std::vector<Eigen::Index> slots = {3, 2};
+    Eigen::ArrayXf parameters = Eigen::ArrayXf::Ones(3);
+    const Eigen::ArrayXf gradients = Eigen::ArrayXf::LinSpaced(3, -1.0f, 1.0f);
+
+    OptimizerConfig config;
+    config.type = OPTIMIZER_MOMENTUM;
+    std::unique_ptr<Optimizer> momentum = makeOptimizer(config, slots);
+    momentum->update(0, parameters.data(), gradients.data(), 0.1f);
+    config.type = OPTIMIZER_NESTEROV;
+    CHECK(!makeOptimizer(config, slots)->restoreState(momentum->state()));
+    config.type = OPTIMIZER_ADAM;
+    CHECK(!makeOptimizer(config, slots)->restoreState(momentum->state()));
+    config.type = OPTIMIZER_MOMENTUM;
+    CHECK(makeOptimizer(config, slots)->restoreState(momentum->state()));
+    CHECK(!makeOptimizer(config, std::vector<Eigen::Index>{3, 3})->restoreState(momentum->state()));
+
+    // A restored Adam optimizer keeps its step count and continues exactly like the original
+    config.type = OPTIMIZER_ADAM;
+    std::unique_ptr<Optimizer> adam = makeOptimizer(config, slots);
+    for (int i = 0; i < 3; ++i) {
+        adam->beginStep();
+        adam->update(0, parameters.data(), gradients.data(), 0.1f);
+    }
+    CHECK(adam->state().steps == 3);
+    std::unique_ptr<Optimizer> restored = makeOptimizer(config, slots);
+    CHECK(restored->restoreState(adam->state()));
+    Eigen::ArrayXf copy = parameters;
+    adam->beginStep();
+    adam->update(0, parameters.data(), gradients.data(), 0.1f);
+    restored->beginStep();
+    restored->update(0, copy.data(), gradients.data(), 0.1f);
+    CHECK((copy == parameters).all());
+    config.type = OPTIMIZER_SGD;
+    CHECK(!makeOptimizer(config, slots)->restoreState(adam->state()));
+}